@@ -1,5 +1,7 @@
 import ctypes
 import os
+import sys
+import threading
 import time
 import platform
 from ctypes import wintypes
@@ -12,6 +14,8 @@ DLL_PATH = os.path.abspath("x64/Release/libcdshow.dll")
 dll = ctypes.WinDLL(DLL_PATH)  # stdcall
 
 CDS_OK = 0
+CDS_ERR_NOT_STARTED = -5
+CDS_ERR_TIMEOUT = -7
 
 # ==========================
 # Prototypes
@@ -34,6 +38,19 @@ dll.cds_device_format_width.restype = ctypes.c_uint32
 dll.cds_device_format_height.restype = ctypes.c_uint32
 dll.cds_device_format_frame_rate.restype = ctypes.c_uint32
 
+class CdsFormatInfo(ctypes.Structure):
+    _fields_ = [
+        ("width", ctypes.c_uint32),
+        ("height", ctypes.c_uint32),
+        ("max_fps", ctypes.c_uint32),
+        ("fourcc", ctypes.c_uint32),
+        ("stream_caps_index", ctypes.c_uint32),
+        ("type", ctypes.c_char * 12),
+    ]
+
+dll.cds_device_formats_table.restype = ctypes.c_int32
+dll.cds_device_formats_table.argtypes = [ctypes.c_int32, ctypes.POINTER(CdsFormatInfo), ctypes.c_int32]
+
 dll.cds_start_capture_with_format.restype = ctypes.c_int32
 dll.cds_stop_capture.restype = ctypes.c_int32
 
@@ -43,6 +60,25 @@ dll.cds_frame_height.restype = ctypes.c_int32
 
 dll.cds_grab_frame.restype = ctypes.c_int32
 dll.cds_grab_frame.argtypes = [ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t]
+dll.cds_grab_frame_seq.restype = ctypes.c_int32
+dll.cds_grab_frame_seq.argtypes = [ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t, ctypes.POINTER(ctypes.c_uint64)]
+dll.cds_wait_for_frame.restype = ctypes.c_int32
+dll.cds_wait_for_frame.argtypes = [ctypes.c_uint32, ctypes.c_uint64, ctypes.c_uint32]
+
+class CdsFrameInfo(ctypes.Structure):
+    _fields_ = [
+        ("sequence", ctypes.c_uint64),
+        ("sample_time_100ns", ctypes.c_int64),
+        ("arrival_100ns", ctypes.c_uint64),
+        ("arrival_utc_100ns", ctypes.c_uint64),
+        ("width", ctypes.c_int32),
+        ("height", ctypes.c_int32),
+        ("bytes_per_row", ctypes.c_int32),
+        ("size", ctypes.c_size_t),
+    ]
+
+dll.cds_grab_button_frame.restype = ctypes.c_int32
+dll.cds_grab_button_frame.argtypes = [ctypes.c_uint32, ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t, ctypes.POINTER(CdsFrameInfo)]
 
 dll.cds_button_pressed.restype = ctypes.c_int32
 dll.cds_button_timestamp.restype = ctypes.c_uint64
@@ -77,6 +113,62 @@ def pick_device_index():
         return non_fhd[0]
     return devices[0][0]
 
+# ==========================
+# Contention benchmark
+# ==========================
+
+def bench_contention(num_threads=8, seconds=5.0):
+    """Grabs from every camera on num_threads threads at once, then stops the
+    captures while the threads are still grabbing. Per-frame calls should scale
+    with the thread count and only ever fail with CDS_ERR_NOT_STARTED at the end."""
+    if dll.cds_initialize() != CDS_OK:
+        print("cds_initialize failed")
+        return
+
+    started = []
+    for dev in range(dll.cds_devices_count()):
+        if dll.cds_device_formats_count(dev) > 0 and dll.cds_start_capture_with_format(dev, 0) == CDS_OK:
+            started.append(dev)
+    if not started:
+        print("No camera could be started")
+        dll.cds_shutdown_capture_api()
+        return
+    for dev in started:
+        dll.cds_wait_for_frame(dev, 0, 5000)
+
+    stop = threading.Event()
+    calls = [0] * num_threads
+    bad = [0] * num_threads
+
+    def worker(t):
+        dev = started[t % len(started)]
+        size = dll.cds_frame_width(dev) * dll.cds_frame_height(dev) * 4
+        buf = (ctypes.c_uint8 * max(size, 1))()
+        while not stop.is_set():
+            rc = dll.cds_grab_frame(dev, buf, size)
+            dll.cds_frame_width(dev)
+            dll.cds_button_pressed(dev)
+            calls[t] += 3
+            if rc not in (CDS_OK, CDS_ERR_NOT_STARTED):
+                bad[t] += 1
+
+    threads = [threading.Thread(target=worker, args=(t,)) for t in range(num_threads)]
+    t0 = time.perf_counter()
+    for th in threads:
+        th.start()
+    time.sleep(seconds)
+    for dev in started:  # races with the grabbing threads on purpose
+        dll.cds_stop_capture(dev)
+    time.sleep(0.2)
+    stop.set()
+    for th in threads:
+        th.join()
+    elapsed = time.perf_counter() - t0
+
+    print(f"{len(started)} camera(s), {num_threads} threads: "
+          f"{sum(calls) / elapsed:,.0f} calls/s, unexpected errors: {sum(bad)}")
+    dll.cds_shutdown_capture_api()
+
 # ==========================
 # Main
 # ==========================
@@ -103,16 +195,18 @@ def main():
     print("Using device:", get_device_name(dev_index))
     print("Device ID:", get_device_unique_id(dev_index))
 
-    fmt_count = dll.cds_device_formats_count(dev_index)
+    fmt_count = max(dll.cds_device_formats_table(dev_index, None, 0), 0)
+    formats = (CdsFormatInfo * fmt_count)()
+    fmt_count = max(min(dll.cds_device_formats_table(dev_index, formats, fmt_count), fmt_count), 0)
 
     best_fmt = 0
     best_pixels = 0
     best_fps = 0
 
     for i in range(fmt_count):
-        w = dll.cds_device_format_width(dev_index, i)
-        h = dll.cds_device_format_height(dev_index, i)
-        fps = dll.cds_device_format_frame_rate(dev_index, i)
+        w = formats[i].width
+        h = formats[i].height
+        fps = formats[i].max_fps
 
         pixels = w * h
         if pixels > best_pixels or (pixels == best_pixels and fps > best_fps):
@@ -126,8 +220,12 @@ def main():
         return
 
     print("Waiting for first frame...")
-    while not dll.cds_has_first_frame(dev_index):
-        time.sleep(0.05)
+    rc = dll.cds_wait_for_frame(dev_index, 0, 5000)
+    if rc != CDS_OK:
+        print("No frame received:", rc)
+        dll.cds_stop_capture(dev_index)
+        dll.cds_shutdown_capture_api()
+        return
 
     width = dll.cds_frame_width(dev_index)
     height = dll.cds_frame_height(dev_index)
@@ -138,6 +236,7 @@ def main():
     buffer = (ctypes.c_uint8 * frame_size)()
 
     frame_counter = 0
+    info = CdsFrameInfo()
 
     try:
         while True:
@@ -145,7 +244,8 @@ def main():
                 ts = dll.cds_button_timestamp(dev_index)
                 print(f"[BUTTON PRESSED] ts100ns={ts}")
 
-                rc = dll.cds_grab_frame(dev_index, buffer, frame_size)
+                # The frame that was current at the press, not the newest one by now.
+                rc = dll.cds_grab_button_frame(dev_index, buffer, frame_size, ctypes.byref(info))
                 if rc != CDS_OK:
                     print("Frame error:", rc)
                     time.sleep(0.1)
@@ -163,7 +263,7 @@ def main():
 
                 filename = f"frame_{frame_counter:05d}.jpg"
                 img.save(filename, "JPEG", quality=90)
-                print("Saved", filename)
+                print("Saved", filename, "seq", info.sequence)
 
                 frame_counter += 1
 
@@ -178,4 +278,7 @@ def main():
 
 
 if __name__ == "__main__":
-    main()
+    if len(sys.argv) > 1 and sys.argv[1] == "--bench":
+        bench_contention(int(sys.argv[2]) if len(sys.argv) > 2 else 8)
+    else:
+        main()
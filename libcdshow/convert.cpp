@@ -0,0 +1,846 @@
+#if defined(_MSC_VER)
+#define _CRT_SECURE_NO_WARNINGS // getenv
+#endif
+#include "convert.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+// =============================================================================
+// ============================ Pixel conversion ===============================
+// =============================================================================
+// Kernels are plain C++ + intrinsics; the MJPEG decoders and the session code only see
+// convert_frame and the layout helpers in convert.h.
+
+bool calc_out_layout(OutFormat fmt, uint32_t width, uint32_t height, OutLayout& out) {
+    if (width == 0 || height == 0) return false;
+    size_t bpp = 1;
+    if (fmt == OutFormat::Bgra || fmt == OutFormat::Rgba) bpp = 4;
+    else if (fmt == OutFormat::Rgb24) bpp = 3;
+
+    if ((size_t)width > SIZE_MAX / 4) return false;
+    size_t rowBytes = (size_t)width * bpp;
+    if ((size_t)height > (SIZE_MAX / 2) / rowBytes) return false;
+    size_t frameBytes = rowBytes * (size_t)height;
+    if (fmt == OutFormat::I420 || fmt == OutFormat::Nv12)
+        frameBytes += 2 * ((size_t)(width + 1) / 2) * ((size_t)(height + 1) / 2);
+
+    out.fmt = fmt;
+    out.width = width;
+    out.height = height;
+    out.rowBytes = rowBytes;
+    out.frameBytes = frameBytes;
+    return true;
+}
+
+bool calc_geometry(OutFormat fmt, FrameGeometry& g) {
+    uint32_t w = g.scaleW ? g.scaleW : g.roiW;
+    uint32_t h = g.scaleH ? g.scaleH : g.roiH;
+    if (w == 0 || h == 0) return false;
+    if ((uint64_t)w * kMaxDownscale < g.roiW || (uint64_t)h * kMaxDownscale < g.roiH) return false;
+    return calc_out_layout(fmt, w, h, g.out);
+}
+
+// Bytes a sample of this layout must have.
+bool calc_src_frame_bytes(SrcFormat fmt, size_t stride, uint32_t height, size_t& totalBytes) {
+    if (height == 0 || stride == 0) return false;
+    if ((size_t)height > (SIZE_MAX / 2) / stride) return false;
+    totalBytes = stride * (size_t)height;
+    if (fmt == SrcFormat::Nv12) totalBytes += stride * (size_t)((height + 1) / 2);
+    return true;
+}
+
+static inline uint8_t clamp_u8(int v) {
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+static inline void yuv_to_bgra_px(int y, int u, int v, uint8_t* dst) {
+    int c = y - 16, d = u - 128, e = v - 128;
+    dst[0] = clamp_u8((298 * c + 516 * d + 128) >> 8);
+    dst[1] = clamp_u8((298 * c - 100 * d - 208 * e + 128) >> 8);
+    dst[2] = clamp_u8((298 * c + 409 * e + 128) >> 8);
+    dst[3] = 0xFF;
+}
+
+static void yuy2_row_to_bgra_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    uint32_t x = 0;
+    for (; x + 2 <= width; x += 2, src += 4, dst += 8) {
+        yuv_to_bgra_px(src[0], src[1], src[3], dst);
+        yuv_to_bgra_px(src[2], src[1], src[3], dst + 4);
+    }
+    if (x < width) yuv_to_bgra_px(src[0], src[1], src[3], dst);
+}
+
+static void nv12_row_to_bgra_scalar(const uint8_t* y, const uint8_t* uv, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x) {
+        const uint8_t* c = uv + (x & ~1u);
+        yuv_to_bgra_px(y[x], c[0], c[1], dst + (size_t)x * 4);
+    }
+}
+
+static void rgb24_row_to_bgra_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x, src += 3, dst += 4) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 0xFF;
+    }
+}
+
+// Limited-range luma -> full-range gray; same result as the G channel of a grey YUV pixel.
+static inline uint8_t y_to_gray_px(int y) {
+    return clamp_u8((298 * (y - 16) + 128) >> 8);
+}
+
+static void y_row_to_gray_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x) dst[x] = y_to_gray_px(src[x]);
+}
+
+static void yuy2_row_to_gray_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x) dst[x] = y_to_gray_px(src[(size_t)x * 2]);
+}
+
+static void yuy2_row_to_y_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x) dst[x] = src[(size_t)x * 2];
+}
+
+// Averages the chroma of two YUY2 rows into one NV12-style UV row of cw pairs.
+static void yuy2_rows_to_uv_scalar(const uint8_t* r0, const uint8_t* r1, uint8_t* uv, uint32_t cw) {
+    for (uint32_t i = 0; i < cw * 2; ++i) uv[i] = (uint8_t)((r0[(size_t)i * 2 + 1] + r1[(size_t)i * 2 + 1] + 1) >> 1);
+}
+
+static void uv_row_split_scalar(const uint8_t* uv, uint8_t* u, uint8_t* v, uint32_t cw) {
+    for (uint32_t i = 0; i < cw; ++i) {
+        u[i] = uv[(size_t)i * 2];
+        v[i] = uv[(size_t)i * 2 + 1];
+    }
+}
+
+static void bgra_row_to_rgba_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x, src += 4, dst += 4) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = src[3];
+    }
+}
+
+static void bgra_row_to_rgb24_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x, src += 4, dst += 3) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+    }
+}
+
+static void bgra_row_to_gray_scalar(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    for (uint32_t x = 0; x < width; ++x, src += 4)
+        dst[x] = (uint8_t)((29 * src[0] + 150 * src[1] + 77 * src[2] + 128) >> 8);
+}
+
+// Two BGRA rows -> their luma rows plus one row of 2x2-averaged chroma (BT.601 limited).
+// y1 may be null for the last row of an odd height (b1 then repeats b0). u/v advance by
+// uvStep so the same code writes I420 planes (1) and NV12 interleaved UV (2).
+static void bgra_rows_to_yuv420_scalar(const uint8_t* b0, const uint8_t* b1, uint32_t width,
+    uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, size_t uvStep) {
+    auto luma = [](const uint8_t* p) {
+        return (uint8_t)(((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8) + 16);
+    };
+    for (uint32_t x = 0; x < width; x += 2) {
+        uint32_t x1 = (x + 1 < width) ? x + 1 : x;
+        const uint8_t* p[4] = { b0 + (size_t)x * 4, b0 + (size_t)x1 * 4, b1 + (size_t)x * 4, b1 + (size_t)x1 * 4 };
+
+        y0[x] = luma(p[0]);
+        if (x1 != x) y0[x1] = luma(p[1]);
+        if (y1) {
+            y1[x] = luma(p[2]);
+            if (x1 != x) y1[x1] = luma(p[3]);
+        }
+
+        int b = (p[0][0] + p[1][0] + p[2][0] + p[3][0] + 2) >> 2;
+        int g = (p[0][1] + p[1][1] + p[2][1] + p[3][1] + 2) >> 2;
+        int r = (p[0][2] + p[1][2] + p[2][2] + p[3][2] + 2) >> 2;
+        size_t ci = (size_t)(x / 2) * uvStep;
+        u[ci] = clamp_u8(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[ci] = clamp_u8(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CDS_HAVE_X86_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CDS_TARGET_SSSE3
+#define CDS_TARGET_AVX2
+#else
+#include <cpuid.h>
+#define CDS_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define CDS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+struct CpuFeatures {
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool avx2 = false;
+};
+
+static CpuFeatures detect_cpu_features() {
+    CpuFeatures f{};
+    unsigned r1[4]{}, r7[4]{};
+    unsigned maxLeaf = 0;
+#if defined(_MSC_VER)
+    int regs[4]{};
+    __cpuid(regs, 0); maxLeaf = (unsigned)regs[0];
+    __cpuid(regs, 1); for (int i = 0; i < 4; ++i) r1[i] = (unsigned)regs[i];
+    if (maxLeaf >= 7) { __cpuidex(regs, 7, 0); for (int i = 0; i < 4; ++i) r7[i] = (unsigned)regs[i]; }
+#else
+    maxLeaf = __get_cpuid_max(0, nullptr);
+    __cpuid(1, r1[0], r1[1], r1[2], r1[3]);
+    if (maxLeaf >= 7) __cpuid_count(7, 0, r7[0], r7[1], r7[2], r7[3]);
+#endif
+    f.sse2 = (r1[3] & (1u << 26)) != 0;
+    f.ssse3 = (r1[2] & (1u << 9)) != 0;
+
+    // AVX2 also needs the OS to save YMM state (OSXSAVE + XCR0 bits 1,2).
+    bool osxsave = (r1[2] & (1u << 27)) != 0;
+    bool avx = (r1[2] & (1u << 28)) != 0;
+    if (osxsave && avx) {
+#if defined(_MSC_VER)
+        unsigned long long xcr0 = _xgetbv(0);
+#else
+        unsigned lo = 0, hi = 0;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        unsigned long long xcr0 = ((unsigned long long)hi << 32) | lo;
+#endif
+        f.avx2 = ((xcr0 & 6) == 6) && ((r7[1] & (1u << 5)) != 0);
+    }
+    return f;
+}
+
+// 8 pixels: c = Y-16, d = U-128, e = V-128 (int16 lanes) -> 2 x 4 BGRA pixels.
+static inline void yuv8_to_bgra_sse2(__m128i c, __m128i d, __m128i e, uint8_t* dst) {
+    const __m128i kR1 = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+    const __m128i kG1 = _mm_setr_epi16(298, -208, 298, -208, 298, -208, 298, -208);
+    const __m128i kB1 = _mm_setr_epi16(298, 0, 298, 0, 298, 0, 298, 0);
+    const __m128i kR2 = _mm_setr_epi16(0, 128, 0, 128, 0, 128, 0, 128);
+    const __m128i kG2 = _mm_setr_epi16(-100, 128, -100, 128, -100, 128, -100, 128);
+    const __m128i kB2 = _mm_setr_epi16(516, 128, 516, 128, 516, 128, 516, 128);
+    const __m128i one = _mm_set1_epi16(1);
+
+    __m128i ceLo = _mm_unpacklo_epi16(c, e), ceHi = _mm_unpackhi_epi16(c, e);
+    __m128i d1Lo = _mm_unpacklo_epi16(d, one), d1Hi = _mm_unpackhi_epi16(d, one);
+
+    __m128i rLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, kR1), _mm_madd_epi16(d1Lo, kR2)), 8);
+    __m128i rHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, kR1), _mm_madd_epi16(d1Hi, kR2)), 8);
+    __m128i gLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, kG1), _mm_madd_epi16(d1Lo, kG2)), 8);
+    __m128i gHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, kG1), _mm_madd_epi16(d1Hi, kG2)), 8);
+    __m128i bLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, kB1), _mm_madd_epi16(d1Lo, kB2)), 8);
+    __m128i bHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, kB1), _mm_madd_epi16(d1Hi, kB2)), 8);
+
+    __m128i r = _mm_packs_epi32(rLo, rHi);
+    __m128i g = _mm_packs_epi32(gLo, gHi);
+    __m128i b = _mm_packs_epi32(bLo, bHi);
+    __m128i b8 = _mm_packus_epi16(b, b);
+    __m128i g8 = _mm_packus_epi16(g, g);
+    __m128i r8 = _mm_packus_epi16(r, r);
+
+    __m128i bg = _mm_unpacklo_epi8(b8, g8);
+    __m128i ra = _mm_unpacklo_epi8(r8, _mm_set1_epi8((char)0xFF));
+    _mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi16(bg, ra));
+    _mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(bg, ra));
+}
+
+// uv holds U0 V0 U1 V1 U2 V2 U3 V3 as int16; expand to per-pixel d/e for 8 pixels.
+static inline void split_uv8_sse2(__m128i uv, __m128i& d, __m128i& e) {
+    const __m128i k128 = _mm_set1_epi16(128);
+    __m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+    __m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    d = _mm_sub_epi16(u, k128);
+    e = _mm_sub_epi16(v, k128);
+}
+
+static void yuy2_row_to_bgra_sse2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8, src += 16, dst += 32) {
+        __m128i px = _mm_loadu_si128((const __m128i*)src);
+        __m128i c = _mm_sub_epi16(_mm_and_si128(px, lowMask), k16);
+        __m128i d, e;
+        split_uv8_sse2(_mm_srli_epi16(px, 8), d, e);
+        yuv8_to_bgra_sse2(c, d, e, dst);
+    }
+    if (x < width) yuy2_row_to_bgra_scalar(src, dst, width - x);
+}
+
+static void nv12_row_to_bgra_sse2(const uint8_t* y, const uint8_t* uv, uint8_t* dst, uint32_t width) {
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i c = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + x)), zero), k16);
+        __m128i d, e;
+        split_uv8_sse2(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(uv + x)), zero), d, e);
+        yuv8_to_bgra_sse2(c, d, e, dst + (size_t)x * 4);
+    }
+    if (x < width) nv12_row_to_bgra_scalar(y + x, uv + x, dst + (size_t)x * 4, width - x);
+}
+
+CDS_TARGET_SSSE3 static void rgb24_row_to_bgra_ssse3(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i shuf = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000u);
+    uint32_t x = 0;
+    // 16-byte loads cover 4 pixels + 4 spare bytes, so stop while 6 pixels remain.
+    for (; x + 6 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + (size_t)x * 3));
+        _mm_storeu_si128((__m128i*)(dst + (size_t)x * 4), _mm_or_si128(_mm_shuffle_epi8(px, shuf), alpha));
+    }
+    if (x < width) rgb24_row_to_bgra_scalar(src + (size_t)x * 3, dst + (size_t)x * 4, width - x);
+}
+
+// 16 pixels, same math as yuv8_to_bgra_sse2. unpack/pack work per 128-bit lane, so
+// lane 0 carries pixels 0-7 and lane 1 pixels 8-15 until the final permute.
+CDS_TARGET_AVX2 static inline void yuv16_to_bgra_avx2(__m256i c, __m256i d, __m256i e, uint8_t* dst) {
+    const __m256i kR1 = _mm256_set1_epi32((409 << 16) | 298);
+    const __m256i kG1 = _mm256_set1_epi32((int)(((uint32_t)(uint16_t)-208 << 16) | 298));
+    const __m256i kB1 = _mm256_set1_epi32(298);
+    const __m256i kR2 = _mm256_set1_epi32(128 << 16);
+    const __m256i kG2 = _mm256_set1_epi32((int)((128u << 16) | (uint16_t)-100));
+    const __m256i kB2 = _mm256_set1_epi32((128 << 16) | 516);
+    const __m256i one = _mm256_set1_epi16(1);
+
+    __m256i ceLo = _mm256_unpacklo_epi16(c, e), ceHi = _mm256_unpackhi_epi16(c, e);
+    __m256i d1Lo = _mm256_unpacklo_epi16(d, one), d1Hi = _mm256_unpackhi_epi16(d, one);
+
+    __m256i rLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceLo, kR1), _mm256_madd_epi16(d1Lo, kR2)), 8);
+    __m256i rHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceHi, kR1), _mm256_madd_epi16(d1Hi, kR2)), 8);
+    __m256i gLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceLo, kG1), _mm256_madd_epi16(d1Lo, kG2)), 8);
+    __m256i gHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceHi, kG1), _mm256_madd_epi16(d1Hi, kG2)), 8);
+    __m256i bLo = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceLo, kB1), _mm256_madd_epi16(d1Lo, kB2)), 8);
+    __m256i bHi = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceHi, kB1), _mm256_madd_epi16(d1Hi, kB2)), 8);
+
+    __m256i r = _mm256_packs_epi32(rLo, rHi);
+    __m256i g = _mm256_packs_epi32(gLo, gHi);
+    __m256i b = _mm256_packs_epi32(bLo, bHi);
+    __m256i b8 = _mm256_packus_epi16(b, b);
+    __m256i g8 = _mm256_packus_epi16(g, g);
+    __m256i r8 = _mm256_packus_epi16(r, r);
+
+    __m256i bg = _mm256_unpacklo_epi8(b8, g8);
+    __m256i ra = _mm256_unpacklo_epi8(r8, _mm256_set1_epi8((char)0xFF));
+    __m256i lo = _mm256_unpacklo_epi16(bg, ra); // px 0-3 | 8-11
+    __m256i hi = _mm256_unpackhi_epi16(bg, ra); // px 4-7 | 12-15
+    _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+    _mm256_storeu_si256((__m256i*)(dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+CDS_TARGET_AVX2 static inline void split_uv16_avx2(__m256i uv, __m256i& d, __m256i& e) {
+    const __m256i k128 = _mm256_set1_epi16(128);
+    __m256i u = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 2, 0, 0));
+    __m256i v = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3, 3, 1, 1)), _MM_SHUFFLE(3, 3, 1, 1));
+    d = _mm256_sub_epi16(u, k128);
+    e = _mm256_sub_epi16(v, k128);
+}
+
+CDS_TARGET_AVX2 static void yuy2_row_to_bgra_avx2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m256i k16 = _mm256_set1_epi16(16);
+    const __m256i lowMask = _mm256_set1_epi16(0x00FF);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16, src += 32, dst += 64) {
+        __m256i px = _mm256_loadu_si256((const __m256i*)src);
+        __m256i c = _mm256_sub_epi16(_mm256_and_si256(px, lowMask), k16);
+        __m256i d, e;
+        split_uv16_avx2(_mm256_srli_epi16(px, 8), d, e);
+        yuv16_to_bgra_avx2(c, d, e, dst);
+    }
+    if (x < width) yuy2_row_to_bgra_sse2(src, dst, width - x);
+}
+
+CDS_TARGET_AVX2 static void nv12_row_to_bgra_avx2(const uint8_t* y, const uint8_t* uv, uint8_t* dst, uint32_t width) {
+    const __m256i k16 = _mm256_set1_epi16(16);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i c = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(y + x))), k16);
+        __m256i d, e;
+        split_uv16_avx2(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(uv + x))), d, e);
+        yuv16_to_bgra_avx2(c, d, e, dst + (size_t)x * 4);
+    }
+    if (x < width) nv12_row_to_bgra_sse2(y + x, uv + x, dst + (size_t)x * 4, width - x);
+}
+
+// 8 limited-range Y (int16) -> full-range gray. 298c = 256c + 42c keeps the product in int16.
+static inline __m128i y8_to_gray16_sse2(__m128i y) {
+    __m128i c = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    __m128i t = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(c, _mm_set1_epi16(42)), _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(c, t);
+}
+
+static void y_row_to_gray_sse2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i lo = y8_to_gray16_sse2(_mm_unpacklo_epi8(px, zero));
+        __m128i hi = y8_to_gray16_sse2(_mm_unpackhi_epi8(px, zero));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    if (x < width) y_row_to_gray_scalar(src + x, dst + x, width - x);
+}
+
+static void yuy2_row_to_gray_sse2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t* p = src + (size_t)x * 2;
+        __m128i lo = y8_to_gray16_sse2(_mm_and_si128(_mm_loadu_si128((const __m128i*)p), lowMask));
+        __m128i hi = y8_to_gray16_sse2(_mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 16)), lowMask));
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    if (x < width) yuy2_row_to_gray_scalar(src + (size_t)x * 2, dst + x, width - x);
+}
+
+static void yuy2_row_to_y_sse2(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    uint32_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+        const uint8_t* p = src + (size_t)x * 2;
+        __m128i lo = _mm_and_si128(_mm_loadu_si128((const __m128i*)p), lowMask);
+        __m128i hi = _mm_and_si128(_mm_loadu_si128((const __m128i*)(p + 16)), lowMask);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+    }
+    if (x < width) yuy2_row_to_y_scalar(src + (size_t)x * 2, dst + x, width - x);
+}
+
+static void yuy2_rows_to_uv_sse2(const uint8_t* r0, const uint8_t* r1, uint8_t* uv, uint32_t cw) {
+    uint32_t n = cw * 2, i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const size_t o = (size_t)i * 2;
+        __m128i a = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(r0 + o)), _mm_loadu_si128((const __m128i*)(r1 + o)));
+        __m128i b = _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(r0 + o + 16)), _mm_loadu_si128((const __m128i*)(r1 + o + 16)));
+        _mm_storeu_si128((__m128i*)(uv + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    if (i < n) yuy2_rows_to_uv_scalar(r0 + (size_t)i * 2, r1 + (size_t)i * 2, uv + i, (n - i) / 2);
+}
+
+static void uv_row_split_sse2(const uint8_t* uv, uint8_t* u, uint8_t* v, uint32_t cw) {
+    const __m128i lowMask = _mm_set1_epi16(0x00FF);
+    uint32_t i = 0;
+    for (; i + 16 <= cw; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(uv + (size_t)i * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(uv + (size_t)i * 2 + 16));
+        _mm_storeu_si128((__m128i*)(u + i), _mm_packus_epi16(_mm_and_si128(a, lowMask), _mm_and_si128(b, lowMask)));
+        _mm_storeu_si128((__m128i*)(v + i), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+    }
+    if (i < cw) uv_row_split_scalar(uv + (size_t)i * 2, u + i, v + i, cw - i);
+}
+
+CDS_TARGET_SSSE3 static void bgra_row_to_rgba_ssse3(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + (size_t)x * 4));
+        _mm_storeu_si128((__m128i*)(dst + (size_t)x * 4), _mm_shuffle_epi8(px, shuf));
+    }
+    if (x < width) bgra_row_to_rgba_scalar(src + (size_t)x * 4, dst + (size_t)x * 4, width - x);
+}
+
+CDS_TARGET_SSSE3 static void bgra_row_to_rgb24_ssse3(const uint8_t* src, uint8_t* dst, uint32_t width) {
+    const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    uint32_t x = 0;
+    // Each 16-byte store carries 12 useful bytes; stop while 6 pixels remain so it stays in the row.
+    for (; x + 6 <= width; x += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*)(src + (size_t)x * 4));
+        _mm_storeu_si128((__m128i*)(dst + (size_t)x * 3), _mm_shuffle_epi8(px, shuf));
+    }
+    if (x < width) bgra_row_to_rgb24_scalar(src + (size_t)x * 4, dst + (size_t)x * 3, width - x);
+}
+#endif // x86 SIMD
+
+struct RowKernels {
+    // Native -> BGRA
+    void (*yuy2)(const uint8_t*, uint8_t*, uint32_t) = yuy2_row_to_bgra_scalar;
+    void (*nv12)(const uint8_t*, const uint8_t*, uint8_t*, uint32_t) = nv12_row_to_bgra_scalar;
+    void (*rgb24)(const uint8_t*, uint8_t*, uint32_t) = rgb24_row_to_bgra_scalar;
+    // Fused native -> GRAY8 / planar, and BGRA -> other packed layouts
+    void (*yToGray)(const uint8_t*, uint8_t*, uint32_t) = y_row_to_gray_scalar;
+    void (*yuy2ToGray)(const uint8_t*, uint8_t*, uint32_t) = yuy2_row_to_gray_scalar;
+    void (*yuy2ToY)(const uint8_t*, uint8_t*, uint32_t) = yuy2_row_to_y_scalar;
+    void (*yuy2ToUv)(const uint8_t*, const uint8_t*, uint8_t*, uint32_t) = yuy2_rows_to_uv_scalar;
+    void (*uvSplit)(const uint8_t*, uint8_t*, uint8_t*, uint32_t) = uv_row_split_scalar;
+    void (*bgraToRgba)(const uint8_t*, uint8_t*, uint32_t) = bgra_row_to_rgba_scalar;
+    void (*bgraToRgb24)(const uint8_t*, uint8_t*, uint32_t) = bgra_row_to_rgb24_scalar;
+};
+
+#ifdef CDS_HAVE_X86_SIMD
+// libcdshow_SIMD set to anything but 1/true/yes/on.
+static bool simd_disabled_by_env() {
+    const char* value = getenv("libcdshow_SIMD");
+    if (!value || !*value) return false;
+    std::string v(value);
+    std::transform(v.begin(), v.end(), v.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return !(v == "1" || v == "true" || v == "yes" || v == "on");
+}
+#endif
+
+// Picked once from runtime CPU detection (libcdshow_SIMD=0 forces the scalar path).
+static const RowKernels& row_kernels() {
+    static const RowKernels k = []() {
+        RowKernels r{};
+#ifdef CDS_HAVE_X86_SIMD
+        if (simd_disabled_by_env()) return r;
+
+        CpuFeatures f = detect_cpu_features();
+        if (f.sse2) {
+            r.yuy2 = yuy2_row_to_bgra_sse2; r.nv12 = nv12_row_to_bgra_sse2;
+            r.yToGray = y_row_to_gray_sse2; r.yuy2ToGray = yuy2_row_to_gray_sse2;
+            r.yuy2ToY = yuy2_row_to_y_sse2; r.yuy2ToUv = yuy2_rows_to_uv_sse2; r.uvSplit = uv_row_split_sse2;
+        }
+        if (f.ssse3) {
+            r.rgb24 = rgb24_row_to_bgra_ssse3;
+            r.bgraToRgba = bgra_row_to_rgba_ssse3; r.bgraToRgb24 = bgra_row_to_rgb24_ssse3;
+        }
+        if (f.avx2) { r.yuy2 = yuy2_row_to_bgra_avx2; r.nv12 = nv12_row_to_bgra_avx2; }
+#endif
+        return r;
+    }();
+    return k;
+}
+
+// Non-BGRA outputs stage BGRA in chunks this wide (even, so YUY2/NV12 chroma pairs stay whole).
+constexpr uint32_t kConvChunkPixels = 256;
+
+static inline const uint8_t* src_row(const SrcFrame& src, uint32_t y) {
+    uint32_t sy = src.bottomUp ? (src.height - 1 - y) : y;
+    return src.data + (size_t)sy * src.stride;
+}
+
+// Output row y, pixels [x, x + n) -> BGRA. x must be even.
+static void src_row_to_bgra(const SrcFrame& src, const RowKernels& k, uint32_t y, uint32_t x, uint32_t n, uint8_t* out) {
+    const uint8_t* row = src_row(src, y);
+    switch (src.fmt) {
+    case SrcFormat::Rgb32:
+        memcpy(out, row + (size_t)x * 4, (size_t)n * 4);
+        break;
+    case SrcFormat::Rgb24:
+        k.rgb24(row + (size_t)x * 3, out, n);
+        break;
+    case SrcFormat::Yuy2:
+        k.yuy2(row + (size_t)x * 2, out, n);
+        break;
+    case SrcFormat::Nv12: {
+        const uint8_t* uv = nv12_chroma(src) + (size_t)(y / 2) * src.stride;
+        k.nv12(row + x, uv + x, out, n);
+        break;
+    }
+    }
+}
+
+// Narrows a full native frame to the geometry's roi (no copy). roi x/y are even.
+SrcFrame crop_src_frame(const SrcFrame& full, const FrameGeometry& g) {
+    SrcFrame c = full;
+    c.width = g.roiW;
+    c.height = g.roiH;
+    // Bottom-up frames store output row 0 last, so the roi starts further down in memory.
+    uint32_t firstRow = full.bottomUp ? full.height - g.roiY - g.roiH : g.roiY;
+    size_t bpp = 4;
+    switch (full.fmt) {
+    case SrcFormat::Rgb32: bpp = 4; break;
+    case SrcFormat::Rgb24: bpp = 3; break;
+    case SrcFormat::Yuy2:  bpp = 2; break;
+    case SrcFormat::Nv12:  bpp = 1; break;
+    }
+    c.data = full.data + (size_t)firstRow * full.stride + (size_t)g.roiX * bpp;
+    if (full.fmt == SrcFormat::Nv12)
+        c.chroma = nv12_chroma(full) + (size_t)(g.roiY / 2) * full.stride + g.roiX;
+    return c;
+}
+
+// Converts a whole native frame into top-down RGB32 rows of dstStride bytes.
+static void convert_frame_to_bgra(const SrcFrame& src, uint8_t* dst, size_t dstStride) {
+    const RowKernels& k = row_kernels();
+    for (uint32_t y = 0; y < src.height; ++y) src_row_to_bgra(src, k, y, 0, src.width, dst + (size_t)y * dstStride);
+}
+
+static void convert_frame_to_gray(const SrcFrame& src, const RowKernels& k, const OutLayout& out, uint8_t* dst) {
+    alignas(16) uint8_t bgra[kConvChunkPixels * 4];
+    for (uint32_t y = 0; y < src.height; ++y) {
+        uint8_t* o = dst + (size_t)y * out.rowBytes;
+        if (src.fmt == SrcFormat::Nv12) k.yToGray(src_row(src, y), o, src.width);
+        else if (src.fmt == SrcFormat::Yuy2) k.yuy2ToGray(src_row(src, y), o, src.width);
+        else {
+            for (uint32_t x = 0; x < src.width; x += kConvChunkPixels) {
+                uint32_t n = (std::min)(kConvChunkPixels, src.width - x);
+                src_row_to_bgra(src, k, y, x, n, bgra);
+                bgra_row_to_gray_scalar(bgra, o + x, n);
+            }
+        }
+    }
+}
+
+static void convert_frame_to_yuv420(const SrcFrame& src, const RowKernels& k, const OutLayout& out, uint8_t* dst) {
+    const uint32_t w = src.width, h = src.height;
+    const uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    const bool nv12 = out.fmt == OutFormat::Nv12;
+    uint8_t* yPlane = dst;
+    uint8_t* cPlane = dst + out.rowBytes * (size_t)h; // U (I420) or UV (NV12)
+    uint8_t* vPlane = cPlane + (size_t)cw * ch;       // I420 only
+    const size_t cStride = nv12 ? (size_t)cw * 2 : (size_t)cw;
+
+    if (src.fmt == SrcFormat::Nv12) {
+        for (uint32_t y = 0; y < h; ++y) memcpy(yPlane + (size_t)y * out.rowBytes, src_row(src, y), w);
+        const uint8_t* srcUv = nv12_chroma(src);
+        for (uint32_t cy = 0; cy < ch; ++cy) {
+            const uint8_t* uv = srcUv + (size_t)cy * src.stride;
+            if (nv12) memcpy(cPlane + (size_t)cy * cStride, uv, (size_t)cw * 2);
+            else k.uvSplit(uv, cPlane + (size_t)cy * cw, vPlane + (size_t)cy * cw, cw);
+        }
+        return;
+    }
+
+    if (src.fmt == SrcFormat::Yuy2) {
+        alignas(16) uint8_t uv[kConvChunkPixels * 2];
+        for (uint32_t y = 0; y < h; ++y) k.yuy2ToY(src_row(src, y), yPlane + (size_t)y * out.rowBytes, w);
+        for (uint32_t cy = 0; cy < ch; ++cy) {
+            const uint8_t* r0 = src_row(src, cy * 2);
+            const uint8_t* r1 = src_row(src, (std::min)(cy * 2 + 1, h - 1));
+            if (nv12) {
+                k.yuy2ToUv(r0, r1, cPlane + (size_t)cy * cStride, cw);
+                continue;
+            }
+            for (uint32_t i = 0; i < cw; i += kConvChunkPixels) {
+                uint32_t m = (std::min)(kConvChunkPixels, cw - i);
+                k.yuy2ToUv(r0 + (size_t)i * 4, r1 + (size_t)i * 4, uv, m);
+                k.uvSplit(uv, cPlane + (size_t)cy * cw + i, vPlane + (size_t)cy * cw + i, m);
+            }
+        }
+        return;
+    }
+
+    // RGB sources: stage both rows of each pair as BGRA, then subsample.
+    alignas(16) uint8_t b0[kConvChunkPixels * 4];
+    alignas(16) uint8_t b1[kConvChunkPixels * 4];
+    for (uint32_t cy = 0; cy < ch; ++cy) {
+        uint32_t y0 = cy * 2;
+        bool pair = y0 + 1 < h;
+        for (uint32_t x = 0; x < w; x += kConvChunkPixels) {
+            uint32_t n = (std::min)(kConvChunkPixels, w - x);
+            src_row_to_bgra(src, k, y0, x, n, b0);
+            if (pair) src_row_to_bgra(src, k, y0 + 1, x, n, b1);
+            uint8_t* u = nv12 ? cPlane + (size_t)cy * cStride + x : cPlane + (size_t)cy * cw + x / 2;
+            uint8_t* v = nv12 ? u + 1 : vPlane + (size_t)cy * cw + x / 2;
+            bgra_rows_to_yuv420_scalar(b0, pair ? b1 : b0, n,
+                yPlane + (size_t)y0 * out.rowBytes + x,
+                pair ? yPlane + (size_t)(y0 + 1) * out.rowBytes + x : nullptr,
+                u, v, nv12 ? 2 : 1);
+        }
+    }
+}
+
+// ---- Scaling ----
+// Box filter when shrinking 2x or more on both axes, bilinear otherwise. Source rows are
+// converted to BGRA one at a time, so only the roi is ever touched, and each output row is
+// handed to a packer for the final layout.
+
+
+static void box_accum_row_scalar(const uint8_t* bgra, const uint32_t* xStart, const uint32_t* xCount, uint32_t outW, uint32_t* acc) {
+    for (uint32_t ox = 0; ox < outW; ++ox) {
+        const uint8_t* p = bgra + (size_t)xStart[ox] * 4;
+        uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (uint32_t i = 0; i < xCount[ox]; ++i, p += 4) {
+            s0 += p[0]; s1 += p[1]; s2 += p[2]; s3 += p[3];
+        }
+        uint32_t* a = acc + (size_t)ox * 4;
+        a[0] += s0; a[1] += s1; a[2] += s2; a[3] += s3;
+    }
+}
+
+#ifdef CDS_HAVE_X86_SIMD
+// Two pixels per step in 16-bit lanes (safe for up to 256 pixels; spans are at most kMaxDownscale + 1).
+static void box_accum_row_sse2(const uint8_t* bgra, const uint32_t* xStart, const uint32_t* xCount, uint32_t outW, uint32_t* acc) {
+    const __m128i zero = _mm_setzero_si128();
+    for (uint32_t ox = 0; ox < outW; ++ox) {
+        const uint8_t* p = bgra + (size_t)xStart[ox] * 4;
+        uint32_t n = xCount[ox], i = 0;
+        __m128i sum = zero;
+        for (; i + 2 <= n; i += 2)
+            sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p + (size_t)i * 4)), zero));
+        if (i < n) {
+            int32_t px;
+            memcpy(&px, p + (size_t)i * 4, 4);
+            sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_cvtsi32_si128(px), zero));
+        }
+        sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+        __m128i* a = (__m128i*)(acc + (size_t)ox * 4);
+        _mm_storeu_si128(a, _mm_add_epi32(_mm_loadu_si128(a), _mm_unpacklo_epi16(sum, zero)));
+    }
+}
+#endif
+
+static void scale_box(const SrcFrame& src, const RowKernels& k, uint32_t outW, uint32_t outH, ConvScratch& sc,
+    const std::function<void(uint32_t, const uint8_t*)>& emit) {
+    const uint32_t w = src.width, h = src.height;
+    sc.srcRows.resize((size_t)w * 4);
+    sc.outRows.resize((size_t)outW * 4);
+    sc.acc.resize((size_t)outW * 4);
+    sc.xStart.resize(outW);
+    sc.xCount.resize(outW);
+    for (uint32_t ox = 0; ox < outW; ++ox) {
+        uint32_t x0 = (uint32_t)((uint64_t)ox * w / outW);
+        uint32_t x1 = (uint32_t)((uint64_t)(ox + 1) * w / outW);
+        sc.xStart[ox] = x0;
+        sc.xCount[ox] = (std::max)(x1, x0 + 1) - x0;
+    }
+
+    auto accum = box_accum_row_scalar;
+#ifdef CDS_HAVE_X86_SIMD
+    if (k.yToGray != y_row_to_gray_scalar) accum = box_accum_row_sse2; // SSE2 kernels were selected
+#endif
+
+    for (uint32_t oy = 0; oy < outH; ++oy) {
+        uint32_t y0 = (uint32_t)((uint64_t)oy * h / outH);
+        uint32_t y1 = (std::max)((uint32_t)((uint64_t)(oy + 1) * h / outH), y0 + 1);
+        std::fill(sc.acc.begin(), sc.acc.end(), 0u);
+        for (uint32_t y = y0; y < y1; ++y) {
+            src_row_to_bgra(src, k, y, 0, w, sc.srcRows.data());
+            accum(sc.srcRows.data(), sc.xStart.data(), sc.xCount.data(), outW, sc.acc.data());
+        }
+        uint8_t* o = sc.outRows.data();
+        for (uint32_t ox = 0; ox < outW; ++ox) {
+            uint32_t n = sc.xCount[ox] * (y1 - y0);
+            const uint32_t* a = sc.acc.data() + (size_t)ox * 4;
+            for (int c = 0; c < 4; ++c) o[(size_t)ox * 4 + c] = (uint8_t)((a[c] + n / 2) / n);
+        }
+        emit(oy, o);
+    }
+}
+
+// Sample centres map as (o + 0.5) * in / out - 0.5, in 16.16 fixed point, clamped to the edges.
+static void bilinear_pos(uint32_t o, uint32_t in, uint32_t out, uint32_t& i0, uint32_t& frac) {
+    int64_t pos = ((int64_t)(2 * (uint64_t)o + 1) * in * 65536) / (2 * (int64_t)out) - 32768;
+    if (pos < 0) pos = 0;
+    i0 = (uint32_t)(pos >> 16);
+    frac = (uint32_t)((pos >> 8) & 0xFF);
+    if (i0 >= in - 1) { i0 = in - 1; frac = 0; }
+}
+
+static void scale_bilinear(const SrcFrame& src, const RowKernels& k, uint32_t outW, uint32_t outH, ConvScratch& sc,
+    const std::function<void(uint32_t, const uint8_t*)>& emit) {
+    const uint32_t w = src.width, h = src.height;
+    const size_t rowBytes = (size_t)w * 4;
+    sc.srcRows.resize(rowBytes * 2);
+    sc.outRows.resize((size_t)outW * 4);
+    sc.xStart.resize(outW);
+    sc.xCount.resize(outW);
+    for (uint32_t ox = 0; ox < outW; ++ox) bilinear_pos(ox, w, outW, sc.xStart[ox], sc.xCount[ox]);
+
+    // Two cached source rows; upscaling revisits the same pair for several output rows.
+    uint32_t cached[2] = { UINT32_MAX, UINT32_MAX };
+    auto fetch = [&](uint32_t y) -> const uint8_t* {
+        for (int i = 0; i < 2; ++i) if (cached[i] == y) return sc.srcRows.data() + rowBytes * i;
+        // Rows are requested in increasing order, so the lower cached row is never needed again.
+        int victim = cached[0] == UINT32_MAX ? 0 : (cached[1] == UINT32_MAX ? 1 : (cached[0] < cached[1] ? 0 : 1));
+        cached[victim] = y;
+        uint8_t* row = sc.srcRows.data() + rowBytes * victim;
+        src_row_to_bgra(src, k, y, 0, w, row);
+        return row;
+    };
+
+    for (uint32_t oy = 0; oy < outH; ++oy) {
+        uint32_t y0 = 0, fy = 0;
+        bilinear_pos(oy, h, outH, y0, fy);
+        const uint8_t* r0 = fetch(y0);
+        const uint8_t* r1 = fy ? fetch(y0 + 1) : r0;
+        uint8_t* o = sc.outRows.data();
+        for (uint32_t ox = 0; ox < outW; ++ox) {
+            uint32_t x0 = sc.xStart[ox], fx = sc.xCount[ox];
+            uint32_t x1 = fx ? x0 + 1 : x0;
+            for (int c = 0; c < 4; ++c) {
+                uint32_t top = r0[(size_t)x0 * 4 + c] * (256 - fx) + r0[(size_t)x1 * 4 + c] * fx;
+                uint32_t bot = r1[(size_t)x0 * 4 + c] * (256 - fx) + r1[(size_t)x1 * 4 + c] * fx;
+                o[(size_t)ox * 4 + c] = (uint8_t)((top * (256 - fy) + bot * fy + 32768) >> 16);
+            }
+        }
+        emit(oy, o);
+    }
+}
+
+// Scaled frames: packs each BGRA output row into the requested layout.
+static void convert_frame_scaled(const SrcFrame& src, const RowKernels& k, const OutLayout& out, uint8_t* dst, ConvScratch& sc) {
+    const uint32_t outW = out.width, outH = out.height;
+    const bool planar = out.fmt == OutFormat::I420 || out.fmt == OutFormat::Nv12;
+    if (planar) sc.pairRow.resize((size_t)outW * 4);
+    const uint32_t cw = (outW + 1) / 2, ch = (outH + 1) / 2;
+    uint8_t* cPlane = dst + out.rowBytes * (size_t)outH;
+
+    auto emit = [&](uint32_t oy, const uint8_t* row) {
+        uint8_t* o = dst + (size_t)oy * out.rowBytes;
+        switch (out.fmt) {
+        case OutFormat::Bgra:  memcpy(o, row, (size_t)outW * 4); break;
+        case OutFormat::Rgba:  k.bgraToRgba(row, o, outW); break;
+        case OutFormat::Rgb24: k.bgraToRgb24(row, o, outW); break;
+        case OutFormat::Gray8: bgra_row_to_gray_scalar(row, o, outW); break;
+        case OutFormat::I420:
+        case OutFormat::Nv12: {
+            bool last = oy + 1 == outH;
+            if ((oy & 1) == 0 && !last) {
+                memcpy(sc.pairRow.data(), row, (size_t)outW * 4);
+                break;
+            }
+            uint32_t cy = oy / 2;
+            bool pair = (oy & 1) != 0;
+            const uint8_t* top = pair ? sc.pairRow.data() : row;
+            uint8_t* u = out.fmt == OutFormat::Nv12 ? cPlane + (size_t)cy * cw * 2 : cPlane + (size_t)cy * cw;
+            uint8_t* v = out.fmt == OutFormat::Nv12 ? u + 1 : cPlane + (size_t)cw * ch + (size_t)cy * cw;
+            bgra_rows_to_yuv420_scalar(top, row, outW,
+                dst + (size_t)(cy * 2) * out.rowBytes, pair ? o : nullptr,
+                u, v, out.fmt == OutFormat::Nv12 ? 2 : 1);
+            break;
+        }
+        }
+    };
+
+    if ((uint64_t)src.width >= 2ull * outW && (uint64_t)src.height >= 2ull * outH) scale_box(src, k, outW, outH, sc, emit);
+    else scale_bilinear(src, k, outW, outH, sc, emit);
+}
+
+// Converts a whole native frame (already cropped) into the requested top-down output layout
+// in one pass, scaling when the output size differs. sc is only used when scaling.
+void convert_frame(const SrcFrame& src, const OutLayout& out, uint8_t* dst, ConvScratch& sc) {
+    const RowKernels& k = row_kernels();
+    if (src.width != out.width || src.height != out.height) {
+        convert_frame_scaled(src, k, out, dst, sc);
+        return;
+    }
+    switch (out.fmt) {
+    case OutFormat::Bgra:
+        convert_frame_to_bgra(src, dst, out.rowBytes);
+        break;
+    case OutFormat::Rgba:
+    case OutFormat::Rgb24: {
+        alignas(16) uint8_t bgra[kConvChunkPixels * 4];
+        const bool rgba = out.fmt == OutFormat::Rgba;
+        const size_t bpp = rgba ? 4 : 3;
+        for (uint32_t y = 0; y < src.height; ++y) {
+            uint8_t* o = dst + (size_t)y * out.rowBytes;
+            for (uint32_t x = 0; x < src.width; x += kConvChunkPixels) {
+                uint32_t n = (std::min)(kConvChunkPixels, src.width - x);
+                src_row_to_bgra(src, k, y, x, n, bgra);
+                (rgba ? k.bgraToRgba : k.bgraToRgb24)(bgra, o + (size_t)x * bpp, n);
+            }
+        }
+        break;
+    }
+    case OutFormat::Gray8:
+        convert_frame_to_gray(src, k, out, dst);
+        break;
+    case OutFormat::I420:
+    case OutFormat::Nv12:
+        convert_frame_to_yuv420(src, k, out, dst);
+        break;
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+// Native frame -> output layout conversion: crop, scale and pixel format. YUV uses BT.601
+// limited range with 8-bit fixed point, identical in the scalar and SIMD paths so the output
+// does not depend on the CPU. No Windows dependencies (covered by tests/test_convert.cpp).
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class SrcFormat : uint32_t {
+    Rgb32,
+    Rgb24,
+    Yuy2,
+    Nv12,
+};
+
+struct SrcFrame {
+    SrcFormat fmt = SrcFormat::Rgb32;
+    const uint8_t* data = nullptr;
+    const uint8_t* chroma = nullptr; // NV12 UV plane; nullptr = right after the luma plane
+    size_t stride = 0;        // bytes per row (luma plane for NV12)
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool bottomUp = false;    // RGB only; YUV is always top-down
+};
+
+inline const uint8_t* nv12_chroma(const SrcFrame& src) {
+    return src.chroma ? src.chroma : src.data + src.stride * (size_t)src.height;
+}
+
+// Output layouts; values match CDS_PIXEL_*. Planar formats put chroma right after the
+// luma plane (I420: U then V; NV12: interleaved UV), each (w+1)/2 x (h+1)/2, still in
+// limited range. GRAY8 is full-range luma.
+enum class OutFormat : uint32_t {
+    Bgra = 0,
+    Rgba = 1,
+    Rgb24 = 2, // R,G,B byte order
+    Gray8 = 3,
+    I420 = 4,
+    Nv12 = 5,
+};
+
+struct OutLayout {
+    OutFormat fmt = OutFormat::Bgra;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    size_t rowBytes = 0;   // first (or only) plane
+    size_t frameBytes = 0; // all planes
+};
+
+bool calc_out_layout(OutFormat fmt, uint32_t width, uint32_t height, OutLayout& out);
+
+// Crop and scale applied between the native frame and the output layout.
+// roi is in native pixels with even x/y (keeps YUV chroma pairs intact); scaleW/H = 0 keeps the roi size.
+struct FrameGeometry {
+    uint32_t roiX = 0, roiY = 0, roiW = 0, roiH = 0;
+    uint32_t scaleW = 0, scaleH = 0;
+    OutLayout out; // out.width/height = final frame size
+};
+
+// Shrinking more than this per axis would overflow the box filter's accumulators.
+constexpr uint32_t kMaxDownscale = 64;
+
+// Fills g.out from the roi and scale; false if either is out of range.
+bool calc_geometry(OutFormat fmt, FrameGeometry& g);
+
+// Bytes a sample of this layout must have.
+bool calc_src_frame_bytes(SrcFormat fmt, size_t stride, uint32_t height, size_t& totalBytes);
+
+// Per-thread working memory for scaled conversions (reused across frames).
+struct ConvScratch {
+    std::vector<uint8_t> srcRows;  // staged BGRA source rows
+    std::vector<uint8_t> outRows;  // two BGRA output rows
+    std::vector<uint8_t> pairRow;  // I420/NV12: even BGRA output row waiting for its partner
+    std::vector<uint32_t> acc;     // box sums
+    std::vector<uint32_t> xStart;  // box: first source column; bilinear: left column
+    std::vector<uint32_t> xCount;  // box: columns per output pixel; bilinear: right weight (0..256)
+};
+
+// Narrows a full native frame to the geometry's roi (no copy). roi x/y are even.
+SrcFrame crop_src_frame(const SrcFrame& full, const FrameGeometry& g);
+
+// Converts a whole native frame (already cropped) into the requested top-down output layout
+// in one pass, scaling when the output size differs. sc is only used when scaling.
+void convert_frame(const SrcFrame& src, const OutLayout& out, uint8_t* dst, ConvScratch& sc);
@@ -0,0 +1,88 @@
+#include "decode_pool.h"
+
+bool MjpegDecodePool::start(int32_t threads, uint64_t firstSeq) {
+    threads = threads < 1 ? 1 : (threads > kMaxMjpegDecodeThreads ? kMaxMjpegDecodeThreads : threads);
+    _nextPublishSeq = firstSeq;
+    _stopping = false;
+    try {
+        for (int32_t i = 0; i < threads * 2; ++i) {
+            _jobs.push_back(std::make_unique<MjpegJob>());
+            _freeJobs.push_back(_jobs.back().get());
+        }
+        for (int32_t i = 0; i < threads; ++i) _workers.emplace_back(&MjpegDecodePool::worker_main, this);
+    }
+    catch (...) {
+        stop();
+        return false;
+    }
+    return true;
+}
+
+void MjpegDecodePool::stop() {
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _stopping = true;
+    }
+    _jobCv.notify_all();
+    _publishCv.notify_all();
+    for (auto& t : _workers) {
+        if (t.joinable()) t.join();
+    }
+    _workers.clear();
+}
+
+MjpegJob* MjpegDecodePool::begin_submit() {
+    std::lock_guard<std::mutex> lk(_mutex);
+    if (_stopping || _freeJobs.empty()) return nullptr;
+    MjpegJob* job = _freeJobs.back();
+    _freeJobs.pop_back();
+    return job;
+}
+
+void MjpegDecodePool::end_submit(MjpegJob* job) {
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _queue.push_back(job);
+    }
+    _jobCv.notify_one();
+}
+
+void MjpegDecodePool::worker_main() {
+    std::unique_ptr<MjpegSlotDecoder> dec = _host.make_decoder();
+
+    for (;;) {
+        MjpegJob* job = nullptr;
+        {
+            std::unique_lock<std::mutex> lk(_mutex);
+            _jobCv.wait(lk, [&]() { return _stopping || !_queue.empty(); });
+            if (_stopping) break;
+            job = _queue.front();
+            _queue.pop_front();
+        }
+
+        // Workers claim while another one may be publishing; begin_write never hands out the
+        // slot being published (tests/test_decode_pool.cpp).
+        int32_t slot = dec ? _frames.begin_write() : -1;
+        bool ok = slot >= 0 && dec->decode(*job, _frames.slots[slot]);
+
+        bool publish = false;
+        {
+            std::unique_lock<std::mutex> lk(_mutex);
+            _publishCv.wait(lk, [&]() { return _stopping || _nextPublishSeq == job->seq; });
+            publish = !_stopping;
+        }
+        // Our turn: nobody else publishes until _nextPublishSeq moves on, so the
+        // publish (and the history copy behind it) runs without blocking claims or submits.
+        if (publish && ok) _host.publish(slot, *job);
+        else {
+            if (slot >= 0) _frames.abort_write(slot);
+            _host.dropped(*job);
+        }
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            if (publish) _nextPublishSeq = job->seq + 1;
+            _freeJobs.push_back(job);
+        }
+        _publishCv.notify_all();
+    }
+}
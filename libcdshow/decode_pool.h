@@ -0,0 +1,81 @@
+#pragma once
+
+#include "frame_exchange.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ---- MJPEG decode pool (CDS_CAPTURE_DECODE_POOL) ----
+// The streaming thread only copies the compressed sample into a job; workers
+// decode into frame slots in parallel and publish strictly in sequence order,
+// so readers never see frames go backwards. Frames are dropped (leaving a
+// sequence gap) when all jobs are busy, a worker finds no free slot, or
+// decoding fails.
+constexpr int32_t kMaxMjpegDecodeThreads = 4; // bounded by kFrameSlotCount
+
+struct MjpegJob {
+    std::vector<uint8_t> data;
+    uint64_t seq = 0;
+    FrameStamp stamp;
+};
+
+// Per-worker decoder, created on the worker thread so it can hold thread-affine
+// state (COM apartment, codec factory).
+class MjpegSlotDecoder {
+public:
+    virtual ~MjpegSlotDecoder() = default;
+    // Fills fs.layout and fs.data from the job; false drops the frame.
+    virtual bool decode(const MjpegJob& job, FrameSlot& fs) = 0;
+};
+
+// What the pool needs from its owner (the capture session, or a benchmark).
+class MjpegDecodeHost {
+public:
+    virtual ~MjpegDecodeHost() = default;
+    // Worker thread; nullptr leaves the worker running but dropping every frame.
+    virtual std::unique_ptr<MjpegSlotDecoder> make_decoder() = 0;
+    // Called in seq order, one at a time, without any pool lock held.
+    virtual void publish(int32_t slot, const MjpegJob& job) = 0;
+    virtual void dropped(const MjpegJob& job) = 0;
+};
+
+class MjpegDecodePool {
+public:
+    MjpegDecodePool(FrameExchange& frames, MjpegDecodeHost& host) : _frames(frames), _host(host) {}
+    MjpegDecodePool(const MjpegDecodePool&) = delete;
+    MjpegDecodePool& operator=(const MjpegDecodePool&) = delete;
+    ~MjpegDecodePool() { stop(); }
+
+    // firstSeq is the seq the first submitted job will carry.
+    bool start(int32_t threads, uint64_t firstSeq);
+    // Only once no more submissions can arrive; drops queued jobs.
+    void stop();
+
+    // Streaming thread: a free job to fill (data, seq, stamp), or nullptr when the
+    // workers are behind and the sample should be dropped. Jobs must be submitted
+    // in seq order with consecutive seqs.
+    MjpegJob* begin_submit();
+    void end_submit(MjpegJob* job);
+
+    int32_t threads() const { return (int32_t)_workers.size(); }
+
+private:
+    void worker_main();
+
+    FrameExchange& _frames;
+    MjpegDecodeHost& _host;
+    std::mutex _mutex;
+    std::condition_variable _jobCv;     // workers wait for work
+    std::condition_variable _publishCv; // workers wait for their turn to publish
+    std::deque<MjpegJob*> _queue;
+    std::vector<MjpegJob*> _freeJobs;
+    std::vector<std::unique_ptr<MjpegJob>> _jobs;
+    std::vector<std::thread> _workers;
+    uint64_t _nextPublishSeq = 1;
+    bool _stopping = false;
+};
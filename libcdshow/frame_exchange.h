@@ -0,0 +1,124 @@
+#pragma once
+
+#include "convert.h"
+#include "frame_pool.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Tests define this to run code between the two stores of end_write.
+#ifndef CDS_EXCHANGE_PUBLISH_HOOK
+#define CDS_EXCHANGE_PUBLISH_HOOK(exchange, slot) ((void)0)
+#endif
+
+// ---- Lock-free frame exchange (slot ring) ----
+// BufferCB claims a slot that is neither published nor pinned, fills it and
+// publishes it with an atomic store. Readers pin the published slot while they
+// copy it (or while a cds_acquire_frame lease is held), so the streaming thread
+// never waits on a reader and vice versa.
+// The first kFrameSlotsPreallocated slots form the steady-state triple buffer;
+// the rest are only allocated when leases keep those pinned.
+constexpr int32_t kFrameSlotCount = 8;
+constexpr int32_t kFrameSlotsPreallocated = 3;
+constexpr int32_t kFrameSlotWriting = -1;
+
+// Taken when BufferCB sees the sample, before any conversion.
+struct FrameStamp {
+    int64_t sampleTime100ns = -1;
+    uint64_t mono100ns = 0;
+    uint64_t utc100ns = 0;
+};
+
+struct FrameData {
+    FrameBuffer data;               // frame in `layout`; native sample when lazy; JPEG bitstream in encoded mode (size() = length)
+    OutLayout layout;               // written by producer before publish (geometry can change between frames)
+    uint64_t seq = 0;               // written by producer before publish
+    uint64_t timestamp100ns = 0;    // arrival time, same clock as cds_button_timestamp (wall clock)
+    uint64_t arrivalMono100ns = 0;  // arrival time, QueryPerformanceCounter
+    int64_t sampleTime100ns = -1;   // stream time DirectShow stamped on the sample
+    SrcFrame native;                // lazy/encoded: layout of the sample as captured (data unused)
+    FrameGeometry geometry;         // lazy: roi/scale in force at capture, applied when read (layout = geometry.out)
+    bool nativeJpeg = false;        // lazy/encoded: the sample is a JPEG
+};
+
+struct FrameSlot : FrameData {
+    std::atomic<int32_t> pins{ 0 }; // >0 = pinned by readers, kFrameSlotWriting = owned by producer
+};
+
+struct FrameExchange {
+    FrameSlot slots[kFrameSlotCount];
+    std::atomic<int32_t> latest{ -1 };
+
+    // Producers. Safe to call from several threads at once (the MJPEG decode pool's workers
+    // claim while another one publishes); see end_write for why.
+    // Returns -1 if every other slot is pinned (frame is dropped).
+    int32_t begin_write() {
+        for (int32_t i = 0; i < kFrameSlotCount; ++i) {
+            int32_t expected = 0;
+            if (!slots[i].pins.compare_exchange_strong(expected, kFrameSlotWriting, std::memory_order_acquire))
+                continue;
+            // Checked after claiming: the slot may be the one published last (end_write sets
+            // `latest` before releasing it), but latest cannot move to a slot we hold.
+            if (latest.load(std::memory_order_acquire) != i) return i;
+            slots[i].pins.store(0, std::memory_order_release);
+        }
+        return -1;
+    }
+
+    // Publishes before releasing the claim: once the slot is claimable again it is already
+    // `latest`, so the re-checks in begin_write/reserve keep other claimers off it. (The
+    // other order leaves a window where the slot is free and not yet latest.)
+    void end_write(int32_t i) {
+        latest.store(i, std::memory_order_release);
+        CDS_EXCHANGE_PUBLISH_HOOK(this, i);
+        slots[i].pins.store(0, std::memory_order_release);
+    }
+
+    void abort_write(int32_t i) {
+        slots[i].pins.store(0, std::memory_order_release);
+    }
+
+    // Any thread: grows the first `count` slots to `bytes` so the producer does not allocate
+    // on its own thread. Takes one slot at a time the way the producer does; the published
+    // slot and slots that are pinned or being written keep their buffer until their next write.
+    void reserve(int32_t count, size_t bytes) {
+        for (int32_t i = 0; i < count; ++i) {
+            int32_t expected = 0;
+            if (!slots[i].pins.compare_exchange_strong(expected, kFrameSlotWriting, std::memory_order_acquire))
+                continue;
+            // Checked after claiming, as in begin_write.
+            if (latest.load(std::memory_order_acquire) != i) {
+                try {
+                    slots[i].data.reserve(bytes);
+                }
+                catch (const std::bad_alloc&) {
+                }
+            }
+            slots[i].pins.store(0, std::memory_order_release);
+        }
+    }
+
+    // Readers. Returns -1 if nothing has been published yet.
+    int32_t pin_latest() {
+        for (;;) {
+            int32_t i = latest.load(std::memory_order_acquire);
+            if (i < 0) return -1;
+            int32_t p = slots[i].pins.load(std::memory_order_relaxed);
+            while (p >= 0) {
+                if (!slots[i].pins.compare_exchange_weak(p, p + 1, std::memory_order_acquire))
+                    continue;
+                // The slot may have been claimed, scribbled on and aborted between reading
+                // `latest` and pinning it. While we hold the pin it cannot be republished,
+                // so it is intact exactly when it is still the latest.
+                if (latest.load(std::memory_order_acquire) == i) return i;
+                unpin(i);
+                break;
+            }
+            // Slot is being written or is still being published; retry.
+        }
+    }
+
+    void unpin(int32_t i) {
+        slots[i].pins.fetch_sub(1, std::memory_order_release);
+    }
+};
@@ -0,0 +1,273 @@
+#include "frame_pool.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdio>
+#endif
+
+uint8_t* FrameBufferPool::acquire(size_t bytes, size_t& capacity) {
+    const size_t sizeClass = size_class(bytes);
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        auto it = _free.find(sizeClass);
+        if (it != _free.end() && !it->second.empty()) {
+            uint8_t* p = it->second.back();
+            it->second.pop_back();
+            capacity = header(p)->capacity;
+            _bytesCached -= capacity;
+            --_blocksCached;
+            _bytesInUse += capacity;
+            ++_blocksInUse;
+            ++_reuses;
+            return p;
+        }
+    }
+
+    uint8_t* p = allocate(sizeClass);
+    if (!p) return nullptr;
+    capacity = header(p)->capacity;
+    std::lock_guard<std::mutex> lk(_mutex);
+    _bytesInUse += capacity;
+    ++_blocksInUse;
+    ++_allocations;
+    return p;
+}
+
+void FrameBufferPool::release(uint8_t* p) {
+    if (!p) return;
+    const size_t capacity = header(p)->capacity;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _bytesInUse -= capacity;
+        --_blocksInUse;
+        if (_bytesCached + capacity <= _maxCachedBytes) {
+            try {
+                _free[header(p)->sizeClass].push_back(p);
+                _bytesCached += capacity;
+                ++_blocksCached;
+                return;
+            }
+            catch (const std::bad_alloc&) {
+            }
+        }
+    }
+    free_block(p);
+}
+
+void FrameBufferPool::trim() {
+    std::map<size_t, std::vector<uint8_t*>> cached;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        cached.swap(_free);
+        _bytesCached = 0;
+        _blocksCached = 0;
+    }
+    for (auto& kv : cached)
+        for (uint8_t* p : kv.second) free_block(p);
+}
+
+bool FrameBufferPool::set_large_pages(bool enabled) {
+    if (enabled && !_backend.enable_large_pages()) return false;
+    _largePages.store(enabled);
+    return true;
+}
+
+void FrameBufferPool::stats(cds_buffer_pool_stats& out) {
+    std::lock_guard<std::mutex> lk(_mutex);
+    out.bytes_in_use = _bytesInUse;
+    out.bytes_cached = _bytesCached;
+    out.buffers_in_use = _blocksInUse;
+    out.buffers_cached = _blocksCached;
+    out.allocations = _allocations;
+    out.reuses = _reuses;
+    out.large_page_bytes = _largePageBytes;
+}
+
+size_t FrameBufferPool::size_class(size_t bytes) {
+    if (bytes <= kPoolMinBlock) return kPoolMinBlock;
+    size_t octave = kPoolMinBlock;
+    while (octave * 2 < bytes && octave < (SIZE_MAX >> 2)) octave *= 2;
+    size_t step = octave / 4;
+    return (bytes + step - 1) / step * step;
+}
+
+uint8_t* FrameBufferPool::allocate(size_t sizeClass) {
+    if (sizeClass > SIZE_MAX - kPoolAlign) return nullptr;
+    const size_t largePage = _backend.large_page_size();
+    const bool large = _largePages.load() && largePage != 0 && sizeClass >= largePage;
+    PoolBlock b = _backend.allocate(sizeClass + kPoolAlign, large);
+    if (!b.base) return nullptr;
+
+    uint8_t* p = b.base + kPoolAlign;
+    header(p)->sizeClass = sizeClass;
+    header(p)->capacity = b.bytes - kPoolAlign;
+    header(p)->largePages = b.largePages;
+    if (b.largePages) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _largePageBytes += b.bytes - kPoolAlign;
+    }
+    return p;
+}
+
+void FrameBufferPool::free_block(uint8_t* p) {
+    PoolBlockHeader* h = header(p);
+    PoolBlock b;
+    b.base = p - kPoolAlign;
+    b.bytes = h->capacity + kPoolAlign;
+    b.largePages = h->largePages;
+    if (b.largePages) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _largePageBytes -= h->capacity;
+    }
+    _backend.release(b);
+}
+
+FrameBufferPool& frame_buffer_pool() {
+    static FrameBufferPool* pool = new FrameBufferPool(system_pool_backend());
+    return *pool;
+}
+
+// ---- FrameBuffer ----
+
+FrameBuffer& FrameBuffer::operator=(const FrameBuffer& o) {
+    if (this != &o) {
+        resize(o._size);
+        if (_size) memcpy(_p, o._p, _size);
+    }
+    return *this;
+}
+
+FrameBuffer& FrameBuffer::operator=(FrameBuffer&& o) noexcept {
+    if (this != &o) {
+        frame_buffer_pool().release(_p);
+        _p = o._p; _size = o._size; _capacity = o._capacity;
+        o._p = nullptr;
+        o._size = o._capacity = 0;
+    }
+    return *this;
+}
+
+void FrameBuffer::reserve(size_t n) {
+    if (n <= _capacity) return;
+    size_t capacity = 0;
+    uint8_t* p = frame_buffer_pool().acquire(n, capacity);
+    if (!p) throw std::bad_alloc();
+    frame_buffer_pool().release(_p);
+    _p = p;
+    _capacity = capacity;
+}
+
+#if !defined(_WIN32)
+// ---- POSIX backend ----
+// posix_memalign for ordinary blocks. On Linux, large blocks try the hugetlbfs pool first
+// (MAP_HUGETLB, only succeeds when the admin reserved huge pages) and then transparent huge
+// pages: an anonymous mapping aligned to the huge page size with MADV_HUGEPAGE, which the
+// kernel backs with huge pages when it can. Both are released with munmap.
+class PosixPoolBackend : public PoolBackend {
+public:
+    size_t large_page_size() override {
+#if defined(__linux__)
+        static const size_t size = read_huge_page_size();
+        return size;
+#else
+        return 0;
+#endif
+    }
+
+    bool enable_large_pages() override {
+#if defined(__linux__)
+        if (large_page_size() == 0) return false;
+        // THP in "always" or "madvise" mode, or a non-empty hugetlbfs pool.
+        char mode[128]{};
+        if (read_file("/sys/kernel/mm/transparent_hugepage/enabled", mode, sizeof(mode)) && !strstr(mode, "[never]"))
+            return true;
+        return meminfo_value("HugePages_Total:") > 0;
+#else
+        return false;
+#endif
+    }
+
+    PoolBlock allocate(size_t bytes, bool largePages) override {
+        PoolBlock b;
+#if defined(__linux__)
+        const size_t lp = large_page_size();
+        if (largePages && lp != 0 && bytes <= SIZE_MAX - 2 * lp) {
+            const size_t rounded = (bytes + lp - 1) / lp * lp;
+            void* m = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (m == MAP_FAILED) m = map_transparent_huge(rounded, lp);
+            if (m) {
+                b.base = (uint8_t*)m;
+                b.bytes = rounded;
+                b.largePages = true;
+                return b;
+            }
+        }
+#else
+        (void)largePages;
+#endif
+        void* p = nullptr;
+        if (posix_memalign(&p, kPoolAlign, bytes) != 0) return b;
+        b.base = (uint8_t*)p;
+        b.bytes = bytes;
+        return b;
+    }
+
+    void release(const PoolBlock& block) override {
+        if (block.largePages) munmap(block.base, block.bytes);
+        else ::free(block.base);
+    }
+
+private:
+#if defined(__linux__)
+    static bool read_file(const char* path, char* buf, size_t size) {
+        FILE* f = fopen(path, "r");
+        if (!f) return false;
+        size_t n = fread(buf, 1, size - 1, f);
+        fclose(f);
+        buf[n] = 0;
+        return n > 0;
+    }
+
+    // First number after `key` in /proc/meminfo, 0 if missing.
+    static unsigned long long meminfo_value(const char* key) {
+        char buf[4096]{};
+        if (!read_file("/proc/meminfo", buf, sizeof(buf))) return 0;
+        const char* p = strstr(buf, key);
+        return p ? strtoull(p + strlen(key), nullptr, 10) : 0;
+    }
+
+    static size_t read_huge_page_size() {
+        char buf[64]{};
+        if (read_file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", buf, sizeof(buf)))
+            return (size_t)strtoull(buf, nullptr, 10);
+        return (size_t)meminfo_value("Hugepagesize:") * 1024;
+    }
+
+    // Over-maps by one huge page and trims both ends so the range is huge-page aligned.
+    static void* map_transparent_huge(size_t bytes, size_t lp) {
+        void* m = mmap(nullptr, bytes + lp, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) return nullptr;
+        uintptr_t start = (uintptr_t)m;
+        uintptr_t aligned = (start + lp - 1) / lp * lp;
+        if (aligned > start) munmap(m, aligned - start);
+        uintptr_t tail = aligned + bytes;
+        if (start + bytes + lp > tail) munmap((void*)tail, start + bytes + lp - tail);
+        if (madvise((void*)aligned, bytes, MADV_HUGEPAGE) != 0) {
+            munmap((void*)aligned, bytes);
+            return nullptr;
+        }
+        return (void*)aligned;
+    }
+#endif
+};
+
+PoolBackend& system_pool_backend() {
+    static PosixPoolBackend* backend = new PosixPoolBackend();
+    return *backend;
+}
+#endif
@@ -0,0 +1,128 @@
+#pragma once
+
+// ---- Frame buffer pool ----
+// Frame memory is 64-byte aligned (whole cache lines for the SIMD converters) and comes
+// from a process-wide pool, so slots, history entries and sessions started after a stop
+// or format change reuse buffers instead of going back to the heap. Sizes are rounded to
+// classes 1/4 octave apart (JPEG samples of varying length share a few classes). Blocks
+// of at least one large page can be backed by large pages (cds_set_large_pages).
+// Memory itself comes from a PoolBackend: VirtualAlloc/_aligned_malloc on Windows
+// (libcdshow.cpp), posix_memalign plus hugetlb/THP on Linux (frame_pool.cpp).
+
+#include "libcdshow.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+constexpr size_t kPoolAlign = 64;
+constexpr size_t kPoolMinBlock = 4096;
+constexpr uint64_t kPoolMaxCachedBytes = 256ull << 20; // free blocks beyond this go back to the OS
+
+struct PoolBlock {
+    uint8_t* base = nullptr; // kPoolAlign-aligned; nullptr = allocation failed
+    size_t bytes = 0;        // usable from base (at least what was asked for)
+    bool largePages = false;
+};
+
+// Where the pool's memory comes from. Thread-safe; tests substitute a fake.
+class PoolBackend {
+public:
+    virtual ~PoolBackend() = default;
+    // Large page granularity, 0 if the platform has none.
+    virtual size_t large_page_size() = 0;
+    // Makes large pages usable by the process (privilege, kernel support); false if they are not.
+    virtual bool enable_large_pages() = 0;
+    // At least `bytes` bytes; with largePages, rounded up to whole large pages when they can be
+    // had and ordinary memory otherwise.
+    virtual PoolBlock allocate(size_t bytes, bool largePages) = 0;
+    virtual void release(const PoolBlock& block) = 0;
+};
+
+// The platform's backend; lives for the whole process.
+PoolBackend& system_pool_backend();
+
+struct PoolBlockHeader {   // sits in the 64 bytes before the buffer
+    size_t sizeClass;      // free list it returns to
+    size_t capacity;       // usable bytes (more than sizeClass for large pages)
+    bool largePages;
+};
+
+class FrameBufferPool {
+public:
+    explicit FrameBufferPool(PoolBackend& backend, uint64_t maxCachedBytes = kPoolMaxCachedBytes)
+        : _backend(backend), _maxCachedBytes(maxCachedBytes) {}
+
+    // Returns nullptr if the backend is out of memory; capacity receives the usable size.
+    uint8_t* acquire(size_t bytes, size_t& capacity);
+    void release(uint8_t* p);
+
+    // Returns every cached block to the OS.
+    void trim();
+
+    bool set_large_pages(bool enabled);
+    void stats(cds_buffer_pool_stats& out);
+
+    static size_t size_class(size_t bytes);
+
+private:
+    static PoolBlockHeader* header(uint8_t* p) { return (PoolBlockHeader*)(p - kPoolAlign); }
+
+    uint8_t* allocate(size_t sizeClass);
+    void free_block(uint8_t* p);
+
+    PoolBackend& _backend;
+    const uint64_t _maxCachedBytes;
+    std::mutex _mutex;
+    std::map<size_t, std::vector<uint8_t*>> _free; // by size class
+    std::atomic<bool> _largePages{ false };
+    uint64_t _bytesInUse = 0;
+    uint64_t _bytesCached = 0;
+    uint64_t _blocksInUse = 0;
+    uint64_t _blocksCached = 0;
+    uint64_t _allocations = 0;
+    uint64_t _reuses = 0;
+    uint64_t _largePageBytes = 0;
+};
+
+// Never destroyed: frame buffers of sessions still alive at exit return to it.
+FrameBufferPool& frame_buffer_pool();
+
+// Byte buffer backed by the pool. Like the std::vector it replaces, resize() keeps the
+// capacity when shrinking; unlike it, growing does not keep the contents (every writer
+// fills the whole buffer) and new bytes are not zeroed.
+class FrameBuffer {
+public:
+    FrameBuffer() = default;
+    ~FrameBuffer() { frame_buffer_pool().release(_p); }
+
+    FrameBuffer(const FrameBuffer& o) { *this = o; }
+    FrameBuffer& operator=(const FrameBuffer& o);
+    FrameBuffer(FrameBuffer&& o) noexcept : _p(o._p), _size(o._size), _capacity(o._capacity) {
+        o._p = nullptr;
+        o._size = o._capacity = 0;
+    }
+    FrameBuffer& operator=(FrameBuffer&& o) noexcept;
+
+    // Throws std::bad_alloc like vector::resize.
+    void resize(size_t n) {
+        reserve(n);
+        _size = n;
+    }
+    // Grows the capacity without changing size(); contents are not kept when it grows.
+    void reserve(size_t n);
+
+    uint8_t* data() { return _p; }
+    const uint8_t* data() const { return _p; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _capacity; }
+    bool empty() const { return _size == 0; }
+
+private:
+    uint8_t* _p = nullptr;
+    size_t _size = 0;
+    size_t _capacity = 0;
+};
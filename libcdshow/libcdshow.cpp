@@ -1,12 +1,22 @@
 #define _WIN32_DCOM
 #include "stdafx.h"
 #include "libcdshow.h"
+#include "convert.h"
+#include "frame_pool.h"
+#include "frame_exchange.h"
+#include "decode_pool.h"
+#include "session_loop.h"
 
 #pragma comment(lib, "strmiids.lib")
+#pragma comment(lib, "windowscodecs.lib")
+#pragma comment(lib, "setupapi.lib")
 
 #include <windows.h>
 #include <dshow.h>
 #include <strmif.h>
+#include <wincodec.h>
+#include <setupapi.h>
+#include <devpkey.h>
 #include <comutil.h>
 #include <comdef.h>
 
@@ -21,6 +31,9 @@
 #include <chrono>
 #include <map>
 #include <set>
+#include <deque>
+#include <memory>
+#include <functional>
 #include <algorithm>
 #include <limits>
 
@@ -123,6 +136,13 @@ static const char* SubTypeName(const GUID& st) {
     return nullptr;
 }
 
+// FOURCC of subtypes built on the FOURCC base GUID ({XXXXXXXX-0000-0010-8000-00AA00389B71}), else 0.
+static uint32_t SubTypeFourcc(const GUID& st) {
+    static const uint8_t kTail[8] = { 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71 };
+    if (st.Data2 != 0x0000 || st.Data3 != 0x0010 || memcmp(st.Data4, kTail, sizeof(kTail)) != 0) return 0;
+    return (uint32_t)st.Data1;
+}
+
 static std::string HResultToString(HRESULT hr) {
     _com_error err(hr);
     wchar_t const* msg = err.ErrorMessage();
@@ -187,6 +207,18 @@ static std::string WToUtf8(const std::wstring& ws) {
     return out;
 }
 
+static std::wstring Utf8ToW(const std::string& s) {
+    if (s.empty()) return {};
+    int sizeNeeded = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, nullptr, 0);
+    if (sizeNeeded <= 0) return {};
+    std::wstring out;
+    out.resize((size_t)sizeNeeded);
+    int written = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, &out[0], sizeNeeded);
+    if (written <= 0) return {};
+    if (!out.empty() && out.back() == L'\0') out.pop_back();
+    return out;
+}
+
 static std::string PinDirToStr(PIN_DIRECTION d) {
     return d == PINDIR_INPUT ? "IN" : "OUT";
 }
@@ -355,6 +387,225 @@ static HRESULT FindPinByCategory(IBaseFilter* f, const GUID& cat, PIN_DIRECTION
     return HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
 }
 
+// =============================================================================
+// =========================== MJPEG decoding (WIC) ============================
+// =============================================================================
+
+// Standard Huffman tables (ITU T.81 Annex K.3). UVC MJPEG frames usually omit DHT and
+// rely on these, but stock JPEG decoders (WIC included) require them in the stream.
+static const uint8_t kDhtBitsDcLum[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t kDhtBitsDcChr[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t kDhtValsDc[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8_t kDhtBitsAcLum[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t kDhtValsAcLum[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+static const uint8_t kDhtBitsAcChr[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t kDhtValsAcChr[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+// One DHT segment carrying all four tables.
+static const std::vector<uint8_t>& standard_dht_segment() {
+    static const std::vector<uint8_t> seg = []() {
+        std::vector<uint8_t> v = { 0xFF, 0xC4, 0x00, 0x00 };
+        auto add = [&](uint8_t tcTh, const uint8_t* bits, const uint8_t* vals, size_t nVals) {
+            v.push_back(tcTh);
+            v.insert(v.end(), bits, bits + 16);
+            v.insert(v.end(), vals, vals + nVals);
+        };
+        add(0x00, kDhtBitsDcLum, kDhtValsDc, sizeof(kDhtValsDc));
+        add(0x01, kDhtBitsDcChr, kDhtValsDc, sizeof(kDhtValsDc));
+        add(0x10, kDhtBitsAcLum, kDhtValsAcLum, sizeof(kDhtValsAcLum));
+        add(0x11, kDhtBitsAcChr, kDhtValsAcChr, sizeof(kDhtValsAcChr));
+        size_t segLen = v.size() - 2;
+        v[2] = (uint8_t)(segLen >> 8);
+        v[3] = (uint8_t)(segLen & 0xFF);
+        return v;
+    }();
+    return seg;
+}
+
+// Returns the offset of the SOS marker if the stream has no DHT before it, else 0.
+static size_t mjpeg_missing_dht_insert_pos(const uint8_t* p, size_t len) {
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) return 0;
+    size_t i = 2;
+    while (i + 4 <= len) {
+        if (p[i] != 0xFF) return 0;
+        uint8_t m = p[i + 1];
+        if (m == 0xFF) { ++i; continue; }     // fill byte
+        if (m == 0xC4) return 0;              // has DHT
+        if (m == 0xDA) return i;              // SOS reached without DHT
+        size_t segLen = ((size_t)p[i + 2] << 8) | p[i + 3];
+        if (segLen < 2) return 0;
+        i += 2 + segLen;
+    }
+    return 0;
+}
+
+// Joins the multithreaded apartment for the object's lifetime (fails harmlessly on an STA thread).
+struct MtaScope {
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    MtaScope() = default;
+    MtaScope(const MtaScope&) = delete;
+    MtaScope& operator=(const MtaScope&) = delete;
+    ~MtaScope() { if (SUCCEEDED(hr)) CoUninitialize(); }
+};
+
+// Decodes MJPEG samples with the OS JPEG codec. One instance per thread (the
+// factory is created in that thread's apartment).
+class WicJpegDecoder {
+public:
+    WicJpegDecoder() = default;
+    WicJpegDecoder(const WicJpegDecoder&) = delete;
+    WicJpegDecoder& operator=(const WicJpegDecoder&) = delete;
+    ~WicJpegDecoder() { SAFE_RELEASE(_factory); }
+
+    HRESULT init() {
+        if (_factory) return S_OK;
+        return CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER,
+            IID_IWICImagingFactory, (void**)&_factory);
+    }
+
+    // Decodes the geometry's roi into its output layout; fails if the JPEG is not exactly
+    // width x height. Unscaled packed layouts come straight out of WIC; everything else goes
+    // through a BGRA scratch frame of the roi.
+    HRESULT decode(const uint8_t* data, size_t len, uint32_t width, uint32_t height,
+        const FrameGeometry& g, uint8_t* dst, ConvScratch& sc) {
+        const OutLayout& out = g.out;
+        WICRect rect{ (INT)g.roiX, (INT)g.roiY, (INT)g.roiW, (INT)g.roiH };
+        bool scaled = out.width != g.roiW || out.height != g.roiH;
+        const GUID* wicFormat = nullptr;
+        switch (out.fmt) {
+        case OutFormat::Bgra:  wicFormat = &GUID_WICPixelFormat32bppBGRA; break;
+        case OutFormat::Rgba:  wicFormat = &GUID_WICPixelFormat32bppRGBA; break;
+        case OutFormat::Rgb24: wicFormat = &GUID_WICPixelFormat24bppRGB; break;
+        case OutFormat::Gray8: wicFormat = &GUID_WICPixelFormat8bppGray; break;
+        default: break;
+        }
+        if (wicFormat && !scaled) return decode_wic(data, len, width, height, rect, *wicFormat, dst, out.rowBytes);
+
+        OutLayout bgra{};
+        if (!calc_out_layout(OutFormat::Bgra, g.roiW, g.roiH, bgra)) return E_INVALIDARG;
+        _bgra.resize(bgra.frameBytes);
+        HRESULT hr = decode_wic(data, len, width, height, rect, GUID_WICPixelFormat32bppBGRA, _bgra.data(), bgra.rowBytes);
+        if (FAILED(hr)) return hr;
+
+        SrcFrame src{};
+        src.fmt = SrcFormat::Rgb32;
+        src.data = _bgra.data();
+        src.stride = bgra.rowBytes;
+        src.width = g.roiW;
+        src.height = g.roiH;
+        convert_frame(src, out, dst, sc);
+        return S_OK;
+    }
+
+private:
+    HRESULT decode_wic(const uint8_t* data, size_t len, uint32_t width, uint32_t height, const WICRect& rect,
+        const GUID& wicFormat, uint8_t* dst, size_t dstStride) {
+        if (!_factory) return E_POINTER;
+        if (!data || !dst || len == 0 || len > MAXDWORD) return E_INVALIDARG;
+        if (dstStride > MAXDWORD || (size_t)rect.Height > MAXDWORD / dstStride) return E_INVALIDARG;
+
+        size_t insertPos = mjpeg_missing_dht_insert_pos(data, len);
+        if (insertPos) {
+            const std::vector<uint8_t>& dht = standard_dht_segment();
+            _patched.assign(data, data + insertPos);
+            _patched.insert(_patched.end(), dht.begin(), dht.end());
+            _patched.insert(_patched.end(), data + insertPos, data + len);
+            data = _patched.data();
+            len = _patched.size();
+        }
+
+        IWICStream* stream = nullptr;
+        IWICBitmapDecoder* dec = nullptr;
+        IWICBitmapFrameDecode* frame = nullptr;
+        IWICFormatConverter* conv = nullptr;
+
+        HRESULT hr = _factory->CreateStream(&stream);
+        if (SUCCEEDED(hr)) hr = stream->InitializeFromMemory(const_cast<BYTE*>(data), (DWORD)len);
+        if (SUCCEEDED(hr)) hr = _factory->CreateDecoder(GUID_ContainerFormatJpeg, nullptr, &dec);
+        if (SUCCEEDED(hr)) hr = dec->Initialize(stream, WICDecodeMetadataCacheOnDemand);
+        if (SUCCEEDED(hr)) hr = dec->GetFrame(0, &frame);
+
+        UINT w = 0, h = 0;
+        if (SUCCEEDED(hr)) hr = frame->GetSize(&w, &h);
+        if (SUCCEEDED(hr) && (w != width || h != height)) hr = E_UNEXPECTED;
+
+        if (SUCCEEDED(hr)) hr = _factory->CreateFormatConverter(&conv);
+        if (SUCCEEDED(hr)) hr = conv->Initialize(frame, wicFormat,
+            WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom);
+        if (SUCCEEDED(hr)) hr = conv->CopyPixels(&rect, (UINT)dstStride, (UINT)(dstStride * rect.Height), dst);
+
+        SAFE_RELEASE(conv);
+        SAFE_RELEASE(frame);
+        SAFE_RELEASE(dec);
+        SAFE_RELEASE(stream);
+        return hr;
+    }
+
+    IWICImagingFactory* _factory = nullptr;
+    std::vector<uint8_t> _patched; // sample + standard DHT when the camera omits it
+    std::vector<uint8_t> _bgra;    // planar outputs only
+};
+
+static bool src_format_from_subtype(const GUID& st, SrcFormat& out) {
+    if (st == MEDIASUBTYPE_RGB32 || st == MEDIASUBTYPE_ARGB32) { out = SrcFormat::Rgb32; return true; }
+    if (st == MEDIASUBTYPE_RGB24) { out = SrcFormat::Rgb24; return true; }
+    if (st == MEDIASUBTYPE_YUY2) { out = SrcFormat::Yuy2; return true; }
+    if (st == MEDIASUBTYPE_NV12) { out = SrcFormat::Nv12; return true; }
+    return false;
+}
+
+// DIB-style stride for packed RGB, natural stride for YUY2 / NV12 luma.
+static size_t calc_src_stride(SrcFormat fmt, uint32_t strideWidth) {
+    switch (fmt) {
+    case SrcFormat::Rgb32: return (size_t)strideWidth * 4;
+    case SrcFormat::Rgb24: return (((size_t)strideWidth * 24 + 31) / 32) * 4;
+    case SrcFormat::Yuy2:  return (size_t)strideWidth * 2;
+    case SrcFormat::Nv12:  return (size_t)strideWidth;
+    }
+    return 0;
+}
+
+static void disconnect_filter_pins(IGraphBuilder* graph, IBaseFilter* f) {
+    if (!graph || !f) return;
+    IEnumPins* en = nullptr;
+    if (FAILED(f->EnumPins(&en)) || !en) return;
+    IPin* p = nullptr; ULONG got = 0;
+    while (en->Next(1, &p, &got) == S_OK) {
+        IPin* other = nullptr;
+        if (SUCCEEDED(p->ConnectedTo(&other)) && other) {
+            graph->Disconnect(other);
+            graph->Disconnect(p);
+            other->Release();
+        }
+        p->Release();
+    }
+    en->Release();
+}
+
 // =============================================================================
 // ===================== NEW DirectShow Capture API (cds_*) ====================
 // =============================================================================
@@ -391,10 +642,14 @@ struct DsDevice {
     int pid = 0;
     std::wstring monikerDisplayNameW;
     std::vector<DsFormat> formats; // deduped + sorted
+    uint64_t fingerprint = 0;      // driver/firmware identity, 0 = unknown (see device_fingerprint)
+    bool formatsFromCache = false; // formats came from the device cache; checked at capture start
+    bool present = true;           // false once a rescan no longer finds it (the index stays reserved)
 };
 
 struct DsSession;
 static uint64_t now_ts100ns_utc();
+static uint64_t now_ts100ns_monotonic();
 static bool calc_frame_layout_bytes(uint32_t width, uint32_t height, size_t& rowBytes, size_t& totalBytes);
 
 class FrameGrabberCB : public ISampleGrabberCB {
@@ -449,19 +704,455 @@ private:
     DsSession* _s;
 };
 
+// ---- Frame buffer pool: Windows backend (see frame_pool.h) ----
+// Ordinary blocks come from _aligned_malloc; large pages from VirtualAlloc(MEM_LARGE_PAGES),
+// which needs SeLockMemoryPrivilege.
+class Win32PoolBackend : public PoolBackend {
+public:
+    size_t large_page_size() override { return GetLargePageMinimum(); }
+
+    // SeLockMemoryPrivilege must be granted to the account and then enabled in the process token.
+    bool enable_large_pages() override {
+        HANDLE token = nullptr;
+        if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) return false;
+        TOKEN_PRIVILEGES tp{};
+        tp.PrivilegeCount = 1;
+        tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        bool ok = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME, &tp.Privileges[0].Luid) &&
+            AdjustTokenPrivileges(token, FALSE, &tp, 0, nullptr, nullptr) &&
+            GetLastError() == ERROR_SUCCESS; // ERROR_NOT_ALL_ASSIGNED: the account lacks it
+        CloseHandle(token);
+        if (!ok) dbg_printf("cds: SeLockMemoryPrivilege unavailable, large pages stay off\n");
+        return ok;
+    }
+
+    PoolBlock allocate(size_t bytes, bool largePages) override {
+        PoolBlock b;
+        const size_t largePage = GetLargePageMinimum();
+        if (largePages && largePage != 0 && bytes <= SIZE_MAX - largePage) {
+            size_t rounded = (bytes + largePage - 1) / largePage * largePage;
+            b.base = (uint8_t*)VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+            if (b.base) {
+                b.bytes = rounded;
+                b.largePages = true;
+                return b;
+            }
+            dbg_printf("cds: large page allocation of %zu bytes failed (%lu), using normal pages\n",
+                rounded, (unsigned long)GetLastError());
+        }
+        b.base = (uint8_t*)_aligned_malloc(bytes, kPoolAlign);
+        b.bytes = b.base ? bytes : 0;
+        return b;
+    }
+
+    void release(const PoolBlock& block) override {
+        if (block.largePages) VirtualFree(block.base, 0, MEM_RELEASE);
+        else _aligned_free(block.base);
+    }
+};
+
+PoolBackend& system_pool_backend() {
+    static Win32PoolBackend* backend = new Win32PoolBackend();
+    return *backend;
+}
+
+// ---- Frame history (cds_set_history / cds_grab_history_frame) ----
+// Copies of recently published frames, oldest first. Entries hold whatever the slots
+// hold, so lazy sessions keep native samples (YUY2/NV12, or JPEG from MJPG cameras) and
+// convert on fetch. Readers take a reference and copy outside the lock; the producer
+// recycles evicted buffers that no reader holds.
+struct FrameHistory {
+    std::mutex mutex;
+    std::deque<std::shared_ptr<FrameData>> frames; // ascending seq
+    uint32_t maxFrames = 0; // 0 = no frame limit
+    uint64_t maxBytes = 0;  // 0 = no byte limit; both 0 = history off
+    uint64_t bytes = 0;
+    std::atomic<bool> enabled{ false };
+
+    void configure(uint32_t frameLimit, uint64_t byteLimit) {
+        std::lock_guard<std::mutex> lk(mutex);
+        maxFrames = frameLimit;
+        maxBytes = byteLimit;
+        enabled.store(frameLimit != 0 || byteLimit != 0, std::memory_order_relaxed);
+        if (!enabled.load(std::memory_order_relaxed)) {
+            frames.clear();
+            bytes = 0;
+        }
+        evict_for(0);
+    }
+
+    // Producer only, while it still owns the slot. Copies the whole frame on the streaming
+    // thread (or the publishing decode worker): the slot itself is about to be published and
+    // recycled, so history cannot keep it. Evicted entries are reused, so this does not allocate
+    // once the history is full.
+    void record(const FrameData& fd) {
+        if (!enabled.load(std::memory_order_relaxed)) return;
+        const size_t len = fd.data.size();
+        std::shared_ptr<FrameData> entry;
+        {
+            std::lock_guard<std::mutex> lk(mutex);
+            if (maxFrames == 0 && maxBytes == 0) return;
+            if (maxBytes != 0 && len > maxBytes) return; // one frame alone is over budget
+            entry = evict_for(len);
+        }
+        try {
+            if (!entry) entry = std::make_shared<FrameData>();
+            *entry = fd; // reuses the recycled buffer's capacity
+        }
+        catch (const std::bad_alloc&) {
+            return;
+        }
+        std::lock_guard<std::mutex> lk(mutex);
+        if (maxFrames == 0 && maxBytes == 0) return; // turned off meanwhile
+        evict_for(len);
+        frames.push_back(std::move(entry));
+        bytes += len;
+    }
+
+    std::shared_ptr<FrameData> find_seq(uint64_t seq) {
+        std::lock_guard<std::mutex> lk(mutex);
+        auto it = std::lower_bound(frames.begin(), frames.end(), seq,
+            [](const std::shared_ptr<FrameData>& f, uint64_t v) { return f->seq < v; });
+        if (it == frames.end() || (*it)->seq != seq) return nullptr;
+        return *it;
+    }
+
+    // Newest frame that arrived at or before arrival100ns (monotonic clock).
+    std::shared_ptr<FrameData> find_arrival(uint64_t arrival100ns) {
+        std::lock_guard<std::mutex> lk(mutex);
+        auto it = std::upper_bound(frames.begin(), frames.end(), arrival100ns,
+            [](uint64_t v, const std::shared_ptr<FrameData>& f) { return v < f->arrivalMono100ns; });
+        if (it == frames.begin()) return nullptr;
+        return *(it - 1);
+    }
+
+    // Frame whose arrival is closest to arrival100ns, either side.
+    std::shared_ptr<FrameData> find_nearest(uint64_t arrival100ns) {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (frames.empty()) return nullptr;
+        auto it = std::lower_bound(frames.begin(), frames.end(), arrival100ns,
+            [](const std::shared_ptr<FrameData>& f, uint64_t v) { return f->arrivalMono100ns < v; });
+        if (it == frames.end()) return frames.back();
+        if (it == frames.begin()) return *it;
+        const std::shared_ptr<FrameData>& before = *(it - 1);
+        return arrival100ns - before->arrivalMono100ns <= (*it)->arrivalMono100ns - arrival100ns ? before : *it;
+    }
+
+
+    bool range(uint64_t& oldest, uint64_t& newest) {
+        std::lock_guard<std::mutex> lk(mutex);
+        if (frames.empty()) return false;
+        oldest = frames.front()->seq;
+        newest = frames.back()->seq;
+        return true;
+    }
+
+private:
+    // Caller holds mutex. Drops the oldest frames until `incoming` more bytes and one more
+    // frame fit; returns one of them if nobody else references it.
+    std::shared_ptr<FrameData> evict_for(size_t incoming) {
+        std::shared_ptr<FrameData> reusable;
+        while (!frames.empty() &&
+            ((maxFrames != 0 && frames.size() + (incoming ? 1 : 0) > maxFrames) ||
+             (maxBytes != 0 && bytes + incoming > maxBytes))) {
+            std::shared_ptr<FrameData> f = std::move(frames.front());
+            frames.pop_front();
+            bytes -= f->data.size();
+            if (f.use_count() == 1) reusable = std::move(f);
+        }
+        return reusable;
+    }
+};
+
+// ---- Button events (cds_next_button_event) ----
+constexpr uint32_t kButtonQueueSize = 64; // power of two
+
+struct ButtonEvent {
+    uint64_t mono100ns = 0;
+    uint64_t utc100ns = 0;
+    uint64_t frameSeq = 0; // latest published frame when the press was seen
+    int32_t source = CDS_BUTTON_SOURCE_TRIGGER;
+};
+
+// Bounded MPMC queue (Vyukov): the trigger poll loop and the STILL-pin callback push,
+// any API thread pops. Each cell's seq says whose turn it is, so neither side locks.
+// A full queue rejects the new event.
+struct ButtonEventQueue {
+    struct Cell {
+        std::atomic<uint32_t> seq{ 0 };
+        ButtonEvent ev;
+    };
+    Cell cells[kButtonQueueSize];
+    std::atomic<uint32_t> head{ 0 }; // next pop
+    std::atomic<uint32_t> tail{ 0 }; // next push
+
+    ButtonEventQueue() {
+        for (uint32_t i = 0; i < kButtonQueueSize; ++i) cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(const ButtonEvent& ev) {
+        uint32_t pos = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & (kButtonQueueSize - 1)];
+            int32_t diff = (int32_t)(c.seq.load(std::memory_order_acquire) - pos);
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.ev = ev;
+                    c.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) return false; // full
+            else pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool pop(ButtonEvent& ev) {
+        uint32_t pos = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& c = cells[pos & (kButtonQueueSize - 1)];
+            int32_t diff = (int32_t)(c.seq.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    ev = c.ev;
+                    c.seq.store(pos + kButtonQueueSize, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) return false; // empty
+            else pos = head.load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// ---- Per-session counters (cds_get_session_stats) ----
+// Hot paths only do relaxed atomic adds; a scrape may mix counters from slightly
+// different instants, which is fine for metrics.
+constexpr uint32_t kLatencyBuckets = 96; // log-linear in us, 4 per power of two; saturates near 30 s
+
+static uint32_t latency_bucket(uint64_t us) {
+    if (us < 4) return (uint32_t)us;
+    uint32_t e = 2;
+    while (e < 63 && (us >> (e + 1)) != 0) ++e;
+    uint64_t idx = (uint64_t)(e - 1) * 4 + ((us >> (e - 2)) & 3);
+    return (uint32_t)(std::min)(idx, (uint64_t)kLatencyBuckets - 1);
+}
+
+// Largest value (us) that lands in bucket idx.
+static uint64_t latency_bucket_upper(uint32_t idx) {
+    if (idx < 4) return idx;
+    uint32_t e = idx / 4 + 1;
+    uint64_t lower = (uint64_t)(4 + idx % 4) << (e - 2);
+    return lower + ((uint64_t)1 << (e - 2)) - 1;
+}
+
+struct SessionStats {
+    std::atomic<uint64_t> captured{ 0 };    // samples seen by BufferCB
+    std::atomic<uint64_t> delivered{ 0 };   // frames published to readers
+    std::atomic<uint64_t> dropped{ 0 };     // captured but never published
+    std::atomic<uint64_t> duplicated{ 0 };  // grabs that returned the previous grab's frame again
+    std::atomic<uint64_t> grabs{ 0 };
+    std::atomic<uint64_t> convert100ns{ 0 };    // copy / convert / flip / decode time
+    std::atomic<uint64_t> readerWait100ns{ 0 }; // reader entry -> frame pinned
+    std::atomic<uint64_t> lastArrival100ns{ 0 };   // monotonic, last delivered frame
+    std::atomic<uint64_t> frameInterval100ns{ 0 }; // moving average between delivered frames
+    std::atomic<uint64_t> lastGrabbedSeq{ 0 };
+    std::atomic<uint32_t> bufferCbHist[kLatencyBuckets]{};
+
+    static void add(std::atomic<uint64_t>& c, uint64_t v = 1) { c.fetch_add(v, std::memory_order_relaxed); }
+
+    // A prepared session starting: the counters cover one start each. A sample that races
+    // with this may land on either side.
+    void reset() {
+        for (std::atomic<uint64_t>* c : { &captured, &delivered, &dropped, &duplicated, &grabs, &convert100ns,
+                 &readerWait100ns, &lastArrival100ns, &frameInterval100ns, &lastGrabbedSeq })
+            c->store(0, std::memory_order_relaxed);
+        for (std::atomic<uint32_t>& b : bufferCbHist) b.store(0, std::memory_order_relaxed);
+    }
+
+    void record_buffer_cb(uint64_t duration100ns) {
+        bufferCbHist[latency_bucket(duration100ns / 10)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Publisher only (publishing is serialized).
+    void record_delivery(uint64_t arrival100ns) {
+        add(delivered);
+        uint64_t last = lastArrival100ns.load(std::memory_order_relaxed);
+        lastArrival100ns.store(arrival100ns, std::memory_order_relaxed);
+        if (last == 0 || arrival100ns <= last) return;
+        int64_t interval = (int64_t)(arrival100ns - last);
+        int64_t avg = (int64_t)frameInterval100ns.load(std::memory_order_relaxed);
+        avg = avg ? avg + (interval - avg) / 8 : interval;
+        frameInterval100ns.store((uint64_t)avg, std::memory_order_relaxed);
+    }
+
+    void record_grab(uint64_t seq) {
+        add(grabs);
+        if (lastGrabbedSeq.exchange(seq, std::memory_order_relaxed) == seq) add(duplicated);
+    }
+
+    // Upper bound (us) of the bucket holding the p-th fraction of BufferCB calls; 0 if none yet.
+    uint32_t buffer_cb_percentile(double p) const {
+        uint64_t counts[kLatencyBuckets];
+        uint64_t total = 0;
+        for (uint32_t i = 0; i < kLatencyBuckets; ++i) {
+            counts[i] = bufferCbHist[i].load(std::memory_order_relaxed);
+            total += counts[i];
+        }
+        if (total == 0) return 0;
+        uint64_t target = (uint64_t)(p * (double)total + 0.999999);
+        if (target == 0) target = 1;
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < kLatencyBuckets; ++i) {
+            seen += counts[i];
+            if (seen >= target) return (uint32_t)(std::min)(latency_bucket_upper(i), (uint64_t)UINT32_MAX);
+        }
+        return (uint32_t)(std::min)(latency_bucket_upper(kLatencyBuckets - 1), (uint64_t)UINT32_MAX);
+    }
+};
+
+struct SessionMjpegPool;
+static void stop_mjpeg_decode_pool(DsSession* s);
+
 struct DsSession {
     uint32_t width = 0;
     uint32_t height = 0;
+    uint32_t captureFlags = 0; // CDS_CAPTURE_* passed to cds_start_capture_ex
+    bool encoded = false;      // CDS_CAPTURE_ENCODED: slots hold MJPG samples untouched
+    bool decodeMjpeg = false;  // CDS_CAPTURE_DECODE_POOL requested
+    SessionMjpegPool* decodePool = nullptr; // set when MJPG samples reach BufferCB for in-library decode
+    bool lazy = false;         // CDS_CAPTURE_LAZY: slots hold native samples, converted when read
+    bool lazyJpeg = false;     // lazy and the native samples are MJPG
+
+    // 1 owner reference (dropped by cds_stop_capture) + 1 per outstanding frame lease.
+    std::atomic<int32_t> refs{ 1 };
+
+    // Layout of the samples the grabber receives; BufferCB (or the reader, when lazy) converts them to `out`.
+    SrcFormat srcFormat = SrcFormat::Rgb32;
+    size_t srcStride = 0;
+    OutFormat outFormat = OutFormat::Bgra; // CDS_PIXEL_* passed to cds_start_capture_ex
+    ConvScratch streamScratch;             // streaming thread only
+
+    // ---- Output geometry (cds_set_output_roi / cds_set_output_size) ----
+    // Producers take a snapshot per frame; the layout each frame was made with travels in its slot.
+    std::mutex geometryMutex;
+    FrameGeometry geometry; // guarded by geometryMutex; full frame until changed
+
+    FrameGeometry current_geometry() {
+        std::lock_guard<std::mutex> lk(geometryMutex);
+        return geometry;
+    }
 
-    std::vector<uint8_t> lastRgb;
-    std::mutex frameMutex;
+    FrameExchange frames;
+    FrameHistory history;
+    uint64_t nextFrameSeq = 1; // streaming thread only
     std::atomic<bool> hasFrame{ false };
+    SessionStats stats;
+
+    // ---- New-frame notification (cds_wait_for_frame) ----
+    std::atomic<uint64_t> latestSeq{ 0 };
+    std::atomic<int32_t> frameWaiters{ 0 };
+    std::mutex frameWaitMutex;
+    std::condition_variable frameCv;
+
+    static FrameStamp stamp_arrival(double sampleTimeSec) {
+        FrameStamp st;
+        st.mono100ns = now_ts100ns_monotonic();
+        st.utc100ns = now_ts100ns_utc();
+        st.sampleTime100ns = (int64_t)(sampleTimeSec * 1e7 + (sampleTimeSec < 0 ? -0.5 : 0.5));
+        return st;
+    }
+
+    // latestSeq survives a format change or a warm start (seqs never restart) while
+    // hasFrame is cleared until the first new frame, so waits need both.
+    bool has_frame_after(uint64_t seq) const {
+        return hasFrame.load() && latestSeq.load() > seq;
+    }
 
-    bool bottomUp = false;
+    void notify_frame_waiters() {
+        // Only touch the mutex when someone is actually waiting; waiters register
+        // before checking latestSeq so a publish can't slip between check and wait.
+        if (frameWaiters.load() > 0) {
+            { std::lock_guard<std::mutex> lk(frameWaitMutex); }
+            frameCv.notify_all();
+        }
+    }
+
+    // Streaming thread only: number and publish a filled slot.
+    void publish_slot(int32_t slot, const FrameStamp& st) {
+        publish_slot_as(slot, nextFrameSeq++, st);
+    }
+
+    // Callers must serialize publishing (streaming thread, or the decode pool in order).
+    void publish_slot_as(int32_t slot, uint64_t seq, const FrameStamp& st) {
+        FrameSlot& fs = frames.slots[slot];
+        fs.seq = seq;
+        fs.timestamp100ns = st.utc100ns;
+        fs.arrivalMono100ns = st.mono100ns;
+        fs.sampleTime100ns = st.sampleTime100ns;
+        history.record(fs);
+        frames.end_write(slot);
+        stats.record_delivery(st.mono100ns);
+        hasFrame.store(true);
+        latestSeq.store(seq);
+        notify_frame_waiters();
+    }
+
+    // ---- Push-mode delivery (cds_set_frame_callback) ----
+    std::mutex callbackMutex;                 // serializes callback (re)registration
+    std::thread deliveryThread;
+    std::thread::id deliveryThreadId;
+    std::atomic<bool> deliveryStop{ false };
+    std::atomic<int32_t> callbackPolicy{ CDS_CALLBACK_COALESCE };
+
+    bool bottomUp = false; // RGB samples only
 
-    // ---- Button (edge triggered) ----
+    // ---- Button ----
+    // cds_button_pressed/cds_button_timestamp keep their edge-flag semantics; the
+    // queue feeds cds_next_button_event independently of them.
     std::atomic<bool> buttonEdge{ false };
     std::atomic<uint64_t> lastButtonTs100ns{ 0 };
+    ButtonEventQueue buttonEvents;
+    std::atomic<int32_t> buttonSlot{ -1 }; // frame slot pinned at the last press, -1 = none
+    std::atomic<uint64_t> buttonEventsLost{ 0 };
+    std::atomic<int32_t> buttonWaiters{ 0 };
+    std::mutex buttonWaitMutex;
+    std::condition_variable buttonCv;
+
+    void notify_button_waiters() {
+        if (buttonWaiters.load() > 0) {
+            { std::lock_guard<std::mutex> lk(buttonWaitMutex); }
+            buttonCv.notify_all();
+        }
+    }
+
+    // Poll thread (trigger) or STILL-pin callback.
+    void record_button(int32_t source) {
+        ButtonEvent ev;
+        ev.mono100ns = now_ts100ns_monotonic();
+        ev.utc100ns = now_ts100ns_utc();
+        // Until the first frame after a warm start or format change, the ring only holds stale ones.
+        const bool current = hasFrame.load();
+        ev.frameSeq = current ? latestSeq.load() : 0;
+        ev.source = source;
+
+        // Hold the frame current at the press for cds_grab_button_frame. Pinning keeps the
+        // producer off the slot, so nothing is copied; a newer press releases the older hold.
+        if (!encoded) {
+            int32_t slot = current ? frames.pin_latest() : -1;
+            if (slot >= 0) ev.frameSeq = frames.slots[slot].seq;
+            int32_t old = buttonSlot.exchange(slot);
+            if (old >= 0) frames.unpin(old);
+        }
+
+        lastButtonTs100ns.store(ev.utc100ns);
+        buttonEdge.store(true);
+        if (!buttonEvents.push(ev)) {
+            buttonEventsLost.fetch_add(1, std::memory_order_relaxed);
+            dbg_printf("cds: button event queue full, press dropped\n");
+        }
+        notify_button_waiters();
+    }
 
     // ---- IAMVideoControl trigger detection ----
     IAMVideoControl* videoCtrl = nullptr;      // thread-owned
@@ -472,11 +1163,74 @@ struct DsSession {
     bool useStillFallback = false;
 
     std::atomic<bool> stopRequested{ false };
+    HANDLE stopEvent = nullptr; // manual reset, set with stopRequested; wakes the session thread
     std::thread worker;
+
+    ~DsSession() {
+        if (stopEvent) CloseHandle(stopEvent);
+        if (runEvent) CloseHandle(runEvent);
+    }
+
+    void request_stop() {
+        stopRequested.store(true);
+        if (stopEvent) SetEvent(stopEvent);
+    }
     std::mutex startMutex;
     std::condition_variable startCv;
     bool startCompleted = false;
     cds_result_t startResult = CDS_ERR_UNKNOWN;
+    bool threadExited = false; // under startMutex: the session thread has left its loop
+
+    // ---- Warm start (cds_prepare_capture, CDS_STOP_KEEP_PREPARED) ----
+    // A warm session thread builds the graph, pauses it and waits for runEvent; a parked
+    // session pauses instead of tearing down. Each step reports back through startCv.
+    bool warm = false;
+    std::atomic<bool> parkRequested{ false };
+    HANDLE runEvent = nullptr; // auto reset
+    DsFormat format;           // the graph is connected with this
+    uint64_t generation = 0;   // g_dsGeneration at creation
+
+    // ---- Format change (cds_change_format) ----
+    std::mutex controlMutex; // one phase request at a time: format change or stop
+    std::atomic<bool> formatChangeRequested{ false };
+    DsFormat pendingFormat;  // written under controlMutex before the request
+
+    // False once the session thread has exited: nothing would finish the phase.
+    bool begin_phase() {
+        std::lock_guard<std::mutex> lk(startMutex);
+        if (threadExited) return false;
+        startCompleted = false;
+        startResult = CDS_ERR_UNKNOWN;
+        return true;
+    }
+
+    // Session thread; only the first result of a phase counts.
+    void finish_phase(cds_result_t r) {
+        {
+            std::lock_guard<std::mutex> lk(startMutex);
+            if (startCompleted) return;
+            startResult = r;
+            startCompleted = true;
+        }
+        startCv.notify_all();
+    }
+
+    // Session thread, on its way out: fails the phase in progress, if any, and every later one.
+    void finish_thread(cds_result_t r) {
+        {
+            std::lock_guard<std::mutex> lk(startMutex);
+            threadExited = true;
+            if (!startCompleted) startResult = r;
+            startCompleted = true;
+        }
+        startCv.notify_all();
+    }
+
+    cds_result_t wait_phase() {
+        std::unique_lock<std::mutex> lk(startMutex);
+        startCv.wait(lk, [&]() { return startCompleted; });
+        return startResult;
+    }
 
     IGraphBuilder* graph = nullptr;
     ICaptureGraphBuilder2* cap = nullptr;
@@ -497,6 +1251,7 @@ struct DsSession {
         if (mc) mc->Stop();
         if (grabber) grabber->SetCallback(nullptr, 0);
         if (stillGrabber) stillGrabber->SetCallback(nullptr, 0);
+        stop_mjpeg_decode_pool(this);
 
         SAFE_RELEASE(me);
         SAFE_RELEASE(mc);
@@ -520,40 +1275,339 @@ struct DsSession {
     }
 };
 
+// ---- MJPEG decode pool (CDS_CAPTURE_DECODE_POOL) ----
+// The pool itself (ordering, job recycling) is in decode_pool.h; the session
+// supplies WIC decoders and publishes through its frame exchange.
+static std::atomic<int32_t> g_mjpegDecodeThreads{ 0 }; // 0 = auto
+
+static int32_t mjpeg_decode_thread_count() {
+    int32_t n = g_mjpegDecodeThreads.load(std::memory_order_relaxed);
+    if (n <= 0) {
+        unsigned hw = std::thread::hardware_concurrency();
+        n = hw > 1 ? (int32_t)(hw / 2) : 1;
+    }
+    return (std::min)((std::max)(n, 1), kMaxMjpegDecodeThreads);
+}
+
+// One per pool worker: joins the MTA for the worker's lifetime and owns its WIC factory.
+class WicSlotDecoder : public MjpegSlotDecoder {
+public:
+    explicit WicSlotDecoder(DsSession* s) : _s(s) {
+        _hrInit = _dec.init();
+        if (FAILED(_hrInit)) dbg_printf("MJPEG worker: WIC init failed: %s\n", HResultToString(_hrInit).c_str());
+    }
+
+    bool ready() const { return SUCCEEDED(_hrInit); }
+
+    bool decode(const MjpegJob& job, FrameSlot& fs) override {
+        FrameGeometry g = _s->current_geometry();
+        fs.layout = g.out;
+        fs.data.resize(g.out.frameBytes);
+        uint64_t t0 = now_ts100ns_monotonic();
+        HRESULT hr = _dec.decode(job.data.data(), job.data.size(), _s->width, _s->height, g, fs.data.data(), _scratch);
+        SessionStats::add(_s->stats.convert100ns, now_ts100ns_monotonic() - t0);
+        if (FAILED(hr)) dbg_printf("MJPEG decode failed (seq=%llu): %s\n",
+            (unsigned long long)job.seq, HResultToString(hr).c_str());
+        return SUCCEEDED(hr);
+    }
+
+private:
+    DsSession* _s;
+    HRESULT _hrInit = E_FAIL;
+    MtaScope _com;       // declared first: the factory is released before leaving the apartment
+    WicJpegDecoder _dec;
+    ConvScratch _scratch;
+};
+
+struct SessionMjpegPool : MjpegDecodeHost {
+    DsSession* s;
+    MjpegDecodePool pool;
+
+    explicit SessionMjpegPool(DsSession* session) : s(session), pool(session->frames, *this) {}
+
+    std::unique_ptr<MjpegSlotDecoder> make_decoder() override {
+        std::unique_ptr<WicSlotDecoder> dec(new(std::nothrow) WicSlotDecoder(s));
+        if (!dec || !dec->ready()) return nullptr;
+        return dec;
+    }
+
+    void publish(int32_t slot, const MjpegJob& job) override { s->publish_slot_as(slot, job.seq, job.stamp); }
+    void dropped(const MjpegJob&) override { SessionStats::add(s->stats.dropped); }
+};
+
+// Session thread, after the graph is built and before Run.
+static HRESULT start_mjpeg_decode_pool(DsSession* s) {
+    int32_t threads = mjpeg_decode_thread_count();
+    SessionMjpegPool* pool = new(std::nothrow) SessionMjpegPool(s);
+    if (!pool) return E_OUTOFMEMORY;
+    if (!pool->pool.start(threads, s->nextFrameSeq)) {
+        delete pool;
+        return E_OUTOFMEMORY;
+    }
+    s->decodePool = pool;
+    dbg_printf("MJPEG decode pool: %d threads\n", threads);
+    return S_OK;
+}
+
+// Only called once no more BufferCB calls can arrive (graph stopped, callback cleared).
+static void stop_mjpeg_decode_pool(DsSession* s) {
+    SessionMjpegPool* pool = s ? s->decodePool : nullptr;
+    if (!pool) return;
+    pool->pool.stop();
+    s->decodePool = nullptr;
+    delete pool;
+}
+
+// Streaming thread: hand the compressed sample to the pool (never blocks on decoding).
+static void submit_mjpeg_sample(DsSession* s, const BYTE* buffer, long len, const FrameStamp& st) {
+    MjpegJob* job = s->decodePool->pool.begin_submit();
+    if (!job) { // workers are behind: drop
+        SessionStats::add(s->stats.dropped);
+        return;
+    }
+    job->data.assign(buffer, buffer + len);
+    job->seq = s->nextFrameSeq++;
+    job->stamp = st;
+    s->decodePool->pool.end_submit(job);
+}
+
 HRESULT STDMETHODCALLTYPE StillButtonCB::SampleCB(double sampleTime, IMediaSample*) {
     if (!_s) return S_OK;
-    uint64_t t = now_ts100ns_utc();
-    _s->lastButtonTs100ns.store(t);
-    _s->buttonEdge.store(true);
+    _s->record_button(CDS_BUTTON_SOURCE_STILL_PIN);
     dbg_printf("[STILL FALLBACK] button sample\n");
     return S_OK;
 }
 
-HRESULT STDMETHODCALLTYPE FrameGrabberCB::BufferCB(double, BYTE* buffer, long len) {
+HRESULT STDMETHODCALLTYPE FrameGrabberCB::BufferCB(double sampleTime, BYTE* buffer, long len) {
     if (!_s || !buffer || len <= 0) return S_OK;
+    const FrameStamp st = DsSession::stamp_arrival(sampleTime);
+    SessionStats& stats = _s->stats;
+    SessionStats::add(stats.captured);
+
+    // Times every exit, including drops.
+    struct CallTimer {
+        SessionStats& stats;
+        uint64_t t0;
+        ~CallTimer() { stats.record_buffer_cb(now_ts100ns_monotonic() - t0); }
+    } timer{ stats, st.mono100ns };
+
+    if (_s->decodePool) {
+        submit_mjpeg_sample(_s, buffer, len, st);
+        return S_OK;
+    }
 
-    size_t rowBytes = 0;
-    size_t expected = 0;
-    if (!calc_frame_layout_bytes(_s->width, _s->height, rowBytes, expected)) return S_OK;
-    if (expected == 0 || (size_t)len < expected) return S_OK;
+    if (_s->encoded || _s->lazy) {
+        // Stored as delivered; lazy sessions convert in the reader (see convert_native_frame).
+        int32_t slot = _s->frames.begin_write();
+        if (slot < 0) {
+            SessionStats::add(stats.dropped);
+            return S_OK;
+        }
+
+        // Slots keep their capacity, so after the first few frames this never allocates.
+        uint64_t t0 = now_ts100ns_monotonic();
+        FrameSlot& fs = _s->frames.slots[slot];
+        fs.data.resize((size_t)len);
+        memcpy(fs.data.data(), buffer, (size_t)len);
+        // The format can change while frames are still held; each one keeps its own layout.
+        fs.native.fmt = _s->srcFormat;
+        fs.native.stride = _s->srcStride;
+        fs.native.width = _s->width;
+        fs.native.height = _s->height;
+        fs.native.bottomUp = _s->bottomUp;
+        fs.nativeJpeg = _s->encoded || _s->lazyJpeg;
+        if (_s->lazy) {
+            fs.geometry = _s->current_geometry();
+            fs.layout = fs.geometry.out;
+        }
+        SessionStats::add(stats.convert100ns, now_ts100ns_monotonic() - t0);
+        _s->publish_slot(slot, st);
+        return S_OK;
+    }
 
-    std::lock_guard<std::mutex> lk(_s->frameMutex);
-    _s->lastRgb.resize(expected);
+    size_t srcBytes = 0;
+    if (!calc_src_frame_bytes(_s->srcFormat, _s->srcStride, _s->height, srcBytes) || (size_t)len < srcBytes) {
+        SessionStats::add(stats.dropped);
+        return S_OK;
+    }
 
-    if (!_s->bottomUp) {
-        memcpy(_s->lastRgb.data(), buffer, expected);
+    int32_t slot = _s->frames.begin_write();
+    if (slot < 0) { // every spare slot is pinned by readers: drop this frame
+        SessionStats::add(stats.dropped);
+        return S_OK;
     }
-    else {
-        // Flip rows to guarantee top-down
-        for (uint32_t y = 0; y < _s->height; ++y) {
-            const uint8_t* srcRow = buffer + ((size_t)(_s->height - 1 - y) * rowBytes);
-            uint8_t* dstRow = _s->lastRgb.data() + ((size_t)y * rowBytes);
-            memcpy(dstRow, srcRow, rowBytes);
+
+    FrameGeometry g = _s->current_geometry();
+    FrameSlot& fs = _s->frames.slots[slot];
+    fs.layout = g.out;
+    fs.data.resize(g.out.frameBytes);
+
+    // Crops, scales and converts to the output layout; bottom-up RGB rows come out top-down.
+    SrcFrame src{};
+    src.fmt = _s->srcFormat;
+    src.data = buffer;
+    src.stride = _s->srcStride;
+    src.width = _s->width;
+    src.height = _s->height;
+    src.bottomUp = _s->bottomUp;
+    uint64_t t0 = now_ts100ns_monotonic();
+    convert_frame(crop_src_frame(src, g), g.out, fs.data.data(), _s->streamScratch);
+    SessionStats::add(stats.convert100ns, now_ts100ns_monotonic() - t0);
+
+    _s->publish_slot(slot, st);
+    return S_OK;
+}
+
+// Lazy sessions convert on whichever thread reads the frame (the caller's, or the delivery
+// thread), so each thread keeps one WIC decoder and one scratch across reads.
+struct LazyConvertContext {
+    ConvScratch scratch;
+    WicJpegDecoder dec;
+    bool comJoined = false;
+    HRESULT hrInit = E_FAIL;
+
+    // The factory belongs to this thread's apartment. A thread without COM joins the MTA on
+    // its first JPEG and stays there, so the cached factory remains valid (see CDS_CAPTURE_LAZY).
+    HRESULT init_jpeg() {
+        if (SUCCEEDED(hrInit)) return hrInit;
+        if (!comJoined) {
+            HRESULT hrCo = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+            if (hrCo == S_FALSE) CoUninitialize(); // already in the MTA: the caller keeps it alive
+            comJoined = true;
         }
+        hrInit = dec.init();
+        if (FAILED(hrInit)) dbg_printf("Lazy MJPEG: WIC init failed: %s\n", HResultToString(hrInit).c_str());
+        return hrInit;
     }
+};
 
-    _s->hasFrame.store(true);
-    return S_OK;
+static LazyConvertContext& lazy_convert_context() {
+    thread_local LazyConvertContext ctx;
+    return ctx;
+}
+
+// Lazy sessions: converts a pinned native slot to the output layout it was captured with,
+// on the calling thread.
+static bool convert_native_frame(const FrameData& fs, uint8_t* dst) {
+    const SrcFrame& nat = fs.native;
+    const FrameGeometry& g = fs.geometry;
+    if ((uint64_t)g.roiX + g.roiW > nat.width || (uint64_t)g.roiY + g.roiH > nat.height) return false;
+
+    LazyConvertContext& ctx = lazy_convert_context();
+    if (fs.nativeJpeg) {
+        HRESULT hr = ctx.init_jpeg();
+        if (SUCCEEDED(hr)) hr = ctx.dec.decode(fs.data.data(), fs.data.size(), nat.width, nat.height, g, dst, ctx.scratch);
+        if (FAILED(hr)) dbg_printf("Lazy MJPEG decode failed (seq=%llu): %s\n",
+            (unsigned long long)fs.seq, HResultToString(hr).c_str());
+        return SUCCEEDED(hr);
+    }
+
+    size_t srcBytes = 0;
+    if (!calc_src_frame_bytes(nat.fmt, nat.stride, nat.height, srcBytes)) return false;
+    if (fs.data.size() < srcBytes) return false;
+
+    SrcFrame src = nat;
+    src.data = fs.data.data();
+    convert_frame(crop_src_frame(src, g), g.out, dst, ctx.scratch);
+    return true;
+}
+
+// Copies a frame into the caller's buffer in the session's output format. Frames keep
+// the geometry they were made with, lazy ones too (converted now, with the roi/scale of
+// their capture). Encoded sessions get the JPEG bitstream.
+static cds_result_t copy_frame_out(DsSession* s, const FrameData& fd,
+    uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+    size_t needed = s->encoded ? fd.data.size() : fd.layout.frameBytes;
+    cds_result_t rc = CDS_ERR_READ_FRAME;
+    if (available_bytes < needed) rc = CDS_ERR_BUF_TOO_SMALL;
+    else if (s->lazy) {
+        uint64_t t0 = now_ts100ns_monotonic();
+        if (needed != 0 && convert_native_frame(fd, buffer)) rc = CDS_OK;
+        SessionStats::add(s->stats.convert100ns, now_ts100ns_monotonic() - t0);
+    }
+    else if (needed != 0 && fd.data.size() >= needed) {
+        memcpy(buffer, fd.data.data(), needed);
+        rc = CDS_OK;
+    }
+    if (rc == CDS_OK && info) {
+        const OutLayout& layout = fd.layout;
+        info->sequence = fd.seq;
+        info->sample_time_100ns = fd.sampleTime100ns;
+        info->arrival_100ns = fd.arrivalMono100ns;
+        info->arrival_utc_100ns = fd.timestamp100ns;
+        info->width = (int32_t)(s->encoded ? fd.native.width : layout.width);
+        info->height = (int32_t)(s->encoded ? fd.native.height : layout.height);
+        info->bytes_per_row = s->encoded ? 0 : (int32_t)layout.rowBytes;
+        info->size = needed;
+    }
+    return rc;
+}
+
+// Slot the caller has pinned; cds_grab_frame_ex and cds_grab_button_frame.
+static cds_result_t copy_pinned_frame(DsSession* s, int32_t slot,
+    uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+    const FrameSlot& fs = s->frames.slots[slot];
+    cds_result_t rc = copy_frame_out(s, fs, buffer, available_bytes, info);
+    if (rc == CDS_OK) s->stats.record_grab(fs.seq);
+    return rc;
+}
+
+// Runs the user frame callback off the streaming thread. A slow callback only
+// delays this thread; BufferCB keeps publishing into the slot ring meanwhile.
+static void delivery_thread_main(DsSession* s, uint32_t device_index, cds_frame_callback fn, void* userData) {
+    uint64_t after = 0;
+    std::vector<uint8_t> converted; // lazy sessions only
+
+    for (;;) {
+        s->frameWaiters.fetch_add(1);
+        {
+            std::unique_lock<std::mutex> lk(s->frameWaitMutex);
+            s->frameCv.wait(lk, [&]() {
+                return s->has_frame_after(after) || s->deliveryStop.load() || s->stopRequested.load();
+            });
+        }
+        s->frameWaiters.fetch_sub(1);
+        if (s->deliveryStop.load() || s->stopRequested.load()) break;
+
+        int32_t slot = s->frames.pin_latest();
+        if (slot < 0) continue;
+
+        const FrameSlot& fs = s->frames.slots[slot];
+        uint64_t seq = fs.seq;
+        const uint8_t* pixels = fs.data.data();
+        OutLayout layout = fs.layout;
+        bool ok = true;
+        if (s->lazy) {
+            converted.resize(layout.frameBytes);
+            ok = convert_native_frame(fs, converted.data());
+            pixels = converted.data();
+        }
+        if (ok) fn(device_index, pixels, (int32_t)layout.width, (int32_t)layout.height,
+            (int32_t)layout.rowBytes, seq, userData);
+        s->frames.unpin(slot);
+
+        // COALESCE: whatever arrived during the callback is delivered next (newest only).
+        // DROP: frames that arrived during the callback are skipped; wait for a fresh one.
+        after = seq;
+        if (s->callbackPolicy.load(std::memory_order_relaxed) == CDS_CALLBACK_DROP)
+            after = (std::max)(seq, s->latestSeq.load());
+    }
+}
+
+// Caller holds s->callbackMutex.
+static void stop_delivery_thread(DsSession* s) {
+    if (!s->deliveryThread.joinable()) return;
+    s->deliveryStop.store(true);
+    s->notify_frame_waiters();
+    s->deliveryThread.join();
+    s->deliveryThreadId = std::thread::id();
+    s->deliveryStop.store(false);
+}
+
+// Sessions are deleted when the last reference goes away: normally in
+// cds_stop_capture, or in cds_release_frame if a lease outlived the session.
+static void release_session_ref(DsSession* s) {
+    if (s && s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete s;
 }
 
 // ---- Global capture state ----
@@ -561,7 +1615,83 @@ static std::mutex g_dsMutex;
 static bool g_dsInitialized = false;
 static uint64_t g_dsGeneration = 1;
 static std::vector<DsDevice> g_dsDevices;
-static std::map<uint32_t, DsSession*> g_dsSessions;
+
+// Running sessions by device index. Per-frame calls look sessions up without any global
+// lock: a reader announces itself on the entry, loads the pointer and takes a session
+// reference. cds_stop_capture unpublishes the pointer, then waits for announced readers
+// to leave before dropping the table's reference, so a reader either sees nullptr or
+// holds a reference that keeps the session alive. Start/stop still serialize on g_dsMutex.
+constexpr uint32_t kMaxSessions = 64;
+
+struct alignas(64) SessionEntry { // one cache line each: cameras don't share counters
+    std::atomic<DsSession*> session{ nullptr };
+    std::atomic<uint32_t> readers{ 0 };
+};
+static SessionEntry g_dsSessions[kMaxSessions];
+
+// Returns a referenced session or nullptr; pair with release_session_ref.
+static DsSession* acquire_session(uint32_t device_index) {
+    if (device_index >= kMaxSessions) return nullptr;
+    SessionEntry& e = g_dsSessions[device_index];
+    e.readers.fetch_add(1); // seq_cst: ordered against the exchange in unpublish_session
+    DsSession* s = e.session.load();
+    if (s) s->refs.fetch_add(1, std::memory_order_relaxed);
+    e.readers.fetch_sub(1, std::memory_order_release);
+    return s;
+}
+
+// Caller holds g_dsMutex.
+static bool session_published(uint32_t device_index) {
+    return device_index < kMaxSessions && g_dsSessions[device_index].session.load(std::memory_order_relaxed) != nullptr;
+}
+
+// Caller holds g_dsMutex. Returns the table's reference (nullptr if none).
+static DsSession* unpublish_session(uint32_t device_index) {
+    if (device_index >= kMaxSessions) return nullptr;
+    SessionEntry& e = g_dsSessions[device_index];
+    DsSession* s = e.session.exchange(nullptr);
+    if (s) {
+        // Readers that loaded s before the exchange are still taking their reference.
+        while (e.readers.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+    }
+    return s;
+}
+
+// Caller holds g_dsMutex. unpublish_session, but only while `s` is the published session.
+static DsSession* unpublish_session_if(uint32_t device_index, DsSession* s) {
+    if (device_index >= kMaxSessions || g_dsSessions[device_index].session.load() != s) return nullptr;
+    return unpublish_session(device_index);
+}
+
+// Session reference for the duration of one API call.
+class SessionRef {
+public:
+    explicit SessionRef(uint32_t device_index) : _s(acquire_session(device_index)) {}
+    ~SessionRef() { release_session_ref(_s); }
+    SessionRef(const SessionRef&) = delete;
+    SessionRef& operator=(const SessionRef&) = delete;
+
+    DsSession* get() const { return _s; }
+    operator DsSession*() const { return _s; }
+    DsSession* operator->() const { return _s; }
+
+private:
+    DsSession* _s;
+};
+
+// Paused graphs from cds_prepare_capture / CDS_STOP_KEEP_PREPARED by device index, guarded
+// by g_dsMutex. The table holds the owner reference.
+static DsSession* g_dsPrepared[kMaxSessions] = {};
+
+// Ends a session that isn't published (prepared, parked, or rejected at start) and drops
+// the owner reference; leases from an earlier run may keep the memory alive a bit longer.
+static void discard_session(DsSession* s) {
+    s->request_stop();
+    s->notify_frame_waiters();
+    s->notify_button_waiters();
+    if (s->worker.joinable()) s->worker.join();
+    release_session_ref(s);
+}
 
 static bool try_get_vih_dimensions(const VIDEOINFOHEADER* vih, uint32_t& width, uint32_t& height) {
     if (!vih) return false;
@@ -616,14 +1746,392 @@ static uint64_t now_ts100ns_utc() {
     return (uint64_t)ui.QuadPart;
 }
 
-// ---- Enumerate devices + formats (dedup with correct mapping) ----
-static HRESULT enumerate_devices_and_formats() {
-    constexpr int kMaxStreamCapsBytes = 1024 * 1024;
+// QueryPerformanceCounter in 100 ns units: never jumps, unlike the wall clock.
+static uint64_t now_ts100ns_monotonic() {
+    static const uint64_t freq = []() {
+        LARGE_INTEGER f{};
+        QueryPerformanceFrequency(&f);
+        return f.QuadPart > 0 ? (uint64_t)f.QuadPart : 1;
+    }();
+    LARGE_INTEGER c{};
+    QueryPerformanceCounter(&c);
+    uint64_t ticks = (uint64_t)c.QuadPart;
+    // Split to avoid overflowing ticks * 10^7.
+    return (ticks / freq) * 10000000ull + ((ticks % freq) * 10000000ull) / freq;
+}
 
-    g_dsDevices.clear();
+// ---- Device/format cache ----
+// Format lists are kept in a small binary file keyed by DevicePath, and reused while
+// the device's driver/firmware fingerprint is unchanged, so cds_initialize only has to
+// enumerate monikers. Cached lists are re-checked against the device when a capture
+// starts (see build_capture_graph_rgb32); a mismatch drops the entry. cds_refresh_device_cache
+// marks entries stale: they are still used, and the next capture start reads the device's
+// whole list and stores it again.
+//
+// File layout (little endian): "CDSC", u32 version, u32 deviceCount, then per device
+// u32 pathLen + UTF-8 path, u64 fingerprint, u32 flags (1 = stale), u32 formatCount,
+// formatCount x { u32 width, height, maxFps, streamCapsIndex, GUID subtype }; ends with
+// the FNV-1a 64 hash of everything before it.
+constexpr uint32_t kDeviceCacheMagic = 0x43534443; // "CDSC"
+constexpr uint32_t kDeviceCacheVersion = 2;
+constexpr uint32_t kDeviceCacheStale = 0x1u;
+constexpr uint32_t kDeviceCacheMaxDevices = 256;
+constexpr uint32_t kDeviceCacheMaxFormats = 4096;
+constexpr uint32_t kDeviceCacheMaxPath = 4096;
+
+struct DeviceCacheEntry {
+    uint64_t fingerprint = 0;
+    bool stale = false; // cds_refresh_device_cache: re-read at the next capture start
+    std::vector<DsFormat> formats;
+};
 
-    ICreateDevEnum* devEnum = nullptr;
-    IEnumMoniker* enumMon = nullptr;
+static std::mutex g_devCacheMutex; // enumeration holds g_dsMutex too; session threads only take this one
+static std::map<std::string, DeviceCacheEntry> g_devCache;
+static bool g_devCacheLoaded = false;
+static bool g_devCacheDirty = false;
+static bool g_devCachePathSet = false;
+static std::wstring g_devCachePath; // empty + set = caching off
+
+static uint64_t fnv1a64(const void* data, size_t len, uint64_t h = 1469598103934665603ull) {
+    const uint8_t* p = (const uint8_t*)data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Hash of the hardware IDs (they carry the firmware REV_xxxx) and the driver version and
+// date. 0 when the path isn't a device interface (virtual cameras): those are always probed.
+static uint64_t device_fingerprint(const std::wstring& devicePath) {
+    if (devicePath.empty()) return 0;
+    HDEVINFO set = SetupDiCreateDeviceInfoList(nullptr, nullptr);
+    if (set == INVALID_HANDLE_VALUE) return 0;
+
+    uint64_t fp = 0;
+    SP_DEVICE_INTERFACE_DATA ifData{};
+    ifData.cbSize = sizeof(ifData);
+    SP_DEVINFO_DATA devData{};
+    devData.cbSize = sizeof(devData);
+    if (SetupDiOpenDeviceInterfaceW(set, devicePath.c_str(), 0, &ifData) &&
+        (SetupDiGetDeviceInterfaceDetailW(set, &ifData, nullptr, 0, nullptr, &devData) ||
+         GetLastError() == ERROR_INSUFFICIENT_BUFFER)) {
+        BYTE buf[1024];
+        DWORD size = 0;
+        uint64_t h = fnv1a64(nullptr, 0);
+        bool any = false;
+        if (SetupDiGetDeviceRegistryPropertyW(set, &devData, SPDRP_HARDWAREID, nullptr, buf, sizeof(buf), &size)) {
+            h = fnv1a64(buf, size, h);
+            any = true;
+        }
+        const DEVPROPKEY* keys[] = { &DEVPKEY_Device_DriverVersion, &DEVPKEY_Device_DriverDate };
+        for (const DEVPROPKEY* key : keys) {
+            DEVPROPTYPE type = 0;
+            if (SetupDiGetDevicePropertyW(set, &devData, key, &type, buf, sizeof(buf), &size, 0)) {
+                h = fnv1a64(buf, size, h);
+                any = true;
+            }
+        }
+        if (any) fp = h ? h : 1;
+    }
+    SetupDiDestroyDeviceInfoList(set);
+    return fp;
+}
+
+// Caller holds g_devCacheMutex.
+static std::wstring device_cache_file() {
+    if (g_devCachePathSet) return g_devCachePath;
+    wchar_t dir[MAX_PATH];
+    DWORD n = GetEnvironmentVariableW(L"LOCALAPPDATA", dir, MAX_PATH);
+    if (n == 0 || n >= MAX_PATH) return {};
+    std::wstring path(dir, n);
+    path += L"\\libcdshow";
+    CreateDirectoryW(path.c_str(), nullptr); // fails harmlessly if it exists
+    return path + L"\\device_cache.bin";
+}
+
+struct CacheReader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok = true;
+
+    void read(void* dst, size_t n) {
+        if (!ok || (size_t)(end - p) < n) { ok = false; return; }
+        memcpy(dst, p, n);
+        p += n;
+    }
+    uint32_t u32() { uint32_t v = 0; read(&v, sizeof(v)); return v; }
+    uint64_t u64() { uint64_t v = 0; read(&v, sizeof(v)); return v; }
+};
+
+static void cache_put(std::vector<uint8_t>& out, const void* data, size_t n) {
+    const uint8_t* p = (const uint8_t*)data;
+    out.insert(out.end(), p, p + n);
+}
+
+static bool parse_device_cache(const std::vector<uint8_t>& file, std::map<std::string, DeviceCacheEntry>& out) {
+    if (file.size() < 12 + sizeof(uint64_t)) return false;
+    size_t bodyLen = file.size() - sizeof(uint64_t);
+    uint64_t stored = 0;
+    memcpy(&stored, file.data() + bodyLen, sizeof(stored));
+    if (stored != fnv1a64(file.data(), bodyLen)) return false;
+
+    CacheReader r{ file.data(), file.data() + bodyLen };
+    if (r.u32() != kDeviceCacheMagic || r.u32() != kDeviceCacheVersion) return false;
+    uint32_t devices = r.u32();
+    if (devices > kDeviceCacheMaxDevices) return false;
+    for (uint32_t d = 0; d < devices && r.ok; ++d) {
+        uint32_t pathLen = r.u32();
+        if (pathLen > kDeviceCacheMaxPath) return false;
+        std::string path(pathLen, '\0');
+        if (pathLen) r.read(&path[0], pathLen);
+        DeviceCacheEntry e;
+        e.fingerprint = r.u64();
+        e.stale = (r.u32() & kDeviceCacheStale) != 0;
+        uint32_t formats = r.u32();
+        if (formats > kDeviceCacheMaxFormats) return false;
+        e.formats.resize(formats);
+        for (DsFormat& f : e.formats) {
+            f.width = r.u32();
+            f.height = r.u32();
+            f.maxFps = r.u32();
+            f.streamCapsIndex = r.u32();
+            r.read(&f.subtype, sizeof(GUID));
+        }
+        out[path] = std::move(e);
+    }
+    return r.ok && r.p == r.end;
+}
+
+// Once per process (and after cds_set_device_cache_path); later calls are no-ops.
+static void device_cache_load() {
+    std::lock_guard<std::mutex> lk(g_devCacheMutex);
+    if (g_devCacheLoaded) return;
+    g_devCacheLoaded = true;
+    g_devCache.clear();
+
+    std::wstring path = device_cache_file();
+    if (path.empty()) return;
+    HANDLE f = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return;
+
+    std::vector<uint8_t> file;
+    LARGE_INTEGER size{};
+    if (GetFileSizeEx(f, &size) && size.QuadPart > 0 && size.QuadPart <= 16 * 1024 * 1024) {
+        file.resize((size_t)size.QuadPart);
+        DWORD got = 0;
+        if (!ReadFile(f, file.data(), (DWORD)file.size(), &got, nullptr) || got != file.size()) file.clear();
+    }
+    CloseHandle(f);
+
+    if (!parse_device_cache(file, g_devCache)) {
+        if (!file.empty()) dbg_printf("cds: device cache unreadable, re-probing all devices\n");
+        g_devCache.clear();
+    }
+}
+
+static bool device_cache_lookup(const std::string& path, uint64_t fingerprint, std::vector<DsFormat>& formats) {
+    if (path.empty() || fingerprint == 0) return false;
+    std::lock_guard<std::mutex> lk(g_devCacheMutex);
+    auto it = g_devCache.find(path);
+    if (it == g_devCache.end() || it->second.fingerprint != fingerprint || it->second.formats.empty()) return false;
+    formats = it->second.formats;
+    return true;
+}
+
+static void device_cache_store(const std::string& path, uint64_t fingerprint, const std::vector<DsFormat>& formats) {
+    if (path.empty() || fingerprint == 0 || formats.empty()) return;
+    std::lock_guard<std::mutex> lk(g_devCacheMutex);
+    DeviceCacheEntry& e = g_devCache[path];
+    e.fingerprint = fingerprint;
+    e.stale = false;
+    e.formats = formats;
+    g_devCacheDirty = true;
+}
+
+// The device's cached list was marked stale by cds_refresh_device_cache.
+static bool device_cache_is_stale(const std::string& path, uint64_t fingerprint) {
+    std::lock_guard<std::mutex> lk(g_devCacheMutex);
+    auto it = g_devCache.find(path);
+    return it != g_devCache.end() && it->second.fingerprint == fingerprint && it->second.stale;
+}
+
+// The device no longer matches its cached formats; the next cds_initialize probes it.
+static void device_cache_invalidate(const std::string& path) {
+    std::lock_guard<std::mutex> lk(g_devCacheMutex);
+    if (g_devCache.erase(path)) g_devCacheDirty = true;
+}
+
+// Writes the cache if it changed. Entries for absent devices are kept (unplugged cameras
+// come back) unless the cache grows past kDeviceCacheMaxDevices.
+static void device_cache_save(const std::vector<std::string>& present) {
+    std::lock_guard<std::mutex> lk(g_devCacheMutex);
+    if (!g_devCacheDirty) return;
+    if (g_devCache.size() > kDeviceCacheMaxDevices) {
+        for (auto it = g_devCache.begin(); it != g_devCache.end();) {
+            if (std::find(present.begin(), present.end(), it->first) == present.end()) it = g_devCache.erase(it);
+            else ++it;
+        }
+    }
+    std::wstring path = device_cache_file();
+    if (path.empty() || g_devCache.size() > kDeviceCacheMaxDevices) return;
+
+    std::vector<uint8_t> out;
+    uint32_t v = kDeviceCacheMagic; cache_put(out, &v, 4);
+    v = kDeviceCacheVersion; cache_put(out, &v, 4);
+    v = (uint32_t)g_devCache.size(); cache_put(out, &v, 4);
+    for (const auto& kv : g_devCache) {
+        v = (uint32_t)kv.first.size(); cache_put(out, &v, 4);
+        cache_put(out, kv.first.data(), kv.first.size());
+        cache_put(out, &kv.second.fingerprint, 8);
+        v = kv.second.stale ? kDeviceCacheStale : 0; cache_put(out, &v, 4);
+        v = (uint32_t)kv.second.formats.size(); cache_put(out, &v, 4);
+        for (const DsFormat& f : kv.second.formats) {
+            cache_put(out, &f.width, 4);
+            cache_put(out, &f.height, 4);
+            cache_put(out, &f.maxFps, 4);
+            cache_put(out, &f.streamCapsIndex, 4);
+            cache_put(out, &f.subtype, sizeof(GUID));
+        }
+    }
+    uint64_t h = fnv1a64(out.data(), out.size());
+    cache_put(out, &h, 8);
+
+    // Write aside and rename so a crash never leaves a torn file.
+    std::wstring tmp = path + L".tmp";
+    HANDLE f = CreateFileW(tmp.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return;
+    DWORD written = 0;
+    bool ok = WriteFile(f, out.data(), (DWORD)out.size(), &written, nullptr) && written == out.size();
+    CloseHandle(f);
+    if (ok && MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) g_devCacheDirty = false;
+    else DeleteFileW(tmp.c_str());
+}
+
+// ---- Enumerate devices + formats (dedup with correct mapping) ----
+
+// Every distinct (size, fps, subtype) the pin offers, in stable sorted order, each with the
+// first caps index that has it.
+static void read_stream_formats(IAMStreamConfig* cfg, std::vector<DsFormat>& formats) {
+    constexpr int kMaxStreamCapsBytes = 1024 * 1024;
+
+    // Dedup map keyed by (w,h,fps,subtype) and store first representative (streamCapsIndex)
+    std::map<FormatKey, DsFormat, FormatKeyLess> uniq;
+
+    int count = 0, size = 0;
+    HRESULT hrCaps = cfg->GetNumberOfCapabilities(&count, &size);
+    if (SUCCEEDED(hrCaps) &&
+        count > 0 &&
+        size >= (int)sizeof(VIDEO_STREAM_CONFIG_CAPS) &&
+        size <= kMaxStreamCapsBytes) {
+        std::vector<uint8_t> capsBuf((size_t)size);
+
+        for (int i = 0; i < count; ++i) {
+            AM_MEDIA_TYPE* mt = nullptr;
+            if (SUCCEEDED(cfg->GetStreamCaps(i, &mt, capsBuf.data())) && mt) {
+                VIDEO_STREAM_CONFIG_CAPS* caps = (VIDEO_STREAM_CONFIG_CAPS*)capsBuf.data();
+
+                uint32_t w = 0, h = 0;
+                if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat && mt->cbFormat >= sizeof(VIDEOINFOHEADER)) {
+                    auto vih = (VIDEOINFOHEADER*)mt->pbFormat;
+                    if (!try_get_vih_dimensions(vih, w, h)) {
+                        free_am_media_type(mt);
+                        continue;
+                    }
+                }
+
+                uint32_t maxFps = 0;
+                if (caps->MinFrameInterval > 0) {
+                    maxFps = (uint32_t)(10000000ULL / (uint64_t)caps->MinFrameInterval);
+                }
+                else if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat && mt->cbFormat >= sizeof(VIDEOINFOHEADER)) {
+                    auto vih = (VIDEOINFOHEADER*)mt->pbFormat;
+                    if (vih->AvgTimePerFrame > 0)
+                        maxFps = (uint32_t)(10000000ULL / (uint64_t)vih->AvgTimePerFrame);
+                }
+
+                if (w && h) {
+                    FormatKey key{ w, h, maxFps, mt->subtype };
+                    if (uniq.find(key) == uniq.end()) {
+                        DsFormat f{};
+                        f.width = w;
+                        f.height = h;
+                        f.maxFps = maxFps;
+                        f.subtype = mt->subtype;
+                        f.streamCapsIndex = (uint32_t)i; // REAL index
+                        uniq.emplace(key, f);
+                    }
+                }
+
+                free_am_media_type(mt);
+            }
+        }
+    }
+    else {
+        dbg_printf("Invalid stream capabilities: hr=%s count=%d size=%d\n",
+            HResultToString(hrCaps).c_str(), count, size);
+    }
+
+    // Emit formats in stable sorted order (map iteration sorted by key)
+    formats.clear();
+    formats.reserve(uniq.size());
+    for (auto& kv : uniq) {
+        formats.push_back(kv.second);
+    }
+}
+
+// Binds the filter and walks IAMStreamConfig in a temporary graph: the slow part of
+// enumeration (hundreds of ms per camera), hence the device cache.
+static void probe_device_formats(IMoniker* mk, DsDevice& dev) {
+    IBaseFilter* filter = nullptr;
+    HRESULT hr = mk->BindToObject(nullptr, nullptr, IID_IBaseFilter, (void**)&filter);
+    if (SUCCEEDED(hr) && filter) {
+        IGraphBuilder* graph = nullptr;
+        ICaptureGraphBuilder2* cap = nullptr;
+
+        HRESULT hrGraph = CoCreateInstance(CLSID_FilterGraph, nullptr, CLSCTX_INPROC_SERVER,
+            IID_IGraphBuilder, (void**)&graph);
+        HRESULT hrCap = SUCCEEDED(hrGraph)
+            ? CoCreateInstance(CLSID_CaptureGraphBuilder2, nullptr, CLSCTX_INPROC_SERVER,
+                IID_ICaptureGraphBuilder2, (void**)&cap)
+            : hrGraph;
+
+        if (SUCCEEDED(hrGraph) && SUCCEEDED(hrCap)) {
+
+            HRESULT hrFG = cap->SetFiltergraph(graph);
+            if (SUCCEEDED(hrFG)) {
+                hrFG = graph->AddFilter(filter, L"Capture");
+            }
+
+            IAMStreamConfig* cfg = nullptr;
+            HRESULT hrCfg = FAILED(hrFG) ? hrFG
+                : cap->FindInterface(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video, filter, IID_IAMStreamConfig, (void**)&cfg);
+            if (FAILED(hrCfg)) {
+                hrCfg = cap->FindInterface(&PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video, filter, IID_IAMStreamConfig, (void**)&cfg);
+            }
+
+            dev.formats.clear();
+            if (SUCCEEDED(hrCfg) && cfg) {
+                read_stream_formats(cfg, dev.formats);
+                SAFE_RELEASE(cfg);
+            }
+        }
+        SAFE_RELEASE(cap);
+        SAFE_RELEASE(graph);
+
+        SAFE_RELEASE(filter);
+    }
+}
+
+// Moniker pass: identity of every video input device, plus cached formats where the
+// cache still matches. Cheap; devices left with needsProbe = true go to probe_devices.
+static HRESULT list_devices(std::vector<DsDevice>& devices, std::vector<bool>& needsProbe) {
+    devices.clear();
+    needsProbe.clear();
+    device_cache_load();
+
+    ICreateDevEnum* devEnum = nullptr;
+    IEnumMoniker* enumMon = nullptr;
 
     HRESULT hr = CoCreateInstance(CLSID_SystemDeviceEnum, nullptr, CLSCTX_INPROC_SERVER,
         IID_ICreateDevEnum, (void**)&devEnum);
@@ -670,114 +2178,63 @@ static HRESULT enumerate_devices_and_formats() {
 
         parse_vid_pid_from_path(dev.devicePathUtf8, dev.vid, dev.pid);
 
-        // Enumerate formats using a temporary graph (robust)
-        IBaseFilter* filter = nullptr;
-        hr = mk->BindToObject(nullptr, nullptr, IID_IBaseFilter, (void**)&filter);
-        if (SUCCEEDED(hr) && filter) {
-            IGraphBuilder* graph = nullptr;
-            ICaptureGraphBuilder2* cap = nullptr;
-
-            HRESULT hrGraph = CoCreateInstance(CLSID_FilterGraph, nullptr, CLSCTX_INPROC_SERVER,
-                IID_IGraphBuilder, (void**)&graph);
-            HRESULT hrCap = SUCCEEDED(hrGraph)
-                ? CoCreateInstance(CLSID_CaptureGraphBuilder2, nullptr, CLSCTX_INPROC_SERVER,
-                    IID_ICaptureGraphBuilder2, (void**)&cap)
-                : hrGraph;
-
-            if (SUCCEEDED(hrGraph) && SUCCEEDED(hrCap)) {
-
-                HRESULT hrFG = cap->SetFiltergraph(graph);
-                if (SUCCEEDED(hrFG)) {
-                    hrFG = graph->AddFilter(filter, L"Capture");
-                }
-
-                IAMStreamConfig* cfg = nullptr;
-                HRESULT hrCfg = FAILED(hrFG) ? hrFG
-                    : cap->FindInterface(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video, filter, IID_IAMStreamConfig, (void**)&cfg);
-                if (FAILED(hrCfg)) {
-                    hrCfg = cap->FindInterface(&PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video, filter, IID_IAMStreamConfig, (void**)&cfg);
-                }
+        dev.fingerprint = device_fingerprint(dev.devicePathW);
+        dev.formatsFromCache = device_cache_lookup(dev.devicePathUtf8, dev.fingerprint, dev.formats);
+        needsProbe.push_back(!dev.formatsFromCache);
 
-                // Dedup map keyed by (w,h,fps,subtype) and store first representative (streamCapsIndex)
-                std::map<FormatKey, DsFormat, FormatKeyLess> uniq;
-
-                if (SUCCEEDED(hrCfg) && cfg) {
-                    int count = 0, size = 0;
-                    HRESULT hrCaps = cfg->GetNumberOfCapabilities(&count, &size);
-                    if (SUCCEEDED(hrCaps) &&
-                        count > 0 &&
-                        size >= (int)sizeof(VIDEO_STREAM_CONFIG_CAPS) &&
-                        size <= kMaxStreamCapsBytes) {
-                        std::vector<uint8_t> capsBuf((size_t)size);
-
-                        for (int i = 0; i < count; ++i) {
-                            AM_MEDIA_TYPE* mt = nullptr;
-                            if (SUCCEEDED(cfg->GetStreamCaps(i, &mt, capsBuf.data())) && mt) {
-                                VIDEO_STREAM_CONFIG_CAPS* caps = (VIDEO_STREAM_CONFIG_CAPS*)capsBuf.data();
-
-                                uint32_t w = 0, h = 0;
-                                if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat && mt->cbFormat >= sizeof(VIDEOINFOHEADER)) {
-                                    auto vih = (VIDEOINFOHEADER*)mt->pbFormat;
-                                    if (!try_get_vih_dimensions(vih, w, h)) {
-                                        free_am_media_type(mt);
-                                        continue;
-                                    }
-                                }
-
-                                uint32_t maxFps = 0;
-                                if (caps->MinFrameInterval > 0) {
-                                    maxFps = (uint32_t)(10000000ULL / (uint64_t)caps->MinFrameInterval);
-                                }
-                                else if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat && mt->cbFormat >= sizeof(VIDEOINFOHEADER)) {
-                                    auto vih = (VIDEOINFOHEADER*)mt->pbFormat;
-                                    if (vih->AvgTimePerFrame > 0)
-                                        maxFps = (uint32_t)(10000000ULL / (uint64_t)vih->AvgTimePerFrame);
-                                }
-
-                                if (w && h) {
-                                    FormatKey key{ w, h, maxFps, mt->subtype };
-                                    if (uniq.find(key) == uniq.end()) {
-                                        DsFormat f{};
-                                        f.width = w;
-                                        f.height = h;
-                                        f.maxFps = maxFps;
-                                        f.subtype = mt->subtype;
-                                        f.streamCapsIndex = (uint32_t)i; // REAL index
-                                        uniq.emplace(key, f);
-                                    }
-                                }
-
-                                free_am_media_type(mt);
-                            }
-                        }
-                    }
-                    else {
-                        dbg_printf("Invalid stream capabilities: hr=%s count=%d size=%d\n",
-                            HResultToString(hrCaps).c_str(), count, size);
-                    }
+        devices.push_back(std::move(dev));
+        mk->Release();
+    }
 
-                    SAFE_RELEASE(cfg);
-                }
+    enumMon->Release();
+    return S_OK;
+}
 
-                // Emit formats in stable sorted order (map iteration sorted by key)
-                dev.formats.clear();
-                dev.formats.reserve(uniq.size());
-                for (auto& kv : uniq) {
-                    dev.formats.push_back(kv.second);
-                }
+constexpr uint32_t kMaxProbeThreads = 8;
+
+// Probes formats of the devices flagged in needsProbe, several at once. Each worker has
+// its own COM apartment and rebinds its devices by moniker display name (monikers from
+// the listing apartment can't be used there). Stops early when cancel is set.
+static void probe_devices(std::vector<DsDevice>& devices, const std::vector<bool>& needsProbe,
+    const std::atomic<bool>& cancel) {
+    std::vector<size_t> todo;
+    for (size_t i = 0; i < devices.size(); ++i)
+        if (needsProbe[i]) todo.push_back(i);
+    if (todo.empty()) return;
+
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        HRESULT hrCo = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
+        while (!cancel.load()) {
+            size_t k = next.fetch_add(1);
+            if (k >= todo.size()) break;
+            DsDevice& dev = devices[todo[k]];
+            IMoniker* mk = nullptr;
+            if (SUCCEEDED(bind_moniker_by_display_name(dev.monikerDisplayNameW, &mk)) && mk) {
+                probe_device_formats(mk, dev);
+                mk->Release();
+                device_cache_store(dev.devicePathUtf8, dev.fingerprint, dev.formats);
+            }
+            else {
+                dbg_printf("cds: rebinding %s for probing failed\n", dev.nameUtf8.c_str());
             }
-            SAFE_RELEASE(cap);
-            SAFE_RELEASE(graph);
-
-            SAFE_RELEASE(filter);
         }
+        if (SUCCEEDED(hrCo)) CoUninitialize();
+    };
 
-        g_dsDevices.push_back(std::move(dev));
-        mk->Release();
+    unsigned hw = std::thread::hardware_concurrency();
+    size_t threads = (std::min)({ todo.size(), (size_t)kMaxProbeThreads, (size_t)(hw ? hw : 1) });
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; ++t) {
+        try {
+            pool.emplace_back(worker);
+        }
+        catch (...) {
+            break; // the calling thread still works through the list
+        }
     }
-
-    enumMon->Release();
-    return S_OK;
+    worker();
+    for (auto& th : pool) th.join();
 }
 
 static void cleanup_still_fallback_branch(DsSession* s) {
@@ -929,14 +2386,323 @@ static HRESULT build_still_fallback_button_branch(DsSession* s) {
     return S_OK;
 }
 
-// ---- Build capture graph: RGB32 guaranteed + detect bottom-up & flip ----
+// Sizes the steady-state slots for the current output layout so BufferCB does not allocate
+// on the streaming thread. Encoded and lazy slots grow to the largest native sample seen instead.
+// Also called from the API thread (cds_set_output_roi/size) while frames are being published:
+// reserve skips the slot BufferCB is writing or publishing (see FrameExchange::end_write).
+static void preallocate_frame_slots(DsSession* s) {
+    if (s->encoded || s->lazy) return;
+    s->frames.reserve(kFrameSlotsPreallocated, s->current_geometry().out.frameBytes);
+}
+
+// ---- Build capture graph: RGB32 guaranteed (converted in BufferCB or by DirectShow) ----
+// Sets the capture pin's format and connects it through the SampleGrabber to the null
+// renderer. Runs at graph build and again, on a stopped graph, for cds_change_format.
+static HRESULT connect_capture_stream(DsSession* s, const DsDevice& dev, const DsFormat& fmt) {
+    const uint32_t streamCapsIndex = fmt.streamCapsIndex;
+    constexpr int kMaxStreamCapsBytes = 1024 * 1024;
+
+    HRESULT hr;
+
+    // -----------------------------
+    // Set device format (native)
+    // -----------------------------
+    IAMStreamConfig* cfg = nullptr;
+    hr = s->cap->FindInterface(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video, s->capFilter, IID_IAMStreamConfig, (void**)&cfg);
+    if (FAILED(hr))
+        hr = s->cap->FindInterface(&PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video, s->capFilter, IID_IAMStreamConfig, (void**)&cfg);
+
+    if (FAILED(hr) || !cfg) return E_FAIL;
+
+    int count = 0, size = 0;
+    HRESULT hrCaps = cfg->GetNumberOfCapabilities(&count, &size);
+    if (FAILED(hrCaps) ||
+        count <= 0 ||
+        size < (int)sizeof(VIDEO_STREAM_CONFIG_CAPS) ||
+        size > kMaxStreamCapsBytes) {
+        SAFE_RELEASE(cfg);
+        return E_FAIL;
+    }
+
+    if ((int)streamCapsIndex >= count) {
+        if (dev.formatsFromCache) device_cache_invalidate(dev.devicePathUtf8);
+        SAFE_RELEASE(cfg);
+        return E_FAIL;
+    }
+
+    AM_MEDIA_TYPE* mt = nullptr;
+    std::vector<uint8_t> capsBuf((size_t)size);
+
+    hr = cfg->GetStreamCaps((int)streamCapsIndex, &mt, capsBuf.data());
+    if (FAILED(hr) || !mt) { SAFE_RELEASE(cfg); return E_FAIL; }
+
+    // A cached format list is only trusted this far: the entry must still describe this caps index.
+    if (dev.formatsFromCache) {
+        uint32_t w = 0, h = 0;
+        bool match = mt->subtype == fmt.subtype;
+        if (match && mt->formattype == FORMAT_VideoInfo && mt->pbFormat && mt->cbFormat >= sizeof(VIDEOINFOHEADER))
+            match = try_get_vih_dimensions((VIDEOINFOHEADER*)mt->pbFormat, w, h) && w == fmt.width && h == fmt.height;
+        if (!match) {
+            dbg_printf("cds: cached format %u no longer matches the device, dropping its cache entry\n", streamCapsIndex);
+            device_cache_invalidate(dev.devicePathUtf8);
+            free_am_media_type(mt);
+            SAFE_RELEASE(cfg);
+            return E_FAIL;
+        }
+        // After cds_refresh_device_cache: re-read the whole list while the filter is bound
+        // anyway; cds_initialize and cds_rescan pick up the stored list.
+        if (device_cache_is_stale(dev.devicePathUtf8, dev.fingerprint)) {
+            std::vector<DsFormat> current;
+            read_stream_formats(cfg, current);
+            dbg_printf("cds: re-checked cached formats of %s: %u listed, %u offered\n",
+                dev.nameUtf8.c_str(), (uint32_t)dev.formats.size(), (uint32_t)current.size());
+            device_cache_store(dev.devicePathUtf8, dev.fingerprint, current);
+        }
+    }
+
+    hr = cfg->SetFormat(mt);
+    if (FAILED(hr)) {
+        free_am_media_type(mt);
+        SAFE_RELEASE(cfg);
+        return hr;
+    }
+
+    uint32_t width = 0, height = 0;
+    if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat) {
+        auto vih = (VIDEOINFOHEADER*)mt->pbFormat;
+        if (!try_get_vih_dimensions(vih, width, height)) {
+            free_am_media_type(mt);
+            SAFE_RELEASE(cfg);
+            return E_FAIL;
+        }
+    }
+
+    GUID nativeSubtype = mt->subtype;
+    free_am_media_type(mt);
+    SAFE_RELEASE(cfg);
+
+    if (!width || !height) return E_FAIL;
+
+    // -----------------------------
+    // SampleGrabber: take YUY2 / NV12 / RGB24 as-is and convert in BufferCB
+    // (SIMD), anything else as RGB32 through DirectShow's own converters.
+    // -----------------------------
+    if (!s->grabberFilter) { // kept across format changes
+        hr = CoCreateInstance(__uuidof(CLSID_SampleGrabber), nullptr, CLSCTX_INPROC_SERVER,
+            IID_IBaseFilter, (void**)&s->grabberFilter);
+        if (FAILED(hr)) return hr;
+
+        hr = s->graph->AddFilter(s->grabberFilter, L"FrameGrabber");
+        if (FAILED(hr)) return hr;
+        hr = s->grabberFilter->QueryInterface(__uuidof(ISampleGrabber), (void**)&s->grabber);
+        if (FAILED(hr) || !s->grabber) return FAILED(hr) ? hr : E_FAIL;
+
+        hr = s->grabber->SetBufferSamples(FALSE);
+        if (FAILED(hr)) return hr;
+
+        hr = CoCreateInstance(__uuidof(CLSID_NullRenderer), nullptr, CLSCTX_INPROC_SERVER,
+            IID_IBaseFilter, (void**)&s->nullRenderer);
+        if (FAILED(hr)) return hr;
+
+        hr = s->graph->AddFilter(s->nullRenderer, L"NullRenderer");
+        if (FAILED(hr)) return hr;
+    }
+
+    size_t rowBytes = 0;
+    size_t frameBytes = 0;
+    if (!calc_frame_layout_bytes(width, height, rowBytes, frameBytes)) return E_FAIL;
+    if (rowBytes > (size_t)(std::numeric_limits<int32_t>::max)()) return E_FAIL;
+    if (frameBytes > (std::numeric_limits<DWORD>::max)()) return E_FAIL;
+    {
+        // A new format starts over at the full frame; readers see size and geometry change together.
+        std::lock_guard<std::mutex> lk(s->geometryMutex);
+        s->width = width;
+        s->height = height;
+        s->geometry = FrameGeometry{};
+        s->geometry.roiW = s->width;
+        s->geometry.roiH = s->height;
+        if (!calc_geometry(s->outFormat, s->geometry)) return E_FAIL;
+    }
+
+    auto render_capture_stream = [&]() -> HRESULT {
+        HRESULT hrR = s->cap->RenderStream(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video,
+            s->capFilter, s->grabberFilter, s->nullRenderer);
+        if (FAILED(hrR))
+            hrR = s->cap->RenderStream(&PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video,
+                s->capFilter, s->grabberFilter, s->nullRenderer);
+        return hrR;
+    };
+
+    // MJPG reaches the grabber compressed for passthrough, or for our own decode pool.
+    bool mjpegToGrabber = false;
+    if (s->encoded && nativeSubtype != MEDIASUBTYPE_MJPG) return VFW_E_TYPE_NOT_ACCEPTED;
+    if (s->encoded || ((s->decodeMjpeg || s->lazy) && nativeSubtype == MEDIASUBTYPE_MJPG)) {
+        AM_MEDIA_TYPE mjpg{};
+        mjpg.majortype = MEDIATYPE_Video;
+        mjpg.subtype = MEDIASUBTYPE_MJPG;
+        mjpg.formattype = FORMAT_VideoInfo;
+
+        hr = s->grabber->SetMediaType(&mjpg);
+        if (SUCCEEDED(hr)) hr = render_capture_stream();
+        dbg_printf("MJPG grabber connection (%s) => %s\n",
+            s->encoded ? "passthrough" : (s->lazy ? "lazy" : "decode pool"), HResultToString(hr).c_str());
+        if (FAILED(hr) && s->encoded) return hr;
+
+        mjpegToGrabber = SUCCEEDED(hr);
+        if (FAILED(hr)) {
+            // Decode pool / lazy decode unavailable: let DirectShow decode to RGB32 as before.
+            disconnect_filter_pins(s->graph, s->grabberFilter);
+            disconnect_filter_pins(s->graph, s->nullRenderer);
+        }
+    }
+
+    SrcFormat nativeFmt = SrcFormat::Rgb32;
+    bool convertInLibrary = !mjpegToGrabber &&
+        src_format_from_subtype(nativeSubtype, nativeFmt) && nativeFmt != SrcFormat::Rgb32;
+
+    hr = mjpegToGrabber ? S_OK : E_FAIL;
+    if (convertInLibrary) {
+        AM_MEDIA_TYPE native{};
+        native.majortype = MEDIATYPE_Video;
+        native.subtype = nativeSubtype;
+        native.formattype = FORMAT_VideoInfo;
+
+        hr = s->grabber->SetMediaType(&native);
+        if (SUCCEEDED(hr)) hr = render_capture_stream();
+        dbg_printf("Native grabber connection (%s) => %s\n",
+            SubTypeName(nativeSubtype), HResultToString(hr).c_str());
+
+        if (FAILED(hr)) {
+            disconnect_filter_pins(s->graph, s->grabberFilter);
+            disconnect_filter_pins(s->graph, s->nullRenderer);
+        }
+    }
+
+    if (FAILED(hr)) {
+        VIDEOINFOHEADER vih{};
+        vih.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+        vih.bmiHeader.biWidth = (LONG)s->width;
+        vih.bmiHeader.biHeight = -(LONG)s->height;
+        vih.bmiHeader.biPlanes = 1;
+        vih.bmiHeader.biBitCount = 32;
+        vih.bmiHeader.biCompression = BI_RGB;
+        vih.bmiHeader.biSizeImage = (DWORD)frameBytes;
+
+        AM_MEDIA_TYPE rgb{};
+        rgb.majortype = MEDIATYPE_Video;
+        rgb.subtype = MEDIASUBTYPE_RGB32;
+        rgb.formattype = FORMAT_VideoInfo;
+        rgb.cbFormat = sizeof(VIDEOINFOHEADER);
+        rgb.pbFormat = (BYTE*)CoTaskMemAlloc(sizeof(VIDEOINFOHEADER));
+        if (!rgb.pbFormat) return E_OUTOFMEMORY;
+        memcpy(rgb.pbFormat, &vih, sizeof(VIDEOINFOHEADER));
+
+        hr = s->grabber->SetMediaType(&rgb);
+        CoTaskMemFree(rgb.pbFormat);
+        if (FAILED(hr)) return hr;
+
+        hr = render_capture_stream();
+    }
+
+    if (FAILED(hr)) return hr;
+
+    // Detect sample layout and orientation from the connected media type.
+    // Positive biHeight means bottom-up RGB (needs row flip in BufferCB); YUV is always top-down.
+    s->bottomUp = false;
+    s->srcFormat = SrcFormat::Rgb32;
+    uint32_t strideWidth = s->width;
+    if (!mjpegToGrabber) {
+        AM_MEDIA_TYPE connected{};
+        if (SUCCEEDED(s->grabber->GetConnectedMediaType(&connected))) {
+            SrcFormat connectedFmt = SrcFormat::Rgb32;
+            if (src_format_from_subtype(connected.subtype, connectedFmt)) {
+                s->srcFormat = connectedFmt;
+            }
+
+            if (connected.formattype == FORMAT_VideoInfo &&
+                connected.pbFormat &&
+                connected.cbFormat >= sizeof(VIDEOINFOHEADER)) {
+                auto cvih = reinterpret_cast<VIDEOINFOHEADER*>(connected.pbFormat);
+                LONG ch = cvih->bmiHeader.biHeight;
+                LONG cw = cvih->bmiHeader.biWidth;
+                if (cw > 0 && (uint32_t)cw > strideWidth) strideWidth = (uint32_t)cw;
+
+                bool isRgb = (s->srcFormat == SrcFormat::Rgb32 || s->srcFormat == SrcFormat::Rgb24);
+                s->bottomUp = isRgb && (ch > 0);
+                dbg_printf("Sample layout: %s biWidth=%ld biHeight=%ld -> bottomUp=%s\n",
+                    SubTypeName(connected.subtype) ? SubTypeName(connected.subtype) : GuidToStr(connected.subtype).c_str(),
+                    (long)cw, (long)ch, s->bottomUp ? "YES" : "NO");
+            }
+
+            if (connected.cbFormat && connected.pbFormat) CoTaskMemFree(connected.pbFormat);
+            if (connected.pUnk) connected.pUnk->Release();
+        }
+    }
+    s->srcStride = calc_src_stride(s->srcFormat, strideWidth);
+
+    s->lazyJpeg = s->lazy && mjpegToGrabber;
+    if (mjpegToGrabber && !s->encoded && !s->lazy) {
+        hr = start_mjpeg_decode_pool(s);
+        if (FAILED(hr)) return hr;
+    }
+
+    if (!s->frameCbObj) {
+        s->frameCbObj = new FrameGrabberCB(s);
+        if (!s->frameCbObj) return E_OUTOFMEMORY;
+    }
+    hr = s->grabber->SetCallback(s->frameCbObj, 1);
+    if (FAILED(hr)) return hr;
+
+    preallocate_frame_slots(s); // also after cds_change_format reconnects
+    s->format = fmt;
+    return S_OK;
+}
+
+// Stopped graph: takes the capture stream apart back to the capture filter. Filters that
+// RenderStream put in between (decoders, converters, Smart Tee) are removed; the grabber
+// and null renderer stay in the graph, unconnected.
+static void disconnect_capture_stream(DsSession* s) {
+    std::vector<IBaseFilter*> between;
+    IBaseFilter* f = s->grabberFilter;
+    while (f) {
+        IBaseFilter* up = nullptr;
+        IEnumPins* en = nullptr;
+        if (SUCCEEDED(f->EnumPins(&en)) && en) {
+            IPin* p = nullptr; ULONG got = 0;
+            while (!up && en->Next(1, &p, &got) == S_OK) {
+                PIN_DIRECTION dir = PINDIR_OUTPUT;
+                IPin* other = nullptr;
+                if (SUCCEEDED(p->QueryDirection(&dir)) && dir == PINDIR_INPUT &&
+                    SUCCEEDED(p->ConnectedTo(&other)) && other) {
+                    PIN_INFO pi{};
+                    if (SUCCEEDED(other->QueryPinInfo(&pi))) up = pi.pFilter;
+                    other->Release();
+                }
+                p->Release();
+            }
+            en->Release();
+        }
+        if (up == s->capFilter) {
+            up->Release();
+            break;
+        }
+        if (up) between.push_back(up);
+        f = up;
+    }
+
+    disconnect_filter_pins(s->graph, s->grabberFilter);
+    disconnect_filter_pins(s->graph, s->nullRenderer);
+    for (IBaseFilter* b : between) {
+        s->graph->RemoveFilter(b);
+        b->Release();
+    }
+}
+
 static HRESULT build_capture_graph_rgb32(
     DsSession* s,
     const DsDevice& dev,
-    uint32_t streamCapsIndex)
+    const DsFormat& fmt)
 {
-    constexpr int kMaxStreamCapsBytes = 1024 * 1024;
-
     HRESULT hr;
 
     hr = CoCreateInstance(CLSID_FilterGraph, nullptr, CLSCTX_INPROC_SERVER, IID_IGraphBuilder, (void**)&s->graph);
@@ -1040,256 +2806,405 @@ static HRESULT build_capture_graph_rgb32(
         }
     }
 
-    // -----------------------------
-    // Set device format (native)
-    // -----------------------------
-    IAMStreamConfig* cfg = nullptr;
-    hr = s->cap->FindInterface(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video, s->capFilter, IID_IAMStreamConfig, (void**)&cfg);
-    if (FAILED(hr))
-        hr = s->cap->FindInterface(&PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video, s->capFilter, IID_IAMStreamConfig, (void**)&cfg);
+    hr = connect_capture_stream(s, dev, fmt);
+    if (FAILED(hr)) return hr;
 
-    if (FAILED(hr) || !cfg) return E_FAIL;
+    if (s->useStillFallback) {
+        HRESULT hrStill = build_still_fallback_button_branch(s);
+        dbg_printf("Fallback build STILL branch => %s\n", HResultToString(hrStill).c_str());
+        if (FAILED(hrStill)) {
+            dbg_printf("Fallback STILL path unavailable; button events may be unavailable.\n");
+            s->useStillFallback = false;
+        }
+    }
 
-    int count = 0, size = 0;
-    HRESULT hrCaps = cfg->GetNumberOfCapabilities(&count, &size);
-    if (FAILED(hrCaps) ||
-        count <= 0 ||
-        size < (int)sizeof(VIDEO_STREAM_CONFIG_CAPS) ||
-        size > kMaxStreamCapsBytes) {
-        SAFE_RELEASE(cfg);
-        return E_FAIL;
-    }
-
-    if ((int)streamCapsIndex >= count) { SAFE_RELEASE(cfg); return E_FAIL; }
+    hr = s->graph->QueryInterface(IID_IMediaControl, (void**)&s->mc);
+    if (FAILED(hr) || !s->mc) return FAILED(hr) ? hr : E_FAIL;
+    s->graph->QueryInterface(IID_IMediaEvent, (void**)&s->me);
 
-    AM_MEDIA_TYPE* mt = nullptr;
-    std::vector<uint8_t> capsBuf((size_t)size);
+    return S_OK;
+}
 
-    hr = cfg->GetStreamCaps((int)streamCapsIndex, &mt, capsBuf.data());
-    if (FAILED(hr) || !mt) { SAFE_RELEASE(cfg); return E_FAIL; }
+// ---- Session thread scheduling ----
+// The loop itself is in session_loop.h; Win32SessionWaitSet is the real wait set.
+static std::atomic<uint32_t> g_triggerPollMs{ kDefaultTriggerPollMs };
 
-    hr = cfg->SetFormat(mt);
-    if (FAILED(hr)) {
-        free_am_media_type(mt);
-        SAFE_RELEASE(cfg);
-        return hr;
+// Stop event + IMediaEvent handle, with the message queue pumped since the session
+// thread is an STA.
+class Win32SessionWaitSet : public SessionWaitSet {
+public:
+    Win32SessionWaitSet(HANDLE stopEvent, IMediaEvent* me) {
+        _handles[_count++] = stopEvent;
+        OAEVENT h = 0;
+        if (me && SUCCEEDED(me->GetEventHandle(&h)) && h) _handles[_count++] = (HANDLE)h;
     }
 
-    if (mt->formattype == FORMAT_VideoInfo && mt->pbFormat) {
-        auto vih = (VIDEOINFOHEADER*)mt->pbFormat;
-        if (!try_get_vih_dimensions(vih, s->width, s->height)) {
-            free_am_media_type(mt);
-            SAFE_RELEASE(cfg);
-            return E_FAIL;
+    SessionWake wait(uint32_t timeoutMs) override {
+        DWORD r = MsgWaitForMultipleObjects(_count, _handles, FALSE,
+            timeoutMs == kWaitForever ? INFINITE : (DWORD)timeoutMs, QS_ALLINPUT);
+        if (r == WAIT_OBJECT_0) return SessionWake::Stop;
+        if (_count > 1 && r == WAIT_OBJECT_0 + 1) return SessionWake::MediaEvent;
+        if (r == WAIT_TIMEOUT) return SessionWake::Timeout;
+        if (r == WAIT_OBJECT_0 + _count) {
+            MSG msg;
+            while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+                TranslateMessage(&msg);
+                DispatchMessageW(&msg);
+            }
+            return SessionWake::Other;
         }
+        dbg_printf("cds: MsgWaitForMultipleObjects failed (%lu)\n", (unsigned long)GetLastError());
+        Sleep(kDefaultTriggerPollMs); // don't spin
+        return SessionWake::Other;
     }
 
-    free_am_media_type(mt);
-    SAFE_RELEASE(cfg);
-
-    if (!s->width || !s->height) return E_FAIL;
-
-    // -----------------------------
-    // SampleGrabber (RGB32)
-    // -----------------------------
-    hr = CoCreateInstance(__uuidof(CLSID_SampleGrabber), nullptr, CLSCTX_INPROC_SERVER,
-        IID_IBaseFilter, (void**)&s->grabberFilter);
-    if (FAILED(hr)) return hr;
-
-    hr = s->graph->AddFilter(s->grabberFilter, L"FrameGrabber");
-    if (FAILED(hr)) return hr;
-    hr = s->grabberFilter->QueryInterface(__uuidof(ISampleGrabber), (void**)&s->grabber);
-    if (FAILED(hr) || !s->grabber) return FAILED(hr) ? hr : E_FAIL;
-
-    VIDEOINFOHEADER vih{};
-    vih.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
-    vih.bmiHeader.biWidth = (LONG)s->width;
-    vih.bmiHeader.biHeight = -(LONG)s->height;
-    vih.bmiHeader.biPlanes = 1;
-    vih.bmiHeader.biBitCount = 32;
-    vih.bmiHeader.biCompression = BI_RGB;
-    size_t rowBytes = 0;
-    size_t frameBytes = 0;
-    if (!calc_frame_layout_bytes(s->width, s->height, rowBytes, frameBytes)) return E_FAIL;
-    if (rowBytes > (size_t)(std::numeric_limits<int32_t>::max)()) return E_FAIL;
-    if (frameBytes > (std::numeric_limits<DWORD>::max)()) return E_FAIL;
-    vih.bmiHeader.biSizeImage = (DWORD)frameBytes;
-
-    AM_MEDIA_TYPE rgb{};
-    rgb.majortype = MEDIATYPE_Video;
-    rgb.subtype = MEDIASUBTYPE_RGB32;
-    rgb.formattype = FORMAT_VideoInfo;
-    rgb.cbFormat = sizeof(VIDEOINFOHEADER);
-    rgb.pbFormat = (BYTE*)CoTaskMemAlloc(sizeof(VIDEOINFOHEADER));
-    if (!rgb.pbFormat) return E_OUTOFMEMORY;
-    memcpy(rgb.pbFormat, &vih, sizeof(VIDEOINFOHEADER));
-
-    hr = s->grabber->SetMediaType(&rgb);
-    CoTaskMemFree(rgb.pbFormat);
-    if (FAILED(hr)) return hr;
-
-    hr = s->grabber->SetBufferSamples(FALSE);
-    if (FAILED(hr)) return hr;
+    uint64_t now_ms() override { return GetTickCount64(); }
 
-    hr = CoCreateInstance(__uuidof(CLSID_NullRenderer), nullptr, CLSCTX_INPROC_SERVER,
-        IID_IBaseFilter, (void**)&s->nullRenderer);
-    if (FAILED(hr)) return hr;
-
-    hr = s->graph->AddFilter(s->nullRenderer, L"NullRenderer");
-    if (FAILED(hr)) return hr;
+private:
+    HANDLE _handles[2] = {};
+    DWORD _count = 0;
+};
 
-    hr = s->cap->RenderStream(&PIN_CATEGORY_CAPTURE, &MEDIATYPE_Video,
-        s->capFilter, s->grabberFilter, s->nullRenderer);
+static void drain_media_events(DsSession* s) {
+    if (!s->me) return;
+    long ev = 0;
+    LONG_PTR p1 = 0, p2 = 0;
+    while (s->me->GetEvent(&ev, &p1, &p2, 0) == S_OK) {
+        if (ev == EC_DEVICE_LOST) dbg_printf("cds: graph event EC_DEVICE_LOST (%ld)\n", (long)p2);
+        else if (ev == EC_ERRORABORT) dbg_printf("cds: graph event EC_ERRORABORT hr=0x%08lx\n", (unsigned long)p1);
+        s->me->FreeEventParams(ev, p1, p2);
+    }
+}
 
-    if (FAILED(hr))
-        hr = s->cap->RenderStream(&PIN_CATEGORY_PREVIEW, &MEDIATYPE_Video,
-            s->capFilter, s->grabberFilter, s->nullRenderer);
+static void poll_uvc_trigger(DsSession* s) {
+    long mode = 0;
+    HRESULT hrMode = s->videoCtrl->GetMode(s->stillPinVC, &mode);
+    if (FAILED(hrMode)) return;
 
-    if (FAILED(hr)) return hr;
+    bool was = (s->lastVcMode & VideoControlFlag_Trigger) != 0;
+    bool now = (mode & VideoControlFlag_Trigger) != 0;
+    if (was || !now) {
+        s->lastVcMode = mode;
+        return;
+    }
 
-    // Detect orientation from the connected media type.
-    // Positive biHeight means bottom-up RGB (needs row flip in BufferCB).
-    s->bottomUp = false;
-    {
-        AM_MEDIA_TYPE connected{};
-        if (SUCCEEDED(s->grabber->GetConnectedMediaType(&connected))) {
-            LONG ch = 0;
-            bool haveH = false;
-            if (connected.formattype == FORMAT_VideoInfo &&
-                connected.pbFormat &&
-                connected.cbFormat >= sizeof(VIDEOINFOHEADER)) {
-                auto cvih = reinterpret_cast<VIDEOINFOHEADER*>(connected.pbFormat);
-                ch = cvih->bmiHeader.biHeight;
-                haveH = true;
-            }
-            if (haveH) {
-                s->bottomUp = (ch > 0);
-                dbg_printf("RGB orientation: biHeight=%ld -> bottomUp=%s\n",
-                    (long)ch, s->bottomUp ? "YES" : "NO");
-            }
+    s->record_button(CDS_BUTTON_SOURCE_TRIGGER);
+    dbg_printf("[UVC TRIGGER] rising edge\n");
 
-            if (connected.cbFormat && connected.pbFormat) CoTaskMemFree(connected.pbFormat);
-            if (connected.pUnk) connected.pUnk->Release();
-        }
+    // Re-arm for devices that latch Trigger until cleared.
+    long clearMode = mode & ~VideoControlFlag_Trigger;
+    HRESULT hrClear = s->videoCtrl->SetMode(s->stillPinVC, clearMode);
+    dbg_printf("IAMVideoControl::SetMode(clear trigger) => %s mode=0x%08lx\n",
+        HResultToString(hrClear).c_str(), clearMode);
+    if (FAILED(hrClear)) {
+        s->lastVcMode = mode;
+        return;
     }
+    long verifyMode = 0;
+    s->lastVcMode = SUCCEEDED(s->videoCtrl->GetMode(s->stillPinVC, &verifyMode)) ? verifyMode : clearMode;
+}
 
-    s->frameCbObj = new FrameGrabberCB(s);
-    if (!s->frameCbObj) return E_OUTOFMEMORY;
-    hr = s->grabber->SetCallback(s->frameCbObj, 1);
-    if (FAILED(hr)) return hr;
-
-    if (s->useStillFallback) {
-        HRESULT hrStill = build_still_fallback_button_branch(s);
-        dbg_printf("Fallback build STILL branch => %s\n", HResultToString(hrStill).c_str());
-        if (FAILED(hrStill)) {
-            dbg_printf("Fallback STILL path unavailable; button events may be unavailable.\n");
-            s->useStillFallback = false;
+// Paused warm session: true when started, false when stopped.
+static bool wait_for_run(DsSession* s) {
+    HANDLE handles[2] = { s->stopEvent, s->runEvent };
+    for (;;) {
+        DWORD r = MsgWaitForMultipleObjects(2, handles, FALSE, INFINITE, QS_ALLINPUT);
+        if (r == WAIT_OBJECT_0) return false;
+        if (r == WAIT_OBJECT_0 + 1) return true;
+        if (r != WAIT_OBJECT_0 + 2) {
+            dbg_printf("cds: MsgWaitForMultipleObjects failed (%lu)\n", (unsigned long)GetLastError());
+            return false;
+        }
+        MSG msg;
+        while (PeekMessageW(&msg, nullptr, 0, 0, PM_REMOVE)) {
+            TranslateMessage(&msg);
+            DispatchMessageW(&msg);
         }
     }
-
-    hr = s->graph->QueryInterface(IID_IMediaControl, (void**)&s->mc);
-    if (FAILED(hr) || !s->mc) return FAILED(hr) ? hr : E_FAIL;
-    s->graph->QueryInterface(IID_IMediaEvent, (void**)&s->me);
-
-    s->lastRgb.resize(frameBytes);
-
-    return S_OK;
 }
 
-static void session_thread_main(DsSession* s, DsDevice devCopy, uint32_t streamCapsIndex) {
+static void session_thread_main(DsSession* s, DsDevice devCopy, DsFormat format) {
     CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
 
-    auto signal_start = [&](cds_result_t r) {
-        {
-            std::lock_guard<std::mutex> lk(s->startMutex);
-            if (!s->startCompleted) {
-                s->startResult = r;
-                s->startCompleted = true;
-            }
-        }
-        s->startCv.notify_all();
-    };
+    HRESULT hr = build_capture_graph_rgb32(s, devCopy, format);
+    if (FAILED(hr)) {
+        dbg_printf("cds: build graph failed: %s\n", HResultToString(hr).c_str());
+    }
+    else if (!s->mc) {
+        dbg_printf("cds: IMediaControl missing after graph build\n");
+        hr = E_NOINTERFACE;
+    }
 
-    HRESULT hr = build_capture_graph_rgb32(s, devCopy, streamCapsIndex);
-    if (SUCCEEDED(hr)) {
-        if (!s->mc) {
-            signal_start(CDS_ERR_OPENING_DEVICE);
-            dbg_printf("cds: IMediaControl missing after graph build\n");
-            s->release_graph_thread_only();
-            CoUninitialize();
-            return;
+    bool paused = s->warm;
+    cds_result_t runResult = CDS_OK; // reported once the graph runs (a rejected format change)
+    while (SUCCEEDED(hr)) {
+        if (paused) {
+            // Paused, the graph has its buffers allocated and the stream open; Run is quick.
+            hr = s->mc->Pause();
+            if (FAILED(hr)) {
+                dbg_printf("cds: Pause failed: %s\n", HResultToString(hr).c_str());
+                break;
+            }
+            s->finish_phase(CDS_OK);
+            if (!wait_for_run(s)) break;
         }
 
         hr = s->mc->Run();
         if (FAILED(hr)) {
-            signal_start(CDS_ERR_OPENING_DEVICE);
             dbg_printf("cds: Run failed: %s\n", HResultToString(hr).c_str());
+            break;
         }
-        else {
-            signal_start(CDS_OK);
-            while (!s->stopRequested.load()) {
-                if (!s->useStillFallback && s->vcHasTrigger && s->videoCtrl && s->stillPinVC) {
-                    long mode = 0;
-                    HRESULT hrMode = s->videoCtrl->GetMode(s->stillPinVC, &mode);
-                    if (SUCCEEDED(hrMode)) {
-                        bool was = (s->lastVcMode & VideoControlFlag_Trigger) != 0;
-                        bool now = (mode & VideoControlFlag_Trigger) != 0;
-
-                        if (!was && now) {
-                            s->lastButtonTs100ns.store(now_ts100ns_utc());
-                            s->buttonEdge.store(true);
-                            dbg_printf("[UVC TRIGGER] rising edge\n");
-
-                            // Re-arm for devices that latch Trigger until cleared.
-                            long clearMode = mode & ~VideoControlFlag_Trigger;
-                            HRESULT hrClear = s->videoCtrl->SetMode(s->stillPinVC, clearMode);
-                            dbg_printf("IAMVideoControl::SetMode(clear trigger) => %s mode=0x%08lx\n",
-                                HResultToString(hrClear).c_str(), clearMode);
-                            if (SUCCEEDED(hrClear)) {
-                                long verifyMode = 0;
-                                HRESULT hrVerify = s->videoCtrl->GetMode(s->stillPinVC, &verifyMode);
-                                if (SUCCEEDED(hrVerify)) {
-                                    s->lastVcMode = verifyMode;
-                                    continue;
-                                }
-                                s->lastVcMode = clearMode;
-                                continue;
-                            }
-                        }
-
-                        s->lastVcMode = mode;
-                    }
-                }
-
-                Sleep(5);
+        s->finish_phase(runResult);
+        runResult = CDS_OK;
+
+        Win32SessionWaitSet waits(s->stopEvent, s->me);
+        const bool canPoll = !s->useStillFallback && s->vcHasTrigger && s->videoCtrl && s->stillPinVC;
+        run_session_loop(waits,
+            [&]() { return canPoll ? g_triggerPollMs.load(std::memory_order_relaxed) : 0u; },
+            [&]() { drain_media_events(s); },
+            [&]() { poll_uvc_trigger(s); });
+
+        if (s->formatChangeRequested.exchange(false)) {
+            ResetEvent(s->stopEvent); // the caller waits for the result before anything else
+            s->mc->Stop();
+            drain_media_events(s);
+            stop_mjpeg_decode_pool(s);
+            s->hasFrame.store(false); // grabs wait for the first frame in the new format
+
+            const DsFormat previous = s->format;
+            disconnect_capture_stream(s);
+            hr = connect_capture_stream(s, devCopy, s->pendingFormat);
+            if (FAILED(hr)) {
+                dbg_printf("cds: format change failed: %s, restoring the previous format\n", HResultToString(hr).c_str());
+                runResult = CDS_ERR_FORMAT_NOT_FOUND;
+                stop_mjpeg_decode_pool(s);
+                disconnect_capture_stream(s);
+                hr = connect_capture_stream(s, devCopy, previous);
             }
+            if (FAILED(hr)) break; // nothing left to run; cds_change_format stops the capture
+            paused = false;
+            continue;
+        }
 
+        if (!s->parkRequested.exchange(false)) {
             // SAFE STOP (same thread)
             s->mc->Stop();
-
-            // Drain events (optional)
-            if (s->me) {
-                long ev = 0;
-                LONG_PTR p1 = 0, p2 = 0;
-                while (s->me->GetEvent(&ev, &p1, &p2, 0) == S_OK) {
-                    s->me->FreeEventParams(ev, p1, p2);
-                }
-            }
+            drain_media_events(s);
+            break;
         }
-    }
-    else {
-        signal_start(CDS_ERR_OPENING_DEVICE);
-        dbg_printf("cds: build graph failed: %s\n", HResultToString(hr).c_str());
+        drain_media_events(s);
+        ResetEvent(s->stopEvent); // the caller waits for the pause before anything else
+        paused = true;
     }
 
+    // However the loop ended (stop, Run or Pause failing, a format change with nothing left to
+    // connect), the session is stopped from here on: waits return and later calls see it.
+    s->stopRequested.store(true);
+    s->notify_frame_waiters();
+    s->notify_button_waiters();
     // Ensure waiter is always released even on unexpected paths.
-    signal_start(CDS_ERR_OPENING_DEVICE);
+    s->finish_thread(CDS_ERR_OPENING_DEVICE);
 
     // FULL TEARDOWN (same thread)
     s->release_graph_thread_only();
     CoUninitialize();
 }
 
+// ---- Initialization (cds_initialize / cds_initialize_async) ----
+// Runs on its own thread: list devices (names are published right away), probe formats
+// in parallel, then publish the format lists and mark the API initialized.
+static std::mutex g_initMutex; // guards the g_init* state below; taken before g_dsMutex
+static std::condition_variable g_initCv;
+static int32_t g_initState = CDS_INIT_IDLE;
+static cds_result_t g_initResult = CDS_ERR_NOT_INITIALIZED;
+static std::thread g_initThread;
+static std::atomic<bool> g_initCancel{ false };
+static std::vector<std::pair<cds_init_callback, void*>> g_initCallbacks;
+static bool g_dsListed = false; // g_dsDevices holds the device list (formats may still be coming); under g_dsMutex
+
+static void set_init_state(int32_t state) {
+    {
+        std::lock_guard<std::mutex> lk(g_initMutex);
+        g_initState = state;
+    }
+    g_initCv.notify_all();
+}
+
+static cds_result_t run_initialization() {
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    bool didInit = SUCCEEDED(hr);
+    if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) return CDS_ERR_UNKNOWN;
+
+    std::vector<DsDevice> devices;
+    std::vector<bool> needsProbe;
+    hr = list_devices(devices, needsProbe);
+    if (FAILED(hr)) {
+        if (didInit) CoUninitialize();
+        return CDS_ERR_UNKNOWN;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(g_dsMutex);
+        if (!g_initCancel.load()) {
+            g_dsDevices = devices;
+            for (size_t i = 0; i < devices.size(); ++i)
+                if (needsProbe[i]) g_dsDevices[i].formats.clear();
+            g_dsListed = true;
+        }
+    }
+    set_init_state(CDS_INIT_PROBING);
+
+    probe_devices(devices, needsProbe, g_initCancel);
+    std::vector<std::string> present;
+    for (const DsDevice& d : devices) present.push_back(d.devicePathUtf8);
+    device_cache_save(present);
+    if (didInit) CoUninitialize();
+
+    std::lock_guard<std::mutex> lk(g_dsMutex);
+    if (g_initCancel.load()) return CDS_ERR_NOT_INITIALIZED;
+    g_dsDevices = std::move(devices);
+    g_dsInitialized = true;
+    ++g_dsGeneration;
+    return CDS_OK;
+}
+
+// Identity used to match devices across rescans: DevicePath, or the moniker name for
+// devices without one (virtual cameras).
+static std::string device_key(const DsDevice& d) {
+    return !d.devicePathUtf8.empty() ? d.devicePathUtf8 : WToUtf8(d.monikerDisplayNameW);
+}
+
+static std::mutex g_rescanMutex; // one cds_rescan at a time
+
+static void init_thread_main() {
+    cds_result_t rc = run_initialization();
+    std::vector<std::pair<cds_init_callback, void*>> callbacks;
+    {
+        std::lock_guard<std::mutex> lk(g_initMutex);
+        g_initState = rc == CDS_OK ? CDS_INIT_DONE : CDS_INIT_FAILED;
+        g_initResult = rc;
+        callbacks.swap(g_initCallbacks);
+    }
+    g_initCv.notify_all();
+    for (auto& cb : callbacks) cb.first(rc, cb.second);
+}
+
+// ---- Session start ----
+
+// Caller holds g_dsMutex. Validates a start/prepare request and copies what the session needs.
+static cds_result_t check_capture_request(uint32_t device_index, uint32_t format_index, uint32_t flags,
+    int32_t pixel_format, DsDevice& devCopy, DsFormat& format) {
+    if (pixel_format < CDS_PIXEL_BGRA || pixel_format > CDS_PIXEL_NV12) return CDS_ERR_UNSUPPORTED;
+    if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
+    if (device_index >= g_dsDevices.size() || !g_dsDevices[device_index].present) return CDS_ERR_DEVICE_NOT_FOUND;
+    if (session_published(device_index)) return CDS_ERR_ALREADY_STARTED;
+    if (device_index >= kMaxSessions) return CDS_ERR_UNSUPPORTED;
+    if (format_index >= g_dsDevices[device_index].formats.size()) return CDS_ERR_FORMAT_NOT_FOUND;
+    if ((flags & CDS_CAPTURE_ENCODED) && (flags & (CDS_CAPTURE_DECODE_POOL | CDS_CAPTURE_LAZY))) return CDS_ERR_UNSUPPORTED;
+    if ((flags & CDS_CAPTURE_ENCODED) &&
+        g_dsDevices[device_index].formats[format_index].subtype != MEDIASUBTYPE_MJPG) return CDS_ERR_FORMAT_NOT_FOUND;
+
+    devCopy = g_dsDevices[device_index];
+    format = g_dsDevices[device_index].formats[format_index];
+    return CDS_OK;
+}
+
+static bool prepared_matches(const DsSession* s, const DsFormat& format, uint32_t flags, int32_t pixel_format,
+    uint64_t generation) {
+    return s->generation == generation &&
+        s->format.width == format.width && s->format.height == format.height &&
+        s->format.maxFps == format.maxFps && s->format.subtype == format.subtype &&
+        s->format.streamCapsIndex == format.streamCapsIndex &&
+        s->captureFlags == flags && (s->encoded || (int32_t)s->outFormat == pixel_format);
+}
+
+// Creates a session and waits until its graph runs (warm: until it is built and paused).
+static cds_result_t launch_session(const DsDevice& dev, const DsFormat& format, uint32_t flags, int32_t pixel_format,
+    bool warm, uint64_t generation, DsSession** out) {
+    DsSession* s = new(std::nothrow) DsSession();
+    if (!s) return CDS_ERR_UNKNOWN;
+    s->captureFlags = flags;
+    s->encoded = (flags & CDS_CAPTURE_ENCODED) != 0;
+    s->decodeMjpeg = (flags & CDS_CAPTURE_DECODE_POOL) != 0;
+    s->lazy = (flags & CDS_CAPTURE_LAZY) != 0;
+    s->outFormat = (OutFormat)pixel_format;
+    s->warm = warm;
+    s->generation = generation;
+
+    s->stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    s->runEvent = CreateEventW(nullptr, FALSE, FALSE, nullptr);
+    if (!s->stopEvent || !s->runEvent) {
+        delete s;
+        return CDS_ERR_UNKNOWN;
+    }
+    try {
+        s->worker = std::thread(session_thread_main, s, dev, format);
+    }
+    catch (...) {
+        delete s;
+        return CDS_ERR_UNKNOWN;
+    }
+
+    cds_result_t rc = s->wait_phase();
+    if (rc != CDS_OK) {
+        discard_session(s);
+        return rc;
+    }
+    *out = s;
+    return CDS_OK;
+}
+
+// cds_grab_history_frame / cds_grab_history_frame_at: look up by sequence number or arrival time.
+static cds_result_t grab_history_frame(uint32_t device_index, bool bySeq, uint64_t key,
+    uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+    if (info) {
+        memset(info, 0, sizeof(*info));
+        info->sample_time_100ns = -1;
+    }
+    SessionRef s(device_index);
+    if (!s) return CDS_ERR_NOT_STARTED;
+    if (!buffer) return CDS_ERR_BUF_NULL;
+
+    std::shared_ptr<FrameData> fd = bySeq ? s->history.find_seq(key) : s->history.find_arrival(key);
+    if (!fd) return CDS_ERR_READ_FRAME;
+    return copy_frame_out(s, *fd, buffer, available_bytes, info);
+}
+
+// ---- Multi-camera grab (cds_grab_frames_multi) ----
+// One camera's frame: the pinned latest slot, or a history entry when that is closer in time.
+struct MultiGrabPick {
+    DsSession* s = nullptr; // referenced
+    int32_t slot = -1;      // pinned
+    std::shared_ptr<FrameData> held;
+    const FrameData* fd = nullptr;
+    cds_result_t rc = CDS_ERR_READ_FRAME;
+};
+
+static uint64_t abs_diff(uint64_t a, uint64_t b) { return a > b ? a - b : b - a; }
+
+// Picks the frame set with the closest arrival times: the camera whose newest frame is
+// oldest sets the reference, every other camera contributes its frame nearest to it.
+static cds_result_t pick_multi_frames(std::vector<MultiGrabPick>& picks) {
+    uint64_t reference = UINT64_MAX;
+    for (MultiGrabPick& p : picks) {
+        if (!p.s->hasFrame.load()) return CDS_ERR_READ_FRAME;
+        p.slot = p.s->frames.pin_latest();
+        if (p.slot < 0) return CDS_ERR_READ_FRAME;
+        p.fd = &p.s->frames.slots[p.slot];
+        reference = (std::min)(reference, p.fd->arrivalMono100ns);
+    }
+    for (MultiGrabPick& p : picks) {
+        std::shared_ptr<FrameData> older = p.s->history.find_nearest(reference);
+        if (older && abs_diff(older->arrivalMono100ns, reference) < abs_diff(p.fd->arrivalMono100ns, reference)) {
+            p.s->frames.unpin(p.slot);
+            p.slot = -1;
+            p.held = std::move(older);
+            p.fd = p.held.get();
+        }
+    }
+    return CDS_OK;
+}
+
 // =============================================================================
 // ============================== C API Exports ===============================
 // =============================================================================
@@ -1298,42 +3213,180 @@ extern "C" {
     // -------------------- cds_* exports --------------------
 
     SP_API cds_result_t SP_CALL cds_initialize(void) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (g_dsInitialized) return CDS_OK;
+        cds_result_t rc = cds_initialize_async(nullptr, nullptr);
+        if (rc != CDS_OK) return rc;
+        return cds_wait_initialized(CDS_WAIT_INFINITE);
+    }
+
+    SP_API cds_result_t SP_CALL cds_initialize_async(cds_init_callback on_done, void* user_data) {
+        bool alreadyDone = false;
+        {
+            std::lock_guard<std::mutex> lk(g_initMutex);
+            {
+                std::lock_guard<std::mutex> dlk(g_dsMutex);
+                alreadyDone = g_dsInitialized;
+            }
+            if (!alreadyDone) {
+                if (on_done) g_initCallbacks.emplace_back(on_done, user_data);
+                if (g_initState != CDS_INIT_LISTING && g_initState != CDS_INIT_PROBING) {
+                    if (g_initThread.joinable()) g_initThread.join(); // previous run, already finished
+                    g_initCancel.store(false);
+                    g_initState = CDS_INIT_LISTING;
+                    g_initResult = CDS_ERR_NOT_INITIALIZED;
+                    try {
+                        g_initThread = std::thread(init_thread_main);
+                    }
+                    catch (...) {
+                        g_initState = CDS_INIT_FAILED;
+                        g_initResult = CDS_ERR_UNKNOWN;
+                        g_initCallbacks.clear();
+                        return CDS_ERR_UNKNOWN;
+                    }
+                }
+            }
+        }
+        if (alreadyDone && on_done) on_done(CDS_OK, user_data);
+        return CDS_OK;
+    }
+
+    SP_API cds_result_t SP_CALL cds_rescan(uint32_t* out_added, uint32_t* out_removed) {
+        if (out_added) *out_added = 0;
+        if (out_removed) *out_removed = 0;
+        std::lock_guard<std::mutex> rescanLk(g_rescanMutex);
+
+        std::map<std::string, uint64_t> known; // key -> fingerprint
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lk(g_dsMutex);
+            if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
+            generation = g_dsGeneration;
+            for (const DsDevice& d : g_dsDevices) known[device_key(d)] = d.fingerprint;
+        }
 
         HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
         bool didInit = SUCCEEDED(hr);
-        if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) {
-            return CDS_ERR_UNKNOWN;
-        }
+        if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) return CDS_ERR_UNKNOWN;
 
-        hr = enumerate_devices_and_formats();
+        std::vector<DsDevice> listed;
+        std::vector<bool> probe;
+        hr = list_devices(listed, probe);
         if (FAILED(hr)) {
             if (didInit) CoUninitialize();
             return CDS_ERR_UNKNOWN;
         }
-
+        // Known devices with the same driver/firmware keep the formats they have.
+        for (size_t i = 0; i < listed.size(); ++i) {
+            auto it = known.find(device_key(listed[i]));
+            if (it != known.end() && it->second == listed[i].fingerprint) probe[i] = false;
+        }
+        // Formats that were just probed, or cached for a device whose driver changed.
+        std::vector<bool> replaceFormats(listed.size());
+        for (size_t i = 0; i < listed.size(); ++i) {
+            auto it = known.find(device_key(listed[i]));
+            replaceFormats[i] = probe[i] || (it != known.end() && it->second != listed[i].fingerprint);
+        }
+        std::atomic<bool> noCancel{ false };
+        probe_devices(listed, probe, noCancel);
+        std::vector<std::string> present;
+        for (const DsDevice& d : listed) present.push_back(d.devicePathUtf8);
+        device_cache_save(present);
         if (didInit) CoUninitialize();
-        g_dsInitialized = true;
-        ++g_dsGeneration;
+
+        std::lock_guard<std::mutex> lk(g_dsMutex);
+        if (!g_dsInitialized || generation != g_dsGeneration) return CDS_ERR_NOT_INITIALIZED; // shut down meanwhile
+
+        std::vector<bool> seen(g_dsDevices.size(), false);
+        uint32_t added = 0, removed = 0;
+        for (size_t i = 0; i < listed.size(); ++i) {
+            DsDevice& l = listed[i];
+            std::string key = device_key(l);
+            size_t idx = 0;
+            while (idx < g_dsDevices.size() && device_key(g_dsDevices[idx]) != key) ++idx;
+
+            if (idx == g_dsDevices.size()) { // new device: next free index
+                g_dsDevices.push_back(std::move(l));
+                seen.push_back(true);
+                ++added;
+                continue;
+            }
+
+            DsDevice& d = g_dsDevices[idx];
+            seen[idx] = true;
+            if (!d.present) ++added; // came back: same index as before
+            d.present = true;
+            d.monikerDisplayNameW = l.monikerDisplayNameW;
+            // A running session keeps its format list (format indices stay meaningful).
+            if (replaceFormats[i] && !session_published((uint32_t)idx)) {
+                d.formats = std::move(l.formats);
+                d.fingerprint = l.fingerprint;
+                d.formatsFromCache = l.formatsFromCache;
+            }
+        }
+        for (size_t idx = 0; idx < seen.size(); ++idx) {
+            if (!seen[idx] && g_dsDevices[idx].present) {
+                g_dsDevices[idx].present = false;
+                ++removed;
+            }
+        }
+        if (added || removed) dbg_printf("cds: rescan: %u added, %u removed\n", added, removed);
+        if (out_added) *out_added = added;
+        if (out_removed) *out_removed = removed;
         return CDS_OK;
     }
 
+    SP_API cds_result_t SP_CALL cds_wait_initialized(uint32_t timeout_ms) {
+        std::unique_lock<std::mutex> lk(g_initMutex);
+        auto finished = [&]() { return g_initState != CDS_INIT_LISTING && g_initState != CDS_INIT_PROBING; };
+        if (timeout_ms == CDS_WAIT_INFINITE) g_initCv.wait(lk, finished);
+        else if (!g_initCv.wait_for(lk, std::chrono::milliseconds(timeout_ms), finished)) return CDS_ERR_TIMEOUT;
+        return g_initState == CDS_INIT_IDLE ? CDS_ERR_NOT_INITIALIZED : g_initResult;
+    }
+
+    SP_API int32_t SP_CALL cds_initialize_status(void) {
+        std::lock_guard<std::mutex> lk(g_initMutex);
+        return g_initState;
+    }
+
     SP_API void SP_CALL cds_shutdown_capture_api(void) {
+        // Abandon a running initialization; probing stops after the devices in flight.
+        std::thread initThread;
+        {
+            std::lock_guard<std::mutex> lk(g_initMutex);
+            g_initCancel.store(true);
+            initThread = std::move(g_initThread);
+        }
+        if (initThread.joinable()) {
+            if (initThread.get_id() == std::this_thread::get_id()) initThread.detach(); // from an init callback
+            else initThread.join();
+        }
+        {
+            std::lock_guard<std::mutex> lk(g_initMutex);
+            g_initState = CDS_INIT_IDLE;
+            g_initResult = CDS_ERR_NOT_INITIALIZED;
+            g_initCallbacks.clear();
+        }
+        g_initCv.notify_all();
+
         // Stop all sessions first (outside lock join)
         std::vector<uint32_t> toStop;
+        std::vector<DsSession*> prepared;
         {
             std::lock_guard<std::mutex> lk(g_dsMutex);
             g_dsInitialized = false;
+            g_dsListed = false;
             ++g_dsGeneration;
-            for (auto& kv : g_dsSessions) toStop.push_back(kv.first);
+            for (uint32_t i = 0; i < kMaxSessions; ++i) {
+                if (session_published(i)) toStop.push_back(i);
+                if (g_dsPrepared[i]) prepared.push_back(g_dsPrepared[i]);
+                g_dsPrepared[i] = nullptr;
+            }
         }
         for (auto idx : toStop) {
             cds_stop_capture(idx);
         }
+        for (DsSession* s : prepared) discard_session(s);
 
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        g_dsSessions.clear();
         g_dsDevices.clear();
         g_dsInitialized = false;
     }
@@ -1342,47 +3395,104 @@ extern "C" {
         g_logOverride.store(enabled ? 1 : 0, std::memory_order_relaxed);
     }
 
+    SP_API uint64_t SP_CALL cds_now_100ns(void) {
+        return now_ts100ns_monotonic();
+    }
+
+    SP_API void SP_CALL cds_set_mjpeg_decode_threads(int32_t threads) {
+        g_mjpegDecodeThreads.store(threads < 0 ? 0 : threads, std::memory_order_relaxed);
+    }
+
+    SP_API void SP_CALL cds_set_device_cache_path(const char* path_utf8) {
+        std::lock_guard<std::mutex> lk(g_devCacheMutex);
+        g_devCachePathSet = path_utf8 != nullptr;
+        g_devCachePath = path_utf8 ? Utf8ToW(path_utf8) : std::wstring();
+        g_devCacheLoaded = false; // read the new file on the next cds_initialize
+        g_devCacheDirty = false;
+    }
+
+    SP_API void SP_CALL cds_refresh_device_cache(void) {
+        // Nothing is probed here: stale entries are re-read lazily, at each camera's next capture
+        // start (connect_capture_stream). Saved with the flag by the next cds_initialize/cds_rescan.
+        device_cache_load();
+        std::lock_guard<std::mutex> lk(g_devCacheMutex);
+        for (auto& kv : g_devCache) kv.second.stale = true;
+        if (!g_devCache.empty()) g_devCacheDirty = true;
+    }
+
+    SP_API void SP_CALL cds_set_trigger_poll_interval(uint32_t ms) {
+        if (ms == 0) ms = kDefaultTriggerPollMs;
+        g_triggerPollMs.store((std::min)(ms, kMaxTriggerPollMs), std::memory_order_relaxed);
+    }
+
     SP_API int32_t SP_CALL cds_devices_count(void) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (!g_dsInitialized) return 0;
+        if (!g_dsListed) return 0;
         return (int32_t)g_dsDevices.size();
     }
 
     SP_API size_t SP_CALL cds_device_name(int32_t device_index, char* buf, size_t buf_len) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (!g_dsInitialized) return 0;
+        if (!g_dsListed) return 0;
         if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return 0;
         return copy_str(g_dsDevices[(size_t)device_index].nameUtf8, buf, buf_len);
     }
 
     SP_API size_t SP_CALL cds_device_unique_id(int32_t device_index, char* buf, size_t buf_len) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (!g_dsInitialized) return 0;
+        if (!g_dsListed) return 0;
         if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return 0;
         return copy_str(g_dsDevices[(size_t)device_index].devicePathUtf8, buf, buf_len);
     }
 
     SP_API size_t SP_CALL cds_device_model_id(int32_t device_index, char* buf, size_t buf_len) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (!g_dsInitialized) return 0;
+        if (!g_dsListed) return 0;
         if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return 0;
         return copy_str(g_dsDevices[(size_t)device_index].modelIdUtf8, buf, buf_len);
     }
 
+    SP_API int32_t SP_CALL cds_device_present(int32_t device_index) {
+        std::lock_guard<std::mutex> lk(g_dsMutex);
+        if (!g_dsListed) return 0;
+        if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return 0;
+        return g_dsDevices[(size_t)device_index].present ? 1 : 0;
+    }
+
     SP_API int32_t SP_CALL cds_device_vid(int32_t device_index) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (!g_dsInitialized) return 0;
+        if (!g_dsListed) return 0;
         if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return 0;
         return g_dsDevices[(size_t)device_index].vid;
     }
 
     SP_API int32_t SP_CALL cds_device_pid(int32_t device_index) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
-        if (!g_dsInitialized) return 0;
+        if (!g_dsListed) return 0;
         if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return 0;
         return g_dsDevices[(size_t)device_index].pid;
     }
 
+    SP_API int32_t SP_CALL cds_devices_table(cds_device_info* out, int32_t capacity) {
+        std::lock_guard<std::mutex> lk(g_dsMutex);
+        if (!g_dsListed) return 0;
+        if (out) {
+            size_t n = capacity > 0 ? (std::min)((size_t)capacity, g_dsDevices.size()) : 0;
+            for (size_t i = 0; i < n; ++i) {
+                const DsDevice& d = g_dsDevices[i];
+                cds_device_info& o = out[i];
+                copy_str(d.nameUtf8, o.name, sizeof(o.name));
+                copy_str(d.devicePathUtf8, o.unique_id, sizeof(o.unique_id));
+                copy_str(d.modelIdUtf8, o.model_id, sizeof(o.model_id));
+                o.vid = d.vid;
+                o.pid = d.pid;
+                o.formats_count = g_dsInitialized ? (int32_t)d.formats.size() : -1;
+                o.present = d.present ? 1 : 0;
+            }
+        }
+        return (int32_t)g_dsDevices.size();
+    }
+
     SP_API int32_t SP_CALL cds_device_formats_count(int32_t device_index) {
         std::lock_guard<std::mutex> lk(g_dsMutex);
         if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
@@ -1429,13 +3539,35 @@ extern "C" {
         return copy_str(GuidToStr(v[(size_t)format_index].subtype), buf, buf_len);
     }
 
+    SP_API int32_t SP_CALL cds_device_formats_table(int32_t device_index, cds_format_info* out, int32_t capacity) {
+        std::lock_guard<std::mutex> lk(g_dsMutex);
+        if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
+        if (device_index < 0 || (size_t)device_index >= g_dsDevices.size()) return CDS_ERR_DEVICE_NOT_FOUND;
+        const auto& v = g_dsDevices[(size_t)device_index].formats;
+        if (out) {
+            size_t n = capacity > 0 ? (std::min)((size_t)capacity, v.size()) : 0;
+            for (size_t i = 0; i < n; ++i) {
+                const DsFormat& f = v[i];
+                cds_format_info& o = out[i];
+                o.width = f.width;
+                o.height = f.height;
+                o.max_fps = f.maxFps;
+                o.fourcc = SubTypeFourcc(f.subtype);
+                o.stream_caps_index = f.streamCapsIndex;
+                const char* name = SubTypeName(f.subtype);
+                copy_str(name ? name : "", o.type, sizeof(o.type));
+            }
+        }
+        return (int32_t)v.size();
+    }
+
     SP_API cds_result_t SP_CALL cds_start_capture(uint32_t device_index, uint32_t width, uint32_t height) {
         uint32_t bestFormatIndex = UINT32_MAX;
         {
             std::lock_guard<std::mutex> lk(g_dsMutex);
             if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
             if (device_index >= g_dsDevices.size()) return CDS_ERR_DEVICE_NOT_FOUND;
-            if (g_dsSessions.count(device_index)) return CDS_ERR_ALREADY_STARTED;
+            if (session_published(device_index)) return CDS_ERR_ALREADY_STARTED;
 
             auto& fmts = g_dsDevices[device_index].formats;
 
@@ -1466,46 +3598,40 @@ extern "C" {
     }
 
     SP_API cds_result_t SP_CALL cds_start_capture_with_format(uint32_t device_index, uint32_t format_index) {
+        return cds_start_capture_ex(device_index, format_index, 0, CDS_PIXEL_BGRA);
+    }
+
+    SP_API cds_result_t SP_CALL cds_start_capture_ex(uint32_t device_index, uint32_t format_index, uint32_t flags, int32_t pixel_format) {
         DsDevice devCopy;
-        uint32_t streamCapsIndex = 0;
+        DsFormat format;
         uint64_t generationSnapshot = 0;
+        DsSession* warm = nullptr;
 
         {
             std::lock_guard<std::mutex> lk(g_dsMutex);
-            if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
-            if (device_index >= g_dsDevices.size()) return CDS_ERR_DEVICE_NOT_FOUND;
-            if (g_dsSessions.count(device_index)) return CDS_ERR_ALREADY_STARTED;
-            if (format_index >= g_dsDevices[device_index].formats.size()) return CDS_ERR_FORMAT_NOT_FOUND;
-
+            cds_result_t rc = check_capture_request(device_index, format_index, flags, pixel_format, devCopy, format);
+            if (rc != CDS_OK) return rc;
             generationSnapshot = g_dsGeneration;
-            devCopy = g_dsDevices[device_index];
-            streamCapsIndex = g_dsDevices[device_index].formats[format_index].streamCapsIndex;
-        }
-
-        DsSession* s = new(std::nothrow) DsSession();
-        if (!s) return CDS_ERR_UNKNOWN;
-
-        s->stopRequested.store(false);
-        try {
-            s->worker = std::thread(session_thread_main, s, devCopy, streamCapsIndex);
-        }
-        catch (...) {
-            delete s;
-            return CDS_ERR_UNKNOWN;
+            warm = g_dsPrepared[device_index];
+            g_dsPrepared[device_index] = nullptr;
         }
 
-        cds_result_t startRc = CDS_ERR_UNKNOWN;
-        {
-            std::unique_lock<std::mutex> lk(s->startMutex);
-            s->startCv.wait(lk, [&]() { return s->startCompleted; });
-            startRc = s->startResult;
+        // A paused graph built for the same request only needs Run; any other is dropped.
+        DsSession* s = nullptr;
+        if (warm) {
+            if (prepared_matches(warm, format, flags, pixel_format, generationSnapshot) && warm->begin_phase()) {
+                warm->stopRequested.store(false);
+                warm->hasFrame.store(false); // nothing from an earlier run; waits check it (latestSeq carries over)
+                warm->stats.reset();
+                SetEvent(warm->runEvent);
+                if (warm->wait_phase() == CDS_OK) s = warm;
+                else dbg_printf("cds: warm start failed, building the graph again\n");
+            }
+            if (!s) discard_session(warm);
         }
-
-        if (startRc != CDS_OK) {
-            s->stopRequested.store(true);
-            if (s->worker.joinable()) s->worker.join();
-            delete s;
-            return startRc;
+        if (!s) {
+            cds_result_t startRc = launch_session(devCopy, format, flags, pixel_format, false, generationSnapshot, &s);
+            if (startRc != CDS_OK) return startRc;
         }
 
         bool rejectedNotInitialized = false;
@@ -1515,101 +3641,629 @@ extern "C" {
             if (!g_dsInitialized || generationSnapshot != g_dsGeneration) {
                 rejectedNotInitialized = true;
             }
-            else if (g_dsSessions.count(device_index)) {
+            else if (session_published(device_index)) {
                 rejectedAlreadyStarted = true;
             }
             else {
-                g_dsSessions[device_index] = s;
+                g_dsSessions[device_index].session.store(s); // hands over the initial reference
             }
         }
         if (rejectedNotInitialized || rejectedAlreadyStarted) {
-            s->stopRequested.store(true);
-            if (s->worker.joinable()) s->worker.join();
-            delete s;
+            discard_session(s);
             return rejectedNotInitialized ? CDS_ERR_NOT_INITIALIZED : CDS_ERR_ALREADY_STARTED;
         }
 
         return CDS_OK;
     }
 
-    SP_API cds_result_t SP_CALL cds_stop_capture(uint32_t device_index) {
+    SP_API cds_result_t SP_CALL cds_prepare_capture(uint32_t device_index, uint32_t format_index, uint32_t flags, int32_t pixel_format) {
+        DsDevice devCopy;
+        DsFormat format;
+        uint64_t generationSnapshot = 0;
+        DsSession* old = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lk(g_dsMutex);
+            cds_result_t rc = check_capture_request(device_index, format_index, flags, pixel_format, devCopy, format);
+            if (rc != CDS_OK) return rc;
+            generationSnapshot = g_dsGeneration;
+            old = g_dsPrepared[device_index];
+            if (old && prepared_matches(old, format, flags, pixel_format, generationSnapshot)) return CDS_OK;
+            g_dsPrepared[device_index] = nullptr;
+        }
+        if (old) discard_session(old);
+
+        DsSession* s = nullptr;
+        cds_result_t rc = launch_session(devCopy, format, flags, pixel_format, true, generationSnapshot, &s);
+        if (rc != CDS_OK) return rc;
+
+        {
+            std::lock_guard<std::mutex> lk(g_dsMutex);
+            if (!g_dsInitialized || generationSnapshot != g_dsGeneration) rc = CDS_ERR_NOT_INITIALIZED;
+            else if (session_published(device_index)) rc = CDS_ERR_ALREADY_STARTED;
+            else {
+                old = g_dsPrepared[device_index]; // a concurrent prepare; the newer one wins
+                g_dsPrepared[device_index] = s;
+                s = nullptr;
+            }
+        }
+        if (s) discard_session(s);
+        if (old) discard_session(old);
+        return rc;
+    }
+
+    SP_API cds_result_t SP_CALL cds_unprepare_capture(uint32_t device_index) {
+        DsSession* s = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(g_dsMutex);
+            if (device_index >= kMaxSessions || !g_dsPrepared[device_index]) return CDS_ERR_NOT_STARTED;
+            s = g_dsPrepared[device_index];
+            g_dsPrepared[device_index] = nullptr;
+        }
+        discard_session(s);
+        return CDS_OK;
+    }
+
+    SP_API cds_result_t SP_CALL cds_stop_capture_ex(uint32_t device_index, uint32_t flags) {
         DsSession* s = nullptr;
         {
             std::lock_guard<std::mutex> lk(g_dsMutex);
-            auto it = g_dsSessions.find(device_index);
-            if (it == g_dsSessions.end()) return CDS_ERR_NOT_STARTED;
-            s = it->second;
-            g_dsSessions.erase(it);
+            s = unpublish_session(device_index);
+            if (!s) return CDS_ERR_NOT_STARTED;
+        }
+
+        std::unique_lock<std::mutex> ctl(s->controlMutex); // lets a format change in progress finish
+        // Only a session thread that is still running can park; one that has exited (Run
+        // failed, say) is joined and discarded as without the flag.
+        bool park = (flags & CDS_STOP_KEEP_PREPARED) != 0;
+        if (park) {
+            s->parkRequested.store(true);
+            park = s->begin_phase();
+        }
+        s->request_stop();
+        s->notify_frame_waiters();
+        s->notify_button_waiters();
+        const bool parked = park && s->wait_phase() == CDS_OK;
+        if (!parked && s->worker.joinable()) s->worker.join();
+        {
+            std::lock_guard<std::mutex> lk(s->callbackMutex);
+            stop_delivery_thread(s);
+        }
+        ctl.unlock();
+
+        if (parked) {
+            DsSession* old = nullptr;
+            {
+                std::lock_guard<std::mutex> lk(g_dsMutex);
+                if (g_dsInitialized && s->generation == g_dsGeneration) {
+                    old = g_dsPrepared[device_index];
+                    g_dsPrepared[device_index] = s;
+                    s = nullptr;
+                }
+            }
+            if (old) discard_session(old);
+            if (s) discard_session(s); // shut down meanwhile
+            return CDS_OK;
+        }
+        release_session_ref(s);
+        return CDS_OK;
+    }
+
+    SP_API cds_result_t SP_CALL cds_stop_capture(uint32_t device_index) {
+        return cds_stop_capture_ex(device_index, 0);
+    }
+
+    SP_API cds_result_t SP_CALL cds_change_format(uint32_t device_index, uint32_t format_index) {
+        DsFormat format;
+        {
+            std::lock_guard<std::mutex> lk(g_dsMutex);
+            if (!g_dsInitialized) return CDS_ERR_NOT_INITIALIZED;
+            if (device_index >= g_dsDevices.size() || !g_dsDevices[device_index].present) return CDS_ERR_DEVICE_NOT_FOUND;
+            if (format_index >= g_dsDevices[device_index].formats.size()) return CDS_ERR_FORMAT_NOT_FOUND;
+            format = g_dsDevices[device_index].formats[format_index];
         }
 
-        s->stopRequested.store(true);
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        if (s->encoded && format.subtype != MEDIASUBTYPE_MJPG) return CDS_ERR_FORMAT_NOT_FOUND;
+
+        std::lock_guard<std::mutex> ctl(s->controlMutex);
+        if (s->stopRequested.load()) return CDS_ERR_NOT_STARTED;
+        if (s->format.streamCapsIndex == format.streamCapsIndex && s->format.subtype == format.subtype &&
+            s->format.width == format.width && s->format.height == format.height) return CDS_OK;
+
+        // The session thread stops the graph, reconnects the capture pin and runs it again.
+        s->pendingFormat = format;
+        if (!s->begin_phase()) return CDS_ERR_NOT_STARTED; // the session thread has just exited
+        s->formatChangeRequested.store(true);
+        SetEvent(s->stopEvent);
+        cds_result_t rc = s->wait_phase();
+        if (rc == CDS_OK || !s->stopRequested.load()) return rc;
+
+        // Neither format could be connected (or the graph would not run again) and the session
+        // thread has exited: stop the capture as cds_stop_capture would, so the device can be
+        // started again. A concurrent cds_stop_capture that unpublished it first finishes the job.
+        {
+            std::lock_guard<std::mutex> lk(s->callbackMutex);
+            // Can't join ourselves from inside the callback: stays listed, stopped, until cds_stop_capture.
+            if (std::this_thread::get_id() == s->deliveryThreadId) return CDS_ERR_OPENING_DEVICE;
+            stop_delivery_thread(s);
+        }
+        DsSession* owned = nullptr;
+        {
+            std::lock_guard<std::mutex> lk(g_dsMutex);
+            owned = unpublish_session_if(device_index, s.get());
+        }
         if (s->worker.joinable()) s->worker.join();
-        delete s;
+        release_session_ref(owned);
+        return CDS_ERR_OPENING_DEVICE;
+    }
+
+    SP_API cds_result_t SP_CALL cds_set_frame_callback(uint32_t device_index, cds_frame_callback fn, void* user_data) {
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        if (s->encoded && fn) return CDS_ERR_UNSUPPORTED;
+
+        cds_result_t rc = CDS_OK;
+        {
+            std::lock_guard<std::mutex> lk(s->callbackMutex);
+            if (std::this_thread::get_id() == s->deliveryThreadId) {
+                rc = CDS_ERR_UNKNOWN; // can't join ourselves from inside the callback
+            }
+            else {
+                stop_delivery_thread(s);
+                if (fn && !s->stopRequested.load()) {
+                    try {
+                        s->deliveryThread = std::thread(delivery_thread_main, s.get(), device_index, fn, user_data);
+                        s->deliveryThreadId = s->deliveryThread.get_id();
+                    }
+                    catch (...) {
+                        rc = CDS_ERR_UNKNOWN;
+                    }
+                }
+            }
+        }
+        return rc;
+    }
+
+    SP_API cds_result_t SP_CALL cds_set_frame_callback_policy(uint32_t device_index, int32_t policy) {
+        if (policy != CDS_CALLBACK_COALESCE && policy != CDS_CALLBACK_DROP) return CDS_ERR_INVALID_ARG;
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        s->callbackPolicy.store(policy, std::memory_order_relaxed);
         return CDS_OK;
     }
 
     SP_API int32_t SP_CALL cds_has_first_frame(uint32_t device_index) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return 0;
-        return it->second->hasFrame.load() ? 1 : 0;
+        SessionRef s(device_index);
+        if (!s) return 0;
+        return s->hasFrame.load() ? 1 : 0;
+    }
+
+    SP_API cds_result_t SP_CALL cds_wait_for_frame(uint32_t device_index, uint64_t last_seq, uint32_t timeout_ms) {
+        SessionRef s(device_index); // outlives a concurrent cds_stop_capture
+        if (!s) return CDS_ERR_NOT_STARTED;
+
+        s->frameWaiters.fetch_add(1);
+        bool ready = false;
+        {
+            std::unique_lock<std::mutex> lk(s->frameWaitMutex);
+            auto pred = [&]() { return s->has_frame_after(last_seq) || s->stopRequested.load(); };
+            if (timeout_ms == CDS_WAIT_INFINITE) {
+                s->frameCv.wait(lk, pred);
+                ready = true;
+            }
+            else {
+                ready = s->frameCv.wait_for(lk, std::chrono::milliseconds(timeout_ms), pred);
+            }
+        }
+        s->frameWaiters.fetch_sub(1);
+
+        cds_result_t rc = CDS_OK;
+        if (s->stopRequested.load()) rc = CDS_ERR_NOT_STARTED;
+        else if (!ready) rc = CDS_ERR_TIMEOUT;
+        return rc;
     }
 
     SP_API cds_result_t SP_CALL cds_grab_frame(uint32_t device_index, uint8_t* buffer, size_t available_bytes) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return CDS_ERR_NOT_STARTED;
-        DsSession* s = it->second;
+        return cds_grab_frame_seq(device_index, buffer, available_bytes, nullptr);
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_frame_seq(uint32_t device_index, uint8_t* buffer, size_t available_bytes, uint64_t* out_seq) {
+        cds_frame_info info{};
+        cds_result_t rc = cds_grab_frame_ex(device_index, buffer, available_bytes, &info);
+        if (out_seq) *out_seq = info.sequence;
+        return rc;
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_frame_ex(uint32_t device_index, uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+        if (info) {
+            memset(info, 0, sizeof(*info));
+            info->sample_time_100ns = -1;
+        }
+        const uint64_t enter100ns = now_ts100ns_monotonic();
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+
+        if (!buffer) return CDS_ERR_BUF_NULL;
+        if (s->encoded) return CDS_ERR_UNSUPPORTED;
+
+        FrameGeometry g = s->current_geometry();
+        if (g.out.frameBytes == 0) return CDS_ERR_READ_FRAME;
+        if (available_bytes < g.out.frameBytes) return CDS_ERR_BUF_TOO_SMALL;
+
+        if (!s->hasFrame.load()) return CDS_ERR_READ_FRAME;
+        int32_t slot = s->frames.pin_latest();
+        if (slot < 0) return CDS_ERR_READ_FRAME;
+        SessionStats::add(s->stats.readerWait100ns, now_ts100ns_monotonic() - enter100ns);
+
+        cds_result_t rc = copy_pinned_frame(s, slot, buffer, available_bytes, info);
+        s->frames.unpin(slot);
+        return rc;
+    }
+
+    SP_API cds_result_t SP_CALL cds_set_history(uint32_t device_index, uint32_t max_frames, uint64_t max_bytes) {
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        s->history.configure(max_frames, max_bytes);
+        return CDS_OK;
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_frames_multi(const uint32_t* device_indices, uint32_t count,
+        uint8_t* const* buffers, const size_t* available_bytes, cds_frame_info* infos, uint64_t* out_max_skew_100ns) {
+        if (out_max_skew_100ns) *out_max_skew_100ns = 0;
+        if (infos) {
+            for (uint32_t i = 0; i < count; ++i) {
+                memset(&infos[i], 0, sizeof(infos[i]));
+                infos[i].sample_time_100ns = -1;
+            }
+        }
+        if (!device_indices || !available_bytes || count == 0 || count > kMaxSessions) return CDS_ERR_INVALID_ARG;
+        if (!buffers) return CDS_ERR_BUF_NULL;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (!buffers[i]) return CDS_ERR_BUF_NULL;
+            for (uint32_t j = 0; j < i; ++j)
+                if (device_indices[j] == device_indices[i]) return CDS_ERR_INVALID_ARG;
+        }
+
+        std::vector<MultiGrabPick> picks(count);
+        auto release_all = [&]() {
+            for (MultiGrabPick& p : picks) {
+                if (p.slot >= 0) p.s->frames.unpin(p.slot);
+                p.held.reset();
+                release_session_ref(p.s);
+            }
+        };
+        for (uint32_t i = 0; i < count; ++i) {
+            picks[i].s = acquire_session(device_indices[i]);
+            if (!picks[i].s) {
+                release_all();
+                return CDS_ERR_NOT_STARTED;
+            }
+        }
+
+        uint64_t enter100ns = now_ts100ns_monotonic();
+        cds_result_t rc = pick_multi_frames(picks);
+        if (rc != CDS_OK) {
+            release_all();
+            return rc;
+        }
+
+        uint64_t oldest = UINT64_MAX, newest = 0;
+        for (MultiGrabPick& p : picks) {
+            oldest = (std::min)(oldest, p.fd->arrivalMono100ns);
+            newest = (std::max)(newest, p.fd->arrivalMono100ns);
+            SessionStats::add(p.s->stats.readerWait100ns, now_ts100ns_monotonic() - enter100ns);
+        }
+
+        // Copied one after another on the caller's thread; the frames stay pinned or held
+        // meanwhile, so later copies still get the frames that were picked.
+        for (uint32_t i = 0; i < count; ++i) {
+            MultiGrabPick& p = picks[i];
+            p.rc = copy_frame_out(p.s, *p.fd, buffers[i], available_bytes[i], infos ? &infos[i] : nullptr);
+            if (p.rc == CDS_OK) p.s->stats.record_grab(p.fd->seq);
+        }
+
+        rc = CDS_OK;
+        for (MultiGrabPick& p : picks) {
+            if (p.rc != CDS_OK) {
+                rc = p.rc;
+                break;
+            }
+        }
+        if (out_max_skew_100ns) *out_max_skew_100ns = newest - oldest;
+        release_all();
+        return rc;
+    }
+
+    SP_API void SP_CALL cds_get_buffer_pool_stats(cds_buffer_pool_stats* out) {
+        if (!out) return;
+        memset(out, 0, sizeof(*out));
+        frame_buffer_pool().stats(*out);
+    }
+
+    SP_API void SP_CALL cds_trim_buffer_pool(void) {
+        frame_buffer_pool().trim();
+    }
+
+    SP_API cds_result_t SP_CALL cds_set_large_pages(int32_t enabled) {
+        return frame_buffer_pool().set_large_pages(enabled != 0) ? CDS_OK : CDS_ERR_UNSUPPORTED;
+    }
+
+    SP_API cds_result_t SP_CALL cds_history_range(uint32_t device_index, uint64_t* oldest_seq, uint64_t* newest_seq) {
+        if (oldest_seq) *oldest_seq = 0;
+        if (newest_seq) *newest_seq = 0;
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        uint64_t oldest = 0, newest = 0;
+        if (!s->history.range(oldest, newest)) return CDS_ERR_READ_FRAME;
+        if (oldest_seq) *oldest_seq = oldest;
+        if (newest_seq) *newest_seq = newest;
+        return CDS_OK;
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_history_frame(uint32_t device_index, uint64_t seq,
+        uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+        return grab_history_frame(device_index, true, seq, buffer, available_bytes, info);
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_history_frame_at(uint32_t device_index, uint64_t arrival_100ns,
+        uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+        return grab_history_frame(device_index, false, arrival_100ns, buffer, available_bytes, info);
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_button_frame(uint32_t device_index, uint8_t* buffer, size_t available_bytes, cds_frame_info* info) {
+        if (info) {
+            memset(info, 0, sizeof(*info));
+            info->sample_time_100ns = -1;
+        }
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        if (!buffer) return CDS_ERR_BUF_NULL;
+        if (s->encoded) return CDS_ERR_UNSUPPORTED;
+
+        int32_t slot = s->buttonSlot.exchange(-1);
+        if (slot < 0) return CDS_ERR_READ_FRAME; // no press since the last successful call
+
+        cds_result_t rc = copy_pinned_frame(s, slot, buffer, available_bytes, info);
+        if (rc != CDS_OK) {
+            // Put it back for a retry unless a newer press took its place meanwhile.
+            int32_t none = -1;
+            if (s->buttonSlot.compare_exchange_strong(none, slot)) return rc;
+        }
+        s->frames.unpin(slot);
+        return rc;
+    }
+
+    SP_API cds_result_t SP_CALL cds_grab_encoded_frame(uint32_t device_index, uint8_t* buffer, size_t available_bytes,
+        size_t* out_size, uint64_t* out_timestamp_100ns, uint64_t* out_seq) {
+        if (out_size) *out_size = 0;
+        if (out_timestamp_100ns) *out_timestamp_100ns = 0;
+        if (out_seq) *out_seq = 0;
+
+        const uint64_t enter100ns = now_ts100ns_monotonic();
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
 
+        if (!s->encoded) return CDS_ERR_UNSUPPORTED;
         if (!buffer) return CDS_ERR_BUF_NULL;
+        if (!s->hasFrame.load()) return CDS_ERR_READ_FRAME;
+
+        int32_t slot = s->frames.pin_latest();
+        if (slot < 0) return CDS_ERR_READ_FRAME;
+        SessionStats::add(s->stats.readerWait100ns, now_ts100ns_monotonic() - enter100ns);
+
+        const FrameSlot& fs = s->frames.slots[slot];
+        size_t len = fs.data.size();
+        cds_result_t rc = CDS_OK;
+        if (out_size) *out_size = len; // reported even when the buffer is too small
+        if (len == 0) rc = CDS_ERR_READ_FRAME;
+        else if (available_bytes < len) rc = CDS_ERR_BUF_TOO_SMALL;
+        else {
+            memcpy(buffer, fs.data.data(), len);
+            if (out_timestamp_100ns) *out_timestamp_100ns = fs.timestamp100ns;
+            if (out_seq) *out_seq = fs.seq;
+            s->stats.record_grab(fs.seq);
+        }
+        s->frames.unpin(slot);
+        return rc;
+    }
 
-        size_t rowBytes = 0;
-        size_t needed = 0;
-        if (!calc_frame_layout_bytes(s->width, s->height, rowBytes, needed)) return CDS_ERR_READ_FRAME;
-        if (rowBytes > (size_t)(std::numeric_limits<int32_t>::max)()) return CDS_ERR_READ_FRAME;
-        if (available_bytes < needed) return CDS_ERR_BUF_TOO_SMALL;
+    SP_API cds_result_t SP_CALL cds_get_session_stats(uint32_t device_index, cds_session_stats* out) {
+        if (!out) return CDS_ERR_BUF_NULL;
+        memset(out, 0, sizeof(*out));
+
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        const SessionStats& st = s->stats;
+
+        out->frames_captured = st.captured.load(std::memory_order_relaxed);
+        out->frames_delivered = st.delivered.load(std::memory_order_relaxed);
+        out->frames_dropped = st.dropped.load(std::memory_order_relaxed);
+        out->frames_duplicated = st.duplicated.load(std::memory_order_relaxed);
+        out->grabs = st.grabs.load(std::memory_order_relaxed);
+        uint64_t interval = st.frameInterval100ns.load(std::memory_order_relaxed);
+        out->fps = interval ? 1e7 / (double)interval : 0.0;
+        out->buffer_cb_p50_us = st.buffer_cb_percentile(0.50);
+        out->buffer_cb_p99_us = st.buffer_cb_percentile(0.99);
+        out->convert_us_total = st.convert100ns.load(std::memory_order_relaxed) / 10;
+        out->reader_wait_us_total = st.readerWait100ns.load(std::memory_order_relaxed) / 10;
+        uint64_t last = st.lastArrival100ns.load(std::memory_order_relaxed);
+        uint64_t now = now_ts100ns_monotonic();
+        out->ms_since_last_frame = (last && now > last) ? (now - last) / 10000 : 0;
+        out->button_events_lost = s->buttonEventsLost.load(std::memory_order_relaxed);
+        return CDS_OK;
+    }
 
-        std::lock_guard<std::mutex> lk2(s->frameMutex);
-        if (!s->hasFrame.load() || s->lastRgb.size() < needed) return CDS_ERR_READ_FRAME;
+    SP_API cds_result_t SP_CALL cds_acquire_frame(uint32_t device_index, cds_frame_lease* lease) {
+        if (!lease) return CDS_ERR_BUF_NULL;
+        memset(lease, 0, sizeof(*lease));
+
+        const uint64_t enter100ns = now_ts100ns_monotonic();
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        if (s->lazy) return CDS_ERR_UNSUPPORTED; // slots hold native samples, not the output layout
+
+        if (!s->hasFrame.load()) return CDS_ERR_READ_FRAME;
+        int32_t slot = s->frames.pin_latest();
+        if (slot < 0) return CDS_ERR_READ_FRAME;
+        SessionStats::add(s->stats.readerWait100ns, now_ts100ns_monotonic() - enter100ns);
+
+        const FrameSlot& fs = s->frames.slots[slot];
+        size_t rowBytes = fs.layout.rowBytes;
+        size_t needed = fs.layout.frameBytes;
+        uint32_t width = fs.layout.width;
+        uint32_t height = fs.layout.height;
+        if (s->encoded) {
+            // Leasing works for the JPEG bitstream too: no rows, size is the sample length.
+            needed = fs.data.size();
+            rowBytes = 0;
+            width = fs.native.width;
+            height = fs.native.height;
+        }
+        if (needed == 0 || fs.data.size() < needed) {
+            s->frames.unpin(slot);
+            return CDS_ERR_READ_FRAME;
+        }
 
-        memcpy(buffer, s->lastRgb.data(), needed);
+        // The lease keeps the session (and so the slot memory) alive past cds_stop_capture.
+        s->refs.fetch_add(1, std::memory_order_relaxed);
+        s->stats.record_grab(fs.seq);
+
+        lease->data = fs.data.data();
+        lease->size = needed;
+        lease->width = (int32_t)width;
+        lease->height = (int32_t)height;
+        lease->bytes_per_row = (int32_t)rowBytes;
+        lease->sequence = fs.seq;
+        lease->internal_session = s;
+        lease->internal_slot = slot;
         return CDS_OK;
     }
 
+    SP_API void SP_CALL cds_release_frame(cds_frame_lease* lease) {
+        if (!lease || !lease->internal_session) return;
+        DsSession* s = static_cast<DsSession*>(lease->internal_session);
+        int32_t slot = lease->internal_slot;
+        memset(lease, 0, sizeof(*lease));
+
+        if (slot >= 0 && slot < kFrameSlotCount) s->frames.unpin(slot);
+        release_session_ref(s);
+    }
+
     SP_API int32_t SP_CALL cds_frame_width(uint32_t device_index) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return 0;
-        return (int32_t)it->second->width;
+        SessionRef s(device_index);
+        if (!s) return 0;
+        return (int32_t)s->current_geometry().out.width;
     }
 
     SP_API int32_t SP_CALL cds_frame_height(uint32_t device_index) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return 0;
-        return (int32_t)it->second->height;
+        SessionRef s(device_index);
+        if (!s) return 0;
+        return (int32_t)s->current_geometry().out.height;
     }
 
     SP_API int32_t SP_CALL cds_frame_bytes_per_row(uint32_t device_index) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return 0;
-        return (int32_t)it->second->width * 4;
+        SessionRef s(device_index);
+        if (!s) return 0;
+        if (s->encoded) return 0;
+        return (int32_t)s->current_geometry().out.rowBytes;
+    }
+
+    SP_API size_t SP_CALL cds_frame_buffer_size(uint32_t device_index) {
+        SessionRef s(device_index);
+        if (!s) return 0;
+        if (s->encoded) return 0;
+        return s->current_geometry().out.frameBytes;
+    }
+
+    SP_API cds_result_t SP_CALL cds_set_output_roi(uint32_t device_index, uint32_t x, uint32_t y, uint32_t width, uint32_t height) {
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        if (s->encoded) return CDS_ERR_UNSUPPORTED;
+
+        bool grew = false;
+        {
+            std::lock_guard<std::mutex> glk(s->geometryMutex); // also guards width/height against cds_change_format
+            if (width == 0 || height == 0) { x = 0; y = 0; width = s->width; height = s->height; }
+            x &= ~1u;
+            y &= ~1u;
+            if (x >= s->width || y >= s->height) return CDS_ERR_INVALID_ARG;
+            width = (std::min)(width, s->width - x);
+            height = (std::min)(height, s->height - y);
+
+            FrameGeometry g = s->geometry;
+            g.roiX = x;
+            g.roiY = y;
+            g.roiW = width;
+            g.roiH = height;
+            if (!calc_geometry(s->outFormat, g)) return CDS_ERR_INVALID_ARG;
+            grew = g.out.frameBytes > s->geometry.out.frameBytes;
+            s->geometry = g;
+        }
+        if (grew) preallocate_frame_slots(s.get());
+        return CDS_OK;
+    }
+
+    SP_API cds_result_t SP_CALL cds_set_output_size(uint32_t device_index, uint32_t width, uint32_t height) {
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+        if (s->encoded) return CDS_ERR_UNSUPPORTED;
+        if ((width == 0) != (height == 0)) return CDS_ERR_INVALID_ARG;
+
+        bool grew = false;
+        {
+            std::lock_guard<std::mutex> glk(s->geometryMutex);
+            FrameGeometry g = s->geometry;
+            g.scaleW = width;
+            g.scaleH = height;
+            if (!calc_geometry(s->outFormat, g)) return CDS_ERR_INVALID_ARG;
+            grew = g.out.frameBytes > s->geometry.out.frameBytes;
+            s->geometry = g;
+        }
+        if (grew) preallocate_frame_slots(s.get());
+        return CDS_OK;
     }
 
     // Button while streaming: edge-trigger (1 once)
     SP_API int32_t SP_CALL cds_button_pressed(uint32_t device_index) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return 0;
-        return it->second->buttonEdge.exchange(false) ? 1 : 0;
+        SessionRef s(device_index);
+        if (!s) return 0;
+        return s->buttonEdge.exchange(false) ? 1 : 0;
     }
 
     SP_API uint64_t SP_CALL cds_button_timestamp(uint32_t device_index) {
-        std::lock_guard<std::mutex> lk(g_dsMutex);
-        auto it = g_dsSessions.find(device_index);
-        if (it == g_dsSessions.end()) return 0;
-        return it->second->lastButtonTs100ns.load();
+        SessionRef s(device_index);
+        if (!s) return 0;
+        return s->lastButtonTs100ns.load();
+    }
+
+    SP_API cds_result_t SP_CALL cds_next_button_event(uint32_t device_index, cds_button_event* out, uint32_t timeout_ms) {
+        if (!out) return CDS_ERR_BUF_NULL;
+        memset(out, 0, sizeof(*out));
+
+        SessionRef s(device_index);
+        if (!s) return CDS_ERR_NOT_STARTED;
+
+        ButtonEvent ev;
+        bool got = s->buttonEvents.pop(ev);
+        if (!got && timeout_ms != 0) {
+            s->buttonWaiters.fetch_add(1);
+            {
+                std::unique_lock<std::mutex> lk(s->buttonWaitMutex);
+                auto pred = [&]() { return (got = s->buttonEvents.pop(ev)) || s->stopRequested.load(); };
+                if (timeout_ms == CDS_WAIT_INFINITE) s->buttonCv.wait(lk, pred);
+                else s->buttonCv.wait_for(lk, std::chrono::milliseconds(timeout_ms), pred);
+            }
+            s->buttonWaiters.fetch_sub(1);
+        }
+        if (!got) return s->stopRequested.load() ? CDS_ERR_NOT_STARTED : CDS_ERR_TIMEOUT;
+
+        out->timestamp_100ns = ev.mono100ns;
+        out->timestamp_utc_100ns = ev.utc100ns;
+        out->frame_sequence = ev.frameSeq;
+        out->source = ev.source;
+        return CDS_OK;
     }
 
 } // extern "C"
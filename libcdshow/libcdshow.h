@@ -25,14 +25,56 @@ extern "C" {
 #define CDS_ERR_ALREADY_STARTED  -4
 #define CDS_ERR_NOT_STARTED      -5
 #define CDS_ERR_NOT_INITIALIZED  -6
+#define CDS_ERR_TIMEOUT          -7
 #define CDS_ERR_READ_FRAME       -8
+#define CDS_ERR_UNSUPPORTED      -9
 #define CDS_ERR_BUF_NULL         -10
 #define CDS_ERR_BUF_TOO_SMALL    -11
+#define CDS_ERR_INVALID_ARG      -12
 #define CDS_ERR_UNKNOWN          -512
 
-	SP_API cds_result_t SP_CALL cds_initialize(void);
+	SP_API cds_result_t SP_CALL cds_initialize(void); // blocking: cds_initialize_async + cds_wait_initialized
+
+	// Initialization runs on a background thread: devices are listed first (names, ids,
+	// vid/pid and cds_devices_count work from then on), then formats are probed in
+	// parallel; format queries and capture start wait for CDS_INIT_DONE.
+#define CDS_INIT_IDLE    0 // not started, or shut down
+#define CDS_INIT_LISTING 1
+#define CDS_INIT_PROBING 2 // device list available
+#define CDS_INIT_DONE    3
+#define CDS_INIT_FAILED  4
+
+	// Called once from the initialization thread when it finishes (right away, on the caller's
+	// thread, if already initialized). Do not call cds_initialize or cds_wait_initialized from it.
+	typedef void (SP_CALL *cds_init_callback)(cds_result_t result, void* user_data);
+
+	// Returns immediately; on_done may be NULL. Calling it again while running just adds the callback.
+	SP_API cds_result_t SP_CALL cds_initialize_async(cds_init_callback on_done, void* user_data);
+	// Waits for the running initialization. Returns its result, CDS_ERR_TIMEOUT, or
+	// CDS_ERR_NOT_INITIALIZED if none was started.
+	SP_API cds_result_t SP_CALL cds_wait_initialized(uint32_t timeout_ms);
+	SP_API int32_t      SP_CALL cds_initialize_status(void); // CDS_INIT_*
 	SP_API void         SP_CALL cds_shutdown_capture_api(void);
 	SP_API void         SP_CALL cds_set_log_enabled(int32_t enabled); // 0=off, non-zero=on
+	SP_API void         SP_CALL cds_set_mjpeg_decode_threads(int32_t threads); // per session, 0=auto (max 4); applies to new captures
+	// Device cache: format lists found by cds_initialize are saved (default
+	// %LOCALAPPDATA%\libcdshow\device_cache.bin) and reused while a camera's hardware IDs and
+	// driver version are unchanged, so initialization only lists devices. A capture start that
+	// finds a cached format stale fails with CDS_ERR_OPENING_DEVICE and drops that camera's entry.
+	// path_utf8: NULL = default location, "" = no cache. Takes effect at the next cds_initialize.
+	SP_API void         SP_CALL cds_set_device_cache_path(const char* path_utf8);
+	// Marks every cached format list stale without probing anything: cds_initialize keeps using
+	// them, and each camera's next capture start reads its full list from the device (it is
+	// opened then anyway) and stores it for the next cds_initialize/cds_rescan.
+	SP_API void         SP_CALL cds_refresh_device_cache(void);
+	// Hot-plug: list cameras again without touching running captures. Known cameras keep their
+	// index and formats (unless their driver changed and they aren't capturing), new ones are
+	// probed and appended, missing ones are marked not present. Counts are optional.
+	SP_API cds_result_t SP_CALL cds_rescan(uint32_t* out_added, uint32_t* out_removed);
+	// How often the UVC still trigger is polled on cameras that report one through IAMVideoControl
+	// (default 5 ms, max 1000, 0 = default; applies to running captures). Sessions without a
+	// trigger don't poll at all.
+	SP_API void         SP_CALL cds_set_trigger_poll_interval(uint32_t ms);
 
 	// Devices
 	SP_API int32_t SP_CALL cds_devices_count(void);
@@ -41,9 +83,27 @@ extern "C" {
 	SP_API size_t  SP_CALL cds_device_unique_id(int32_t device_index, char* buf, size_t buf_len); // DevicePath UTF-8
 	SP_API size_t  SP_CALL cds_device_model_id(int32_t device_index, char* buf, size_t buf_len);
 
+	// 1 while the camera is connected. Unplugged cameras keep their index (0 here, capture
+	// start returns CDS_ERR_DEVICE_NOT_FOUND) and get it back when they reappear.
+	SP_API int32_t SP_CALL cds_device_present(int32_t device_index);
+
 	SP_API int32_t SP_CALL cds_device_vid(int32_t device_index); // 0 if unknown
 	SP_API int32_t SP_CALL cds_device_pid(int32_t device_index); // 0 if unknown
 
+	// All devices in one call. Fills min(capacity, count) entries and returns the device count
+	// (out may be NULL to ask for it). Strings are UTF-8, NUL-terminated, cut to fit.
+	typedef struct cds_device_info {
+		char    name[256];
+		char    unique_id[512]; // DevicePath, as cds_device_unique_id
+		char    model_id[128];
+		int32_t vid;            // 0 if unknown
+		int32_t pid;            // 0 if unknown
+		int32_t formats_count;  // -1 until cds_initialize has probed formats
+		int32_t present;        // as cds_device_present
+	} cds_device_info;
+
+	SP_API int32_t SP_CALL cds_devices_table(cds_device_info* out, int32_t capacity);
+
 	// Formats (deduped, stable-sorted)
 	SP_API int32_t  SP_CALL cds_device_formats_count(int32_t device_index);
 	SP_API uint32_t SP_CALL cds_device_format_width(int32_t device_index, int32_t format_index);
@@ -55,22 +115,255 @@ extern "C" {
 	// subtype name: "MJPG","YUY2","NV12","RGB24","RGB32", or GUID string
 	SP_API size_t   SP_CALL cds_device_format_type(int32_t device_index, int32_t format_index, char* buf, size_t buf_len);
 
-	// Capture (RGB32 guaranteed, top-down guaranteed)
+	// A device's whole format list in one call, same order and indices as above. Fills
+	// min(capacity, count) entries and returns the format count (out may be NULL), or a
+	// negative cds_result_t like cds_device_formats_count.
+	typedef struct cds_format_info {
+		uint32_t width;
+		uint32_t height;
+		uint32_t max_fps;
+		uint32_t fourcc;            // e.g. 'MJPG' = 0x47504A4D; 0 for RGB24/RGB32 and other non-FOURCC subtypes
+		uint32_t stream_caps_index; // IAMStreamConfig capability this format came from
+		char     type[12];          // as cds_device_format_type ("MJPG", "RGB24"...), "" for other subtypes
+	} cds_format_info;
+
+	SP_API int32_t SP_CALL cds_device_formats_table(int32_t device_index, cds_format_info* out, int32_t capacity);
+
+	// Capture (RGB32 unless another pixel format is requested, top-down guaranteed)
+	// Up to 64 devices (indices 0..63) can capture; higher indices return CDS_ERR_UNSUPPORTED.
+	// Per-session calls (grab, wait, frame size, button...) take no global lock, so sessions
+	// read from different threads don't contend, and cds_stop_capture is safe against them.
 	SP_API cds_result_t SP_CALL cds_start_capture(uint32_t device_index, uint32_t width, uint32_t height);
 	SP_API cds_result_t SP_CALL cds_start_capture_with_format(uint32_t device_index, uint32_t format_index);
 	SP_API cds_result_t SP_CALL cds_stop_capture(uint32_t device_index);
 
+	// Capture flags for cds_start_capture_ex
+#define CDS_CAPTURE_ENCODED     0x1u // MJPG formats only: keep the JPEG bitstream, no decode (see cds_grab_encoded_frame)
+#define CDS_CAPTURE_DECODE_POOL 0x2u // MJPG formats: decode on the library's worker pool instead of DirectShow's
+                                     // single-threaded decoder (ignored for other formats)
+#define CDS_CAPTURE_LAZY        0x4u // keep frames in the camera's format (YUY2/NV12/MJPG...) and convert to the
+                                     // output pixel format only when grabbed; for sessions that read few frames.
+                                     // cds_acquire_frame returns CDS_ERR_UNSUPPORTED. Not combinable with ENCODED.
+                                     // MJPG frames are decoded with a per-thread WIC factory: a reading thread
+                                     // without COM joins the multithreaded apartment on its first grab and stays.
+
+	// Output pixel formats for cds_start_capture_ex (byte order in memory)
+#define CDS_PIXEL_BGRA  0 // = RGB32, the default
+#define CDS_PIXEL_RGBA  1
+#define CDS_PIXEL_RGB24 2 // R,G,B
+#define CDS_PIXEL_GRAY8 3 // full-range luma
+#define CDS_PIXEL_I420  4 // Y plane, then U and V planes of (w+1)/2 x (h+1)/2
+#define CDS_PIXEL_NV12  5 // Y plane, then interleaved UV plane of (w+1)/2 x (h+1)/2 pairs
+
+	// pixel_format is ignored for CDS_CAPTURE_ENCODED.
+	SP_API cds_result_t SP_CALL cds_start_capture_ex(uint32_t device_index, uint32_t format_index, uint32_t flags, int32_t pixel_format);
+
+	// Warm start: builds the capture graph for these start arguments and leaves it paused (the
+	// camera may already show as in use), so a later cds_start_capture_ex with the same arguments
+	// only has to run it. Starting with other arguments drops the prepared graph. Same errors as
+	// cds_start_capture_ex; preparing again with the same arguments is a no-op.
+	SP_API cds_result_t SP_CALL cds_prepare_capture(uint32_t device_index, uint32_t format_index, uint32_t flags, int32_t pixel_format);
+	// Releases a prepared graph (CDS_ERR_NOT_STARTED if there is none).
+	SP_API cds_result_t SP_CALL cds_unprepare_capture(uint32_t device_index);
+
+	// Stop flags for cds_stop_capture_ex
+#define CDS_STOP_KEEP_PREPARED 0x1u // pause the graph instead of releasing it, as if cds_prepare_capture
+                                    // had been called; frame numbering and history carry on at the next start
+	SP_API cds_result_t SP_CALL cds_stop_capture_ex(uint32_t device_index, uint32_t flags);
+
+	// Switches a running capture to another format of the same device without stopping the
+	// session: the graph is stopped, the capture pin reconnected and run again. Flags, pixel
+	// format, callbacks, history and button state stay; frame numbering continues and the
+	// output ROI/size go back to the full new frame. Grabs wait for the first new-format frame;
+	// frames already held keep the size they were captured with. If the device rejects the
+	// format the previous one is restored and CDS_ERR_FORMAT_NOT_FOUND is returned; if that
+	// fails too the capture is stopped (as by cds_stop_capture) and CDS_ERR_OPENING_DEVICE is returned.
+	SP_API cds_result_t SP_CALL cds_change_format(uint32_t device_index, uint32_t format_index);
+
 	SP_API int32_t      SP_CALL cds_has_first_frame(uint32_t device_index);
 	SP_API cds_result_t SP_CALL cds_grab_frame(uint32_t device_index, uint8_t* buffer, size_t available_bytes);
 
+	// CDS_CAPTURE_ENCODED sessions: copies the latest JPEG as delivered by the camera.
+	// On CDS_ERR_BUF_TOO_SMALL, out_size still tells the required length.
+	// Pixel grabs and frame callbacks return CDS_ERR_UNSUPPORTED on encoded sessions;
+	// cds_acquire_frame works and reports bytes_per_row = 0.
+	SP_API cds_result_t SP_CALL cds_grab_encoded_frame(uint32_t device_index, uint8_t* buffer, size_t available_bytes,
+		size_t* out_size, uint64_t* out_timestamp_100ns, uint64_t* out_seq);
+
+	// Frames are numbered 1, 2, 3... per session. Gaps between grabbed sequence numbers
+	// mean skipped frames; an equal number means the same frame was grabbed twice.
+	SP_API cds_result_t SP_CALL cds_grab_frame_seq(uint32_t device_index, uint8_t* buffer, size_t available_bytes, uint64_t* out_seq);
+
+	// Everything known about a grabbed frame. Capture-to-app latency is cds_now_100ns() - arrival_100ns.
+	typedef struct cds_frame_info {
+		uint64_t sequence;
+		int64_t  sample_time_100ns; // stream time DirectShow stamped on the sample (relative to graph start)
+		uint64_t arrival_100ns;     // when the library received it; monotonic clock, see cds_now_100ns
+		uint64_t arrival_utc_100ns; // same moment on the wall clock (FILETIME), like cds_button_timestamp
+		int32_t  width;
+		int32_t  height;
+		int32_t  bytes_per_row;
+		size_t   size;              // bytes written to the buffer
+	} cds_frame_info;
+
+	SP_API cds_result_t SP_CALL cds_grab_frame_ex(uint32_t device_index, uint8_t* buffer, size_t available_bytes, cds_frame_info* info);
+
+	// Monotonic clock used for arrival_100ns (QueryPerformanceCounter in 100 ns units; does not jump with NTP).
+	SP_API uint64_t SP_CALL cds_now_100ns(void);
+
+	// Blocks until a frame newer than last_seq exists (pass 0 to wait for the first frame).
+	// Returns CDS_OK, CDS_ERR_TIMEOUT, or CDS_ERR_NOT_STARTED if the capture is stopped meanwhile.
+#define CDS_WAIT_INFINITE 0xFFFFFFFFu
+	SP_API cds_result_t SP_CALL cds_wait_for_frame(uint32_t device_index, uint64_t last_seq, uint32_t timeout_ms);
+
+	// Zero-copy access: borrow the latest frame straight from the library's ring.
+	// The pointer stays valid (and the slot is not overwritten) until cds_release_frame,
+	// even if the capture is stopped meanwhile. Hold leases briefly: while every spare
+	// slot is leased, new frames are dropped.
+	typedef struct cds_frame_lease {
+		const uint8_t* data;   // session pixel format, top-down, read-only (JPEG for CDS_CAPTURE_ENCODED)
+		size_t   size;         // cds_frame_buffer_size (JPEG length for CDS_CAPTURE_ENCODED)
+		int32_t  width;
+		int32_t  height;
+		int32_t  bytes_per_row;
+		uint64_t sequence;     // increases by 1 per captured frame
+		void*    internal_session; // do not touch
+		int32_t  internal_slot;    // do not touch
+	} cds_frame_lease;
+
+	SP_API cds_result_t SP_CALL cds_acquire_frame(uint32_t device_index, cds_frame_lease* lease);
+	SP_API void         SP_CALL cds_release_frame(cds_frame_lease* lease); // no-op on a zeroed lease
+
+	// Push mode: fn is called for each new frame from a dedicated delivery thread (never the
+	// DirectShow streaming thread). data is in the session pixel format, top-down, and only
+	// valid during the call.
+	// Pass fn=NULL to unregister. Do not call cds_set_frame_callback or cds_stop_capture from
+	// inside the callback.
+	typedef void (SP_CALL *cds_frame_callback)(uint32_t device_index, const uint8_t* data,
+		int32_t width, int32_t height, int32_t bytes_per_row, uint64_t sequence, void* user_data);
+
+	// What happens to frames that arrive while the callback is still running:
+#define CDS_CALLBACK_COALESCE 0 // default: deliver only the newest one right after the callback returns
+#define CDS_CALLBACK_DROP     1 // drop them all; deliver the next frame captured after the callback returns
+
+	SP_API cds_result_t SP_CALL cds_set_frame_callback(uint32_t device_index, cds_frame_callback fn, void* user_data);
+	SP_API cds_result_t SP_CALL cds_set_frame_callback_policy(uint32_t device_index, int32_t policy);
+
+	// Crop and scale, applied while each frame is converted (not available for CDS_CAPTURE_ENCODED).
+	// Changes apply from the next captured frame; cds_frame_width/height/bytes_per_row/buffer_size
+	// report the new geometry right away. Grabbing a frame made before the change returns
+	// CDS_ERR_BUF_TOO_SMALL if it no longer fits.
+	// roi is in native frame pixels; x/y are rounded down to even and the size is clipped to the
+	// frame. width or height 0 restores the full frame.
+	SP_API cds_result_t SP_CALL cds_set_output_roi(uint32_t device_index, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+	// Scales the roi to width x height (0,0 = roi size). Box filter when shrinking 2x or more on
+	// both axes, bilinear otherwise; at most 64x smaller per axis.
+	SP_API cds_result_t SP_CALL cds_set_output_size(uint32_t device_index, uint32_t width, uint32_t height);
+
+	// History: keep the last frames so the ones around a trigger can be fetched afterwards.
+	// Off by default; limit by frame count, byte budget, or both (0 = no limit on that
+	// axis; both 0 turns history off and frees it). Frames are stored as the session stores
+	// them: start with CDS_CAPTURE_LAZY to keep native YUY2/NV12 (or JPEG from MJPG cameras)
+	// and fit several times more frames in the same budget; they are converted when fetched.
+	// Cost: every frame is copied into history on the capture thread as it arrives (a full
+	// output frame, or the native sample when lazy), which adds one frame-sized memcpy per
+	// frame to the capture path and can cost frames at high resolutions and rates.
+	SP_API cds_result_t SP_CALL cds_set_history(uint32_t device_index, uint32_t max_frames, uint64_t max_bytes);
+	// Oldest and newest sequence numbers held; CDS_ERR_READ_FRAME if history is empty.
+	SP_API cds_result_t SP_CALL cds_history_range(uint32_t device_index, uint64_t* oldest_seq, uint64_t* newest_seq);
+	// Frame with exactly this sequence number, or CDS_ERR_READ_FRAME if it isn't held
+	// (evicted, dropped, or not captured yet). Same output as cds_grab_frame_ex; JPEG
+	// bitstream for CDS_CAPTURE_ENCODED.
+	SP_API cds_result_t SP_CALL cds_grab_history_frame(uint32_t device_index, uint64_t seq,
+		uint8_t* buffer, size_t available_bytes, cds_frame_info* info);
+	// Newest held frame with arrival_100ns <= arrival_100ns (e.g. a button event's timestamp_100ns).
+	SP_API cds_result_t SP_CALL cds_grab_history_frame_at(uint32_t device_index, uint64_t arrival_100ns,
+		uint8_t* buffer, size_t available_bytes, cds_frame_info* info);
+
+	// One frame from each of `count` running sessions (distinct indices), chosen so their
+	// arrival_100ns are as close as possible: the camera whose newest frame is oldest sets the
+	// time, the others use their frame nearest to it. Older frames can only be matched for
+	// sessions with a history (cds_set_history; a few frames is enough), otherwise each camera
+	// contributes its newest frame. buffers/available_bytes/infos are arrays of `count` (infos
+	// may be NULL); frames are copied on the calling thread. out_max_skew_100ns
+	// (optional) is the spread of the chosen arrival times. Returns the first device's error in
+	// array order if any copy failed (the other buffers may still have been filled).
+	SP_API cds_result_t SP_CALL cds_grab_frames_multi(const uint32_t* device_indices, uint32_t count,
+		uint8_t* const* buffers, const size_t* available_bytes, cds_frame_info* infos, uint64_t* out_max_skew_100ns);
+
+	// Counters since cds_start_capture (also when it reuses a prepared graph). Cheap to call
+	// (no locks on the capture path); fields are read one by one, so they can be a frame apart
+	// from each other.
+	typedef struct cds_session_stats {
+		uint64_t frames_captured;   // samples handed over by DirectShow
+		uint64_t frames_delivered;  // made available to grabs/leases/callbacks
+		uint64_t frames_dropped;    // captured but not delivered (ring full, decoder behind, bad sample)
+		uint64_t frames_duplicated; // grabs that returned the same frame as the previous grab
+		uint64_t grabs;             // successful grabs and leases
+		double   fps;               // delivered frames per second (moving average)
+		uint32_t buffer_cb_p50_us;  // time spent in the capture callback, per frame (bucketed, ~25% resolution)
+		uint32_t buffer_cb_p99_us;
+		uint64_t convert_us_total;     // copying/converting/decoding frames, capture and grab side
+		uint64_t reader_wait_us_total; // grab/lease calls waiting until they held a frame
+		uint64_t ms_since_last_frame;  // 0 until the first frame
+		uint64_t button_events_lost;   // presses dropped because the button event queue was full
+	} cds_session_stats;
+
+	SP_API cds_result_t SP_CALL cds_get_session_stats(uint32_t device_index, cds_session_stats* out);
+
+	// Frame buffers (ring slots, history, decode output) are 64-byte aligned and come from one
+	// process-wide pool that keeps up to 256 MB of freed buffers for reuse across sessions and
+	// format changes.
+	typedef struct cds_buffer_pool_stats {
+		uint64_t bytes_in_use;     // held by sessions, history and leases
+		uint64_t bytes_cached;     // freed, kept for reuse
+		uint64_t buffers_in_use;
+		uint64_t buffers_cached;
+		uint64_t allocations;      // requests that needed new memory
+		uint64_t reuses;           // requests served from the cache
+		uint64_t large_page_bytes; // of the above, backed by large pages
+	} cds_buffer_pool_stats;
+
+	SP_API void         SP_CALL cds_get_buffer_pool_stats(cds_buffer_pool_stats* out);
+	// Frees the cached buffers (e.g. after stopping high-resolution captures).
+	SP_API void         SP_CALL cds_trim_buffer_pool(void);
+	// Back buffers of at least one large page (2 MB on x64) with large pages, for fewer TLB
+	// misses on 4K frames. Needs the "Lock pages in memory" right (SeLockMemoryPrivilege);
+	// returns CDS_ERR_UNSUPPORTED without it. Applies to buffers allocated from now on; falls
+	// back to normal pages when large pages run out. Off by default.
+	SP_API cds_result_t SP_CALL cds_set_large_pages(int32_t enabled);
+
 	SP_API int32_t SP_CALL cds_frame_width(uint32_t device_index);
 	SP_API int32_t SP_CALL cds_frame_height(uint32_t device_index);
-	SP_API int32_t SP_CALL cds_frame_bytes_per_row(uint32_t device_index);
+	SP_API int32_t SP_CALL cds_frame_bytes_per_row(uint32_t device_index); // luma plane for I420/NV12
+	SP_API size_t  SP_CALL cds_frame_buffer_size(uint32_t device_index);   // bytes cds_grab_frame writes (all planes)
 
 	// Button press detection WHILE STREAMING (integrated into cds session)
 	SP_API int32_t  SP_CALL cds_button_pressed(uint32_t device_index);     // returns 1 once per press (edge), then 0
 	SP_API uint64_t SP_CALL cds_button_timestamp(uint32_t device_index);   // timestamp_100ns for last press (best-effort)
 
+	// Every press is also queued (up to 64 unread; more are counted in button_events_lost).
+	// The queue is independent of cds_button_pressed, which only keeps the latest edge.
+#define CDS_BUTTON_SOURCE_TRIGGER   0 // UVC trigger reported through IAMVideoControl
+#define CDS_BUTTON_SOURCE_STILL_PIN 1 // sample on the STILL pin (fallback)
+
+	typedef struct cds_button_event {
+		uint64_t timestamp_100ns;     // monotonic, see cds_now_100ns
+		uint64_t timestamp_utc_100ns; // wall clock, like cds_button_timestamp
+		uint64_t frame_sequence;      // newest frame at the time of the press (0 = none yet)
+		int32_t  source;              // CDS_BUTTON_SOURCE_*
+	} cds_button_event;
+
+	// Pops the oldest press. timeout_ms = 0 polls, CDS_WAIT_INFINITE blocks.
+	// Returns CDS_OK, CDS_ERR_TIMEOUT if none arrived, or CDS_ERR_NOT_STARTED if the capture is stopped.
+	SP_API cds_result_t SP_CALL cds_next_button_event(uint32_t device_index, cds_button_event* out, uint32_t timeout_ms);
+
+	// Copies the frame that was newest when the button was last pressed (the library holds it
+	// from the press on), instead of whatever is newest by the time the app reacts. Each press
+	// is returned once; a newer press replaces an unread one. CDS_ERR_READ_FRAME if there was
+	// no press since the last successful call. Not available for CDS_CAPTURE_ENCODED.
+	SP_API cds_result_t SP_CALL cds_grab_button_frame(uint32_t device_index, uint8_t* buffer, size_t available_bytes, cds_frame_info* info);
+
 #ifdef __cplusplus
 }
 #endif
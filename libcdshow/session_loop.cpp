@@ -0,0 +1,26 @@
+#include "session_loop.h"
+
+#include <algorithm>
+
+void run_session_loop(SessionWaitSet& waits, const std::function<uint32_t()>& pollIntervalMs,
+    const std::function<void()>& onMediaEvent, const std::function<void()>& onPoll) {
+    uint64_t nextPoll = 0;
+    for (;;) {
+        uint32_t timeout = kWaitForever;
+        uint32_t interval = pollIntervalMs();
+        if (interval != 0) {
+            uint64_t now = waits.now_ms();
+            if (now >= nextPoll) {
+                onPoll();
+                now = waits.now_ms();
+                nextPoll = now + interval;
+            }
+            nextPoll = (std::min)(nextPoll, now + interval); // interval may have shrunk
+            timeout = (uint32_t)(nextPoll - now);
+        }
+
+        SessionWake w = waits.wait(timeout);
+        if (w == SessionWake::Stop) return;
+        if (w == SessionWake::MediaEvent) onMediaEvent();
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+// ---- Session thread scheduling ----
+// The session thread sleeps until it is stopped, the graph posts an event, or the next
+// UVC trigger poll is due. The loop only sees SessionWaitSet, so its timing can be driven
+// by fake sources in tests; Win32SessionWaitSet in libcdshow.cpp is the real one.
+constexpr uint32_t kWaitForever = 0xFFFFFFFFu;
+constexpr uint32_t kDefaultTriggerPollMs = 5;
+constexpr uint32_t kMaxTriggerPollMs = 1000;
+
+enum class SessionWake { Stop, MediaEvent, Timeout, Other };
+
+struct SessionWaitSet {
+    virtual ~SessionWaitSet() = default;
+    virtual SessionWake wait(uint32_t timeoutMs) = 0; // kWaitForever blocks
+    virtual uint64_t now_ms() = 0;
+};
+
+// Returns when the stop source fires. pollIntervalMs() is re-read every pass (0 = don't
+// poll, sleep until an event); onPoll runs at most once per interval.
+void run_session_loop(SessionWaitSet& waits, const std::function<uint32_t()>& pollIntervalMs,
+    const std::function<void()>& onMediaEvent, const std::function<void()>& onPoll);
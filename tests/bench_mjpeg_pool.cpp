@@ -0,0 +1,325 @@
+// Throughput benchmark for the MJPEG decode pool (libcdshow/decode_pool.h): JPEG samples
+// are submitted like BufferCB would, decoded with libjpeg by 1..kMaxMjpegDecodeThreads
+// workers into the frame exchange and converted to the output format, while a reader pins
+// the latest frame. Frames must come out complete and strictly in seq order.
+//
+//   bench_mjpeg_pool [--frames N] [--format bgra|nv12|i420|gray8] [--scale WxH] [sample.jpg ...]
+//
+// Pass samples recorded from a camera (cds_grab_encoded_frame in a CDS_CAPTURE_ENCODED session
+// returns them as delivered); without any, a 1280x720 test pattern is encoded and used instead.
+
+#include "decode_pool.h"
+#include "check.h"
+
+#include <atomic>
+#include <chrono>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <jpeglib.h>
+
+typedef std::vector<uint8_t> Sample;
+
+// ---- libjpeg glue ----
+
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static void jpeg_error_jump(j_common_ptr cinfo) {
+    longjmp(((JpegError*)cinfo->err)->jump, 1);
+}
+
+static Sample encode_pattern(uint32_t w, uint32_t h, uint32_t frame) {
+    std::vector<uint8_t> rgb((size_t)w * h * 3);
+    for (uint32_t y = 0; y < h; ++y) {
+        for (uint32_t x = 0; x < w; ++x) {
+            uint8_t* p = &rgb[((size_t)y * w + x) * 3];
+            bool bar = ((x + frame * 16) / 64) % 2 == 0;
+            p[0] = (uint8_t)(x * 255 / w);
+            p[1] = (uint8_t)(y * 255 / h);
+            p[2] = bar ? 200 : (uint8_t)((x ^ y) & 0xFF);
+        }
+    }
+
+    jpeg_compress_struct c;
+    jpeg_error_mgr err;
+    c.err = jpeg_std_error(&err);
+    jpeg_create_compress(&c);
+    unsigned char* out = nullptr;
+    unsigned long outLen = 0;
+    jpeg_mem_dest(&c, &out, &outLen);
+    c.image_width = w;
+    c.image_height = h;
+    c.input_components = 3;
+    c.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&c);
+    jpeg_set_quality(&c, 85, TRUE);
+    jpeg_start_compress(&c, TRUE);
+    while (c.next_scanline < c.image_height) {
+        JSAMPROW row = &rgb[(size_t)c.next_scanline * w * 3];
+        jpeg_write_scanlines(&c, &row, 1);
+    }
+    jpeg_finish_compress(&c);
+    Sample s(out, out + outLen);
+    jpeg_destroy_compress(&c);
+    free(out);
+    return s;
+}
+
+static bool read_file(const char* path, Sample& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    uint8_t buf[65536];
+    size_t n = 0;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out.insert(out.end(), buf, buf + n);
+    fclose(f);
+    return !out.empty();
+}
+
+static bool jpeg_size(const Sample& s, uint32_t& w, uint32_t& h) {
+    jpeg_decompress_struct d;
+    JpegError err;
+    d.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_jump;
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&d);
+        return false;
+    }
+    jpeg_create_decompress(&d);
+    jpeg_mem_src(&d, s.data(), (unsigned long)s.size());
+    jpeg_read_header(&d, TRUE);
+    w = d.image_width;
+    h = d.image_height;
+    jpeg_destroy_decompress(&d);
+    return true;
+}
+
+// The benchmark's stand-in for the WIC decoder: libjpeg to BGRA, then the library's
+// converter into the slot's output layout (straight into the slot when that is BGRA).
+class LibjpegSlotDecoder : public MjpegSlotDecoder {
+public:
+    LibjpegSlotDecoder(uint32_t width, uint32_t height, const FrameGeometry& g) : _w(width), _h(height), _g(g) {
+        _d.err = jpeg_std_error(&_err.mgr);
+        _err.mgr.error_exit = jpeg_error_jump;
+        jpeg_create_decompress(&_d);
+    }
+    ~LibjpegSlotDecoder() override { jpeg_destroy_decompress(&_d); }
+
+    bool decode(const MjpegJob& job, FrameSlot& fs) override {
+        fs.layout = _g.out;
+        fs.data.resize(_g.out.frameBytes);
+        const bool direct = _g.out.fmt == OutFormat::Bgra && _g.out.width == _w && _g.out.height == _h;
+        const size_t stride = (size_t)_w * 4;
+        uint8_t* dst = fs.data.data();
+        if (!direct) {
+            _bgra.resize(stride * _h);
+            dst = _bgra.data();
+        }
+
+        if (setjmp(_err.jump)) {
+            jpeg_abort_decompress(&_d);
+            return false;
+        }
+        jpeg_mem_src(&_d, job.data.data(), (unsigned long)job.data.size());
+        jpeg_read_header(&_d, TRUE);
+        if (_d.image_width != _w || _d.image_height != _h) {
+            jpeg_abort_decompress(&_d);
+            return false;
+        }
+#ifdef JCS_EXTENSIONS
+        _d.out_color_space = JCS_EXT_BGRA;
+#else
+#error "bench_mjpeg_pool needs libjpeg-turbo (JCS_EXT_BGRA)"
+#endif
+        jpeg_start_decompress(&_d);
+        while (_d.output_scanline < _d.output_height) {
+            JSAMPROW row = dst + (size_t)_d.output_scanline * stride;
+            jpeg_read_scanlines(&_d, &row, 1);
+        }
+        jpeg_finish_decompress(&_d);
+
+        if (!direct) {
+            SrcFrame src{};
+            src.fmt = SrcFormat::Rgb32;
+            src.data = _bgra.data();
+            src.stride = stride;
+            src.width = _w;
+            src.height = _h;
+            convert_frame(crop_src_frame(src, _g), _g.out, fs.data.data(), _scratch);
+        }
+        return true;
+    }
+
+private:
+    uint32_t _w, _h;
+    FrameGeometry _g;
+    jpeg_decompress_struct _d;
+    JpegError _err;
+    std::vector<uint8_t> _bgra;
+    ConvScratch _scratch;
+};
+
+// Plays the session: publishes into the exchange and checks the order it is called in.
+class BenchHost : public MjpegDecodeHost {
+public:
+    FrameExchange frames;
+    std::atomic<uint64_t> publishedFrames{ 0 };
+    std::atomic<uint64_t> droppedFrames{ 0 };
+    std::atomic<uint64_t> outOfOrder{ 0 };
+    uint64_t lastSeq = 0; // only touched by the publishing worker
+    uint32_t width = 0, height = 0;
+    FrameGeometry geometry;
+
+    std::unique_ptr<MjpegSlotDecoder> make_decoder() override {
+        return std::unique_ptr<MjpegSlotDecoder>(new LibjpegSlotDecoder(width, height, geometry));
+    }
+
+    void publish(int32_t slot, const MjpegJob& job) override {
+        if (job.seq <= lastSeq) outOfOrder.fetch_add(1);
+        lastSeq = job.seq;
+        frames.slots[slot].seq = job.seq;
+        frames.end_write(slot);
+        publishedFrames.fetch_add(1);
+    }
+
+    void dropped(const MjpegJob& job) override {
+        if (job.seq <= lastSeq) outOfOrder.fetch_add(1);
+        lastSeq = job.seq;
+        droppedFrames.fetch_add(1);
+    }
+};
+
+struct RunResult {
+    double fps = 0;
+    uint64_t published = 0;
+    uint64_t dropped = 0;
+    uint64_t reads = 0;
+};
+
+static RunResult run_pool(const std::vector<Sample>& samples, uint32_t w, uint32_t h, const FrameGeometry& g,
+    int32_t threads, uint64_t frames) {
+    std::unique_ptr<BenchHost> host(new BenchHost());
+    host->width = w;
+    host->height = h;
+    host->geometry = g;
+    host->frames.reserve(kFrameSlotsPreallocated, g.out.frameBytes);
+
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> reads{ 0 };
+    std::atomic<uint64_t> backwards{ 0 };
+    std::thread reader([&]() { // a grab loop: pin, look, unpin
+        uint64_t last = 0;
+        while (!done.load()) {
+            int32_t slot = host->frames.pin_latest();
+            if (slot >= 0) {
+                const FrameSlot& fs = host->frames.slots[slot];
+                if (fs.seq < last || fs.data.size() != g.out.frameBytes) backwards.fetch_add(1);
+                last = fs.seq;
+                host->frames.unpin(slot);
+                reads.fetch_add(1);
+            }
+            std::this_thread::yield();
+        }
+    });
+
+    MjpegDecodePool pool(host->frames, *host);
+    CHECK(pool.start(threads, 1));
+    auto t0 = std::chrono::steady_clock::now();
+    for (uint64_t seq = 1; seq <= frames; ++seq) {
+        // A camera would drop here; the benchmark waits so every sample is decoded.
+        MjpegJob* job = nullptr;
+        while (!(job = pool.begin_submit())) std::this_thread::yield();
+        const Sample& s = samples[(seq - 1) % samples.size()];
+        job->data.assign(s.begin(), s.end());
+        job->seq = seq;
+        pool.end_submit(job);
+    }
+    while (host->publishedFrames.load() + host->droppedFrames.load() < frames) std::this_thread::yield();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    pool.stop();
+    done.store(true);
+    reader.join();
+
+    CHECK_MSG(host->outOfOrder.load() == 0, "%llu frames published out of order", (unsigned long long)host->outOfOrder.load());
+    CHECK_MSG(backwards.load() == 0, "%llu reads went backwards or were incomplete", (unsigned long long)backwards.load());
+    CHECK(host->lastSeq == frames);
+    for (int32_t i = 0; i < kFrameSlotCount; ++i) CHECK(host->frames.slots[i].pins.load() == 0);
+
+    RunResult r;
+    r.published = host->publishedFrames.load();
+    r.dropped = host->droppedFrames.load();
+    r.reads = reads.load();
+    r.fps = secs > 0 ? (double)r.published / secs : 0;
+    return r;
+}
+
+static bool parse_format(const char* name, OutFormat& fmt) {
+    static const struct { const char* name; OutFormat fmt; } kFormats[] = {
+        { "bgra", OutFormat::Bgra }, { "rgba", OutFormat::Rgba }, { "rgb24", OutFormat::Rgb24 },
+        { "gray8", OutFormat::Gray8 }, { "i420", OutFormat::I420 }, { "nv12", OutFormat::Nv12 },
+    };
+    for (const auto& f : kFormats) {
+        if (strcmp(name, f.name) == 0) { fmt = f.fmt; return true; }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    uint64_t frames = 300;
+    OutFormat fmt = OutFormat::Bgra;
+    uint32_t scaleW = 0, scaleH = 0;
+    std::vector<Sample> samples;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        if (a == "--frames" && i + 1 < argc) frames = strtoull(argv[++i], nullptr, 10);
+        else if (a == "--format" && i + 1 < argc) {
+            if (!parse_format(argv[++i], fmt)) { fprintf(stderr, "unknown format %s\n", argv[i]); return 2; }
+        }
+        else if (a == "--scale" && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ux%u", &scaleW, &scaleH) != 2) { fprintf(stderr, "bad --scale %s\n", argv[i]); return 2; }
+        }
+        else {
+            Sample s;
+            if (!read_file(argv[i], s)) { fprintf(stderr, "cannot read %s\n", argv[i]); return 2; }
+            samples.push_back(std::move(s));
+        }
+    }
+    if (frames == 0) frames = 1;
+
+    const bool recorded = !samples.empty();
+    if (!recorded)
+        for (uint32_t i = 0; i < 8; ++i) samples.push_back(encode_pattern(1280, 720, i));
+
+    uint32_t w = 0, h = 0;
+    if (!jpeg_size(samples[0], w, h)) { fprintf(stderr, "first sample is not a JPEG\n"); return 2; }
+    for (const Sample& s : samples) {
+        uint32_t sw = 0, sh = 0;
+        if (!jpeg_size(s, sw, sh) || sw != w || sh != h) { fprintf(stderr, "samples must all be %ux%u JPEGs\n", w, h); return 2; }
+    }
+
+    FrameGeometry g;
+    g.roiW = w;
+    g.roiH = h;
+    g.scaleW = scaleW;
+    g.scaleH = scaleH;
+    if (!calc_geometry(fmt, g)) { fprintf(stderr, "unsupported output size\n"); return 2; }
+
+    printf("bench_mjpeg_pool: %zu %s samples %ux%u -> %ux%u, %llu frames, %u hardware threads\n",
+        samples.size(), recorded ? "recorded" : "synthetic", w, h, g.out.width, g.out.height,
+        (unsigned long long)frames, std::thread::hardware_concurrency());
+    for (int32_t threads = 1; threads <= kMaxMjpegDecodeThreads; ++threads) {
+        RunResult r = run_pool(samples, w, h, g, threads, frames);
+        printf("  %d worker%s: %8.1f fps  (%llu published, %llu dropped, %llu reads)\n", threads, threads == 1 ? " " : "s",
+            r.fps, (unsigned long long)r.published, (unsigned long long)r.dropped, (unsigned long long)r.reads);
+        CHECK(r.published + r.dropped == frames);
+        CHECK(r.dropped == 0); // every sample decodes and the reader never holds more than one slot
+    }
+    return test_result("bench_mjpeg_pool");
+}
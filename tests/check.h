@@ -0,0 +1,30 @@
+#pragma once
+
+// Minimal assertion helpers shared by the portable unit tests. Each test binary returns
+// test_result() from main, so ctest sees a non-zero exit on any failed CHECK.
+
+#include <cstdio>
+
+static int g_checkFailures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+        ++g_checkFailures; \
+    } \
+} while (0)
+
+#define CHECK_MSG(cond, ...) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #cond); \
+        fprintf(stderr, __VA_ARGS__); \
+        fputc('\n', stderr); \
+        ++g_checkFailures; \
+    } \
+} while (0)
+
+static inline int test_result(const char* name) {
+    if (g_checkFailures) fprintf(stderr, "%s: %d check(s) failed\n", name, g_checkFailures);
+    else printf("%s: ok\n", name);
+    return g_checkFailures ? 1 : 0;
+}
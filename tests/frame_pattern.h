@@ -0,0 +1,41 @@
+#pragma once
+
+// Synthetic frames for the slot ring tests: every byte of a frame is derived from its seq,
+// so a reader can tell whether the slot it pinned was overwritten or only half written.
+
+#include "frame_exchange.h"
+
+#include <cstring>
+
+constexpr size_t kFrameBytes = 4 * 1024;
+
+static inline uint32_t width_for(uint64_t seq) { return (uint32_t)(seq % 1000) + 1; }
+
+static inline void fill_frame(FrameData& fd, uint64_t seq) {
+    fd.seq = seq;
+    fd.layout.width = width_for(seq);
+    fd.data.resize(kFrameBytes);
+    memset(fd.data.data(), (int)(seq & 0xFF), kFrameBytes);
+    memcpy(fd.data.data(), &seq, sizeof(seq));
+}
+
+// A write that fails halfway (decode error, stop): what the slot holds when it is given back.
+static inline void fill_half_frame(FrameData& fd, uint64_t seq) {
+    fd.seq = seq;
+    fd.layout.width = width_for(seq);
+    fd.data.resize(kFrameBytes);
+    memset(fd.data.data(), 0xEE, kFrameBytes / 2);
+}
+
+// True if the frame holds exactly what fill_frame wrote for its seq.
+static inline bool frame_consistent(const FrameData& fd) {
+    const uint64_t seq = fd.seq;
+    if (fd.layout.width != width_for(seq) || fd.data.size() != kFrameBytes) return false;
+    uint64_t stored = 0;
+    memcpy(&stored, fd.data.data(), sizeof(stored));
+    if (stored != seq) return false;
+    const uint8_t b = (uint8_t)(seq & 0xFF);
+    for (size_t i = sizeof(seq); i < kFrameBytes; ++i)
+        if (fd.data.data()[i] != b) return false;
+    return true;
+}
@@ -0,0 +1,451 @@
+// Golden-image tests for libcdshow/convert.cpp. Every conversion is compared byte for byte
+// against a straightforward per-pixel reference model of the documented math. ctest runs
+// this binary twice, once with the SIMD kernels and once with libcdshow_SIMD=0, so both
+// kernel sets are covered, including their scalar tails at odd widths.
+
+#include "convert.h"
+#include "check.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static const OutFormat kOutFormats[] = {
+    OutFormat::Bgra, OutFormat::Rgba, OutFormat::Rgb24, OutFormat::Gray8, OutFormat::I420, OutFormat::Nv12,
+};
+
+static const char* out_name(OutFormat f) {
+    switch (f) {
+    case OutFormat::Bgra: return "BGRA";
+    case OutFormat::Rgba: return "RGBA";
+    case OutFormat::Rgb24: return "RGB24";
+    case OutFormat::Gray8: return "GRAY8";
+    case OutFormat::I420: return "I420";
+    case OutFormat::Nv12: return "NV12";
+    }
+    return "?";
+}
+
+// ---- Synthetic native frames ----
+
+struct TestSource {
+    std::vector<uint8_t> bytes;
+    SrcFrame frame;
+    const char* name = "";
+};
+
+static uint32_t g_rng = 0x12345678u;
+
+static uint8_t next_byte() {
+    g_rng = g_rng * 1664525u + 1013904223u;
+    return (uint8_t)(g_rng >> 24);
+}
+
+static size_t packed_row_bytes(SrcFormat fmt, uint32_t width) {
+    switch (fmt) {
+    case SrcFormat::Rgb32: return (size_t)width * 4;
+    case SrcFormat::Rgb24: return (size_t)width * 3;
+    case SrcFormat::Yuy2:  return (size_t)((width + 1) / 2) * 4; // odd widths still carry the last pair
+    case SrcFormat::Nv12:  return (size_t)((width + 1) / 2) * 2; // chroma row is the wider one
+    }
+    return 0;
+}
+
+// Random contents (so clamping is exercised), padded stride, exactly sized buffer.
+static TestSource make_source(SrcFormat fmt, uint32_t width, uint32_t height, size_t pad, bool bottomUp) {
+    static const char* names[] = { "RGB32", "RGB24", "YUY2", "NV12" };
+    TestSource s;
+    s.name = names[(int)fmt];
+    size_t stride = packed_row_bytes(fmt, width) + pad;
+    size_t total = 0;
+    calc_src_frame_bytes(fmt, stride, height, total);
+    s.bytes.resize(total);
+    for (auto& b : s.bytes) b = next_byte();
+    s.frame.fmt = fmt;
+    s.frame.data = s.bytes.data();
+    s.frame.stride = stride;
+    s.frame.width = width;
+    s.frame.height = height;
+    s.frame.bottomUp = bottomUp;
+    return s;
+}
+
+// ---- Reference model ----
+
+static uint8_t ref_clamp(int v) { return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v)); }
+
+static void ref_yuv_to_bgra(int y, int u, int v, uint8_t* d) {
+    int c = y - 16, e = v - 128;
+    int dd = u - 128;
+    d[0] = ref_clamp((298 * c + 516 * dd + 128) >> 8);
+    d[1] = ref_clamp((298 * c - 100 * dd - 208 * e + 128) >> 8);
+    d[2] = ref_clamp((298 * c + 409 * e + 128) >> 8);
+    d[3] = 0xFF;
+}
+
+static uint8_t ref_y_to_gray(int y) { return ref_clamp((298 * (y - 16) + 128) >> 8); }
+
+static const uint8_t* ref_row(const SrcFrame& s, uint32_t y) {
+    return s.data + (size_t)(s.bottomUp ? s.height - 1 - y : y) * s.stride;
+}
+
+static const uint8_t* ref_chroma_row(const SrcFrame& s, uint32_t y) {
+    const uint8_t* uv = s.chroma ? s.chroma : s.data + s.stride * (size_t)s.height;
+    return uv + (size_t)(y / 2) * s.stride;
+}
+
+// Luma and chroma of one YUV source pixel.
+static void ref_yuv_at(const SrcFrame& s, uint32_t x, uint32_t y, int& Y, int& U, int& V) {
+    const uint8_t* row = ref_row(s, y);
+    if (s.fmt == SrcFormat::Yuy2) {
+        const uint8_t* pair = row + (size_t)(x / 2) * 4;
+        Y = pair[(x & 1) * 2]; U = pair[1]; V = pair[3];
+    }
+    else {
+        const uint8_t* uv = ref_chroma_row(s, y) + (size_t)(x / 2) * 2;
+        Y = row[x]; U = uv[0]; V = uv[1];
+    }
+}
+
+static std::vector<uint8_t> ref_to_bgra(const SrcFrame& s) {
+    std::vector<uint8_t> out((size_t)s.width * s.height * 4);
+    for (uint32_t y = 0; y < s.height; ++y) {
+        for (uint32_t x = 0; x < s.width; ++x) {
+            uint8_t* d = out.data() + ((size_t)y * s.width + x) * 4;
+            const uint8_t* row = ref_row(s, y);
+            switch (s.fmt) {
+            case SrcFormat::Rgb32: memcpy(d, row + (size_t)x * 4, 4); break;
+            case SrcFormat::Rgb24: memcpy(d, row + (size_t)x * 3, 3); d[3] = 0xFF; break;
+            case SrcFormat::Yuy2:
+            case SrcFormat::Nv12: {
+                int Y, U, V;
+                ref_yuv_at(s, x, y, Y, U, V);
+                ref_yuv_to_bgra(Y, U, V, d);
+                break;
+            }
+            }
+        }
+    }
+    return out;
+}
+
+// BGRA image -> any output layout.
+static std::vector<uint8_t> ref_pack(const std::vector<uint8_t>& bgra, uint32_t w, uint32_t h, const OutLayout& out) {
+    std::vector<uint8_t> dst(out.frameBytes);
+    auto px = [&](uint32_t x, uint32_t y) { return bgra.data() + ((size_t)y * w + x) * 4; };
+    for (uint32_t y = 0; y < h; ++y) {
+        uint8_t* o = dst.data() + (size_t)y * out.rowBytes;
+        for (uint32_t x = 0; x < w; ++x) {
+            const uint8_t* p = px(x, y);
+            switch (out.fmt) {
+            case OutFormat::Bgra: memcpy(o + (size_t)x * 4, p, 4); break;
+            case OutFormat::Rgba: o[x * 4] = p[2]; o[x * 4 + 1] = p[1]; o[x * 4 + 2] = p[0]; o[x * 4 + 3] = p[3]; break;
+            case OutFormat::Rgb24: o[x * 3] = p[2]; o[x * 3 + 1] = p[1]; o[x * 3 + 2] = p[0]; break;
+            case OutFormat::Gray8: o[x] = (uint8_t)((29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8); break;
+            case OutFormat::I420:
+            case OutFormat::Nv12:
+                o[x] = (uint8_t)(((66 * p[2] + 129 * p[1] + 25 * p[0] + 128) >> 8) + 16);
+                break;
+            }
+        }
+    }
+    if (out.fmt != OutFormat::I420 && out.fmt != OutFormat::Nv12) return dst;
+
+    const uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    uint8_t* c = dst.data() + out.rowBytes * h;
+    for (uint32_t cy = 0; cy < ch; ++cy) {
+        for (uint32_t cx = 0; cx < cw; ++cx) {
+            uint32_t x0 = cx * 2, x1 = (std::min)(x0 + 1, w - 1);
+            uint32_t y0 = cy * 2, y1 = (std::min)(y0 + 1, h - 1);
+            const uint8_t* q[4] = { px(x0, y0), px(x1, y0), px(x0, y1), px(x1, y1) };
+            int b = (q[0][0] + q[1][0] + q[2][0] + q[3][0] + 2) >> 2;
+            int g = (q[0][1] + q[1][1] + q[2][1] + q[3][1] + 2) >> 2;
+            int r = (q[0][2] + q[1][2] + q[2][2] + q[3][2] + 2) >> 2;
+            uint8_t u = ref_clamp(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            uint8_t v = ref_clamp(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            if (out.fmt == OutFormat::Nv12) {
+                c[((size_t)cy * cw + cx) * 2] = u;
+                c[((size_t)cy * cw + cx) * 2 + 1] = v;
+            }
+            else {
+                c[(size_t)cy * cw + cx] = u;
+                c[(size_t)cw * ch + (size_t)cy * cw + cx] = v;
+            }
+        }
+    }
+    return dst;
+}
+
+// Same-size conversion. YUV sources keep their own luma/chroma for GRAY8 and planar outputs.
+static std::vector<uint8_t> ref_direct(const SrcFrame& s, const OutLayout& out) {
+    const bool yuv = s.fmt == SrcFormat::Yuy2 || s.fmt == SrcFormat::Nv12;
+    const bool planar = out.fmt == OutFormat::I420 || out.fmt == OutFormat::Nv12;
+    if (!yuv || (out.fmt != OutFormat::Gray8 && !planar)) return ref_pack(ref_to_bgra(s), s.width, s.height, out);
+
+    const uint32_t w = s.width, h = s.height, cw = (w + 1) / 2, ch = (h + 1) / 2;
+    std::vector<uint8_t> dst(out.frameBytes);
+    for (uint32_t y = 0; y < h; ++y) {
+        for (uint32_t x = 0; x < w; ++x) {
+            int Y, U, V;
+            ref_yuv_at(s, x, y, Y, U, V);
+            dst[(size_t)y * out.rowBytes + x] = planar ? (uint8_t)Y : ref_y_to_gray(Y);
+        }
+    }
+    if (!planar) return dst;
+
+    uint8_t* c = dst.data() + out.rowBytes * h;
+    for (uint32_t cy = 0; cy < ch; ++cy) {
+        for (uint32_t cx = 0; cx < cw; ++cx) {
+            int u, v;
+            if (s.fmt == SrcFormat::Nv12) {
+                const uint8_t* uv = ref_chroma_row(s, cy * 2) + (size_t)cx * 2;
+                u = uv[0]; v = uv[1];
+            }
+            else {
+                const uint8_t* p0 = ref_row(s, cy * 2) + (size_t)cx * 4;
+                const uint8_t* p1 = ref_row(s, (std::min)(cy * 2 + 1, h - 1)) + (size_t)cx * 4;
+                u = (p0[1] + p1[1] + 1) >> 1;
+                v = (p0[3] + p1[3] + 1) >> 1;
+            }
+            if (out.fmt == OutFormat::Nv12) {
+                c[((size_t)cy * cw + cx) * 2] = (uint8_t)u;
+                c[((size_t)cy * cw + cx) * 2 + 1] = (uint8_t)v;
+            }
+            else {
+                c[(size_t)cy * cw + cx] = (uint8_t)u;
+                c[(size_t)cw * ch + (size_t)cy * cw + cx] = (uint8_t)v;
+            }
+        }
+    }
+    return dst;
+}
+
+// Box filter when shrinking 2x or more on both axes, bilinear otherwise (16.16 sample centres).
+static std::vector<uint8_t> ref_scale(const std::vector<uint8_t>& bgra, uint32_t w, uint32_t h, uint32_t ow, uint32_t oh) {
+    std::vector<uint8_t> out((size_t)ow * oh * 4);
+    if (w >= 2 * ow && h >= 2 * oh) {
+        for (uint32_t oy = 0; oy < oh; ++oy) {
+            uint32_t y0 = (uint32_t)((uint64_t)oy * h / oh);
+            uint32_t y1 = (std::max)((uint32_t)((uint64_t)(oy + 1) * h / oh), y0 + 1);
+            for (uint32_t ox = 0; ox < ow; ++ox) {
+                uint32_t x0 = (uint32_t)((uint64_t)ox * w / ow);
+                uint32_t x1 = (std::max)((uint32_t)((uint64_t)(ox + 1) * w / ow), x0 + 1);
+                uint32_t n = (x1 - x0) * (y1 - y0);
+                for (int c = 0; c < 4; ++c) {
+                    uint32_t sum = 0;
+                    for (uint32_t y = y0; y < y1; ++y)
+                        for (uint32_t x = x0; x < x1; ++x) sum += bgra[((size_t)y * w + x) * 4 + c];
+                    out[((size_t)oy * ow + ox) * 4 + c] = (uint8_t)((sum + n / 2) / n);
+                }
+            }
+        }
+        return out;
+    }
+
+    auto pos = [](uint32_t o, uint32_t in, uint32_t n, uint32_t& i0, uint32_t& frac) {
+        int64_t p = ((int64_t)(2 * (uint64_t)o + 1) * in * 65536) / (2 * (int64_t)n) - 32768;
+        if (p < 0) p = 0;
+        i0 = (uint32_t)(p >> 16);
+        frac = (uint32_t)((p >> 8) & 0xFF);
+        if (i0 >= in - 1) { i0 = in - 1; frac = 0; }
+    };
+    for (uint32_t oy = 0; oy < oh; ++oy) {
+        uint32_t y0, fy;
+        pos(oy, h, oh, y0, fy);
+        uint32_t y1 = fy ? y0 + 1 : y0;
+        for (uint32_t ox = 0; ox < ow; ++ox) {
+            uint32_t x0, fx;
+            pos(ox, w, ow, x0, fx);
+            uint32_t x1 = fx ? x0 + 1 : x0;
+            for (int c = 0; c < 4; ++c) {
+                auto at = [&](uint32_t x, uint32_t y) -> uint32_t { return bgra[((size_t)y * w + x) * 4 + c]; };
+                uint32_t top = at(x0, y0) * (256 - fx) + at(x1, y0) * fx;
+                uint32_t bot = at(x0, y1) * (256 - fx) + at(x1, y1) * fx;
+                out[((size_t)oy * ow + ox) * 4 + c] = (uint8_t)((top * (256 - fy) + bot * fy + 32768) >> 16);
+            }
+        }
+    }
+    return out;
+}
+
+// ---- Harness ----
+
+static ConvScratch g_scratch; // shared on purpose: scratch reuse across sizes must not leak state
+
+static void check_convert(const SrcFrame& src, const OutLayout& out, const std::vector<uint8_t>& expected, const char* what) {
+    const size_t guard = 64;
+    std::vector<uint8_t> dst(out.frameBytes + guard, 0xCD);
+    convert_frame(src, out, dst.data(), g_scratch);
+
+    size_t mismatch = out.frameBytes;
+    for (size_t i = 0; i < out.frameBytes; ++i) {
+        if (dst[i] != expected[i]) { mismatch = i; break; }
+    }
+    CHECK_MSG(mismatch == out.frameBytes, "%s: %ux%u -> %s %ux%u differs at byte %zu (got %u, want %u)",
+        what, src.width, src.height, out_name(out.fmt), out.width, out.height, mismatch,
+        mismatch < out.frameBytes ? dst[mismatch] : 0, mismatch < out.frameBytes ? expected[mismatch] : 0);
+    bool guardOk = std::all_of(dst.begin() + out.frameBytes, dst.end(), [](uint8_t b) { return b == 0xCD; });
+    CHECK_MSG(guardOk, "%s: %ux%u -> %s wrote past the frame", what, src.width, src.height, out_name(out.fmt));
+}
+
+// Widths straddle every kernel's vector step (4/8/16 pixels, 16 chroma pairs) and the
+// 256-pixel staging chunk, so each main loop and each tail path runs.
+static void test_same_size() {
+    static const uint32_t widths[] = { 1, 2, 3, 5, 6, 7, 8, 9, 15, 16, 17, 23, 31, 32, 33, 34, 47, 63, 64, 65, 100, 255, 256, 257, 513 };
+    static const uint32_t heights[] = { 1, 2, 3, 5 };
+    static const SrcFormat formats[] = { SrcFormat::Rgb32, SrcFormat::Rgb24, SrcFormat::Yuy2, SrcFormat::Nv12 };
+    for (SrcFormat sf : formats) {
+        for (uint32_t w : widths) {
+            for (uint32_t h : heights) {
+                bool rgb = sf == SrcFormat::Rgb32 || sf == SrcFormat::Rgb24;
+                for (int variant = 0; variant < (rgb ? 2 : 1); ++variant) {
+                    TestSource s = make_source(sf, w, h, (w & 1) ? 12 : 0, variant == 1);
+                    for (OutFormat of : kOutFormats) {
+                        OutLayout out;
+                        CHECK(calc_out_layout(of, w, h, out));
+                        check_convert(s.frame, out, ref_direct(s.frame, out), s.name);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Copies the roi of a native frame into a standalone top-down frame of the same format.
+static TestSource copy_roi(const TestSource& full, const FrameGeometry& g) {
+    const SrcFrame& f = full.frame;
+    TestSource c = make_source(f.fmt, g.roiW, g.roiH, 0, false);
+    size_t bpp = f.fmt == SrcFormat::Rgb32 ? 4 : f.fmt == SrcFormat::Rgb24 ? 3 : f.fmt == SrcFormat::Yuy2 ? 2 : 1;
+    size_t rowBytes = packed_row_bytes(f.fmt, g.roiW);
+    if (f.fmt == SrcFormat::Nv12) rowBytes = g.roiW; // luma row; chroma rows copied below
+    for (uint32_t y = 0; y < g.roiH; ++y)
+        memcpy(const_cast<uint8_t*>(c.frame.data) + (size_t)y * c.frame.stride, ref_row(f, g.roiY + y) + g.roiX * bpp, rowBytes);
+    if (f.fmt == SrcFormat::Nv12) {
+        uint8_t* uv = const_cast<uint8_t*>(c.frame.data) + c.frame.stride * (size_t)g.roiH;
+        for (uint32_t cy = 0; cy < (g.roiH + 1) / 2; ++cy)
+            memcpy(uv + (size_t)cy * c.frame.stride, ref_chroma_row(f, g.roiY + cy * 2) + g.roiX, packed_row_bytes(f.fmt, g.roiW));
+    }
+    return c;
+}
+
+static void test_roi() {
+    struct Roi { uint32_t x, y, w, h; };
+    static const Roi rois[] = { { 0, 0, 40, 30 }, { 2, 4, 17, 9 }, { 10, 6, 30, 24 }, { 38, 28, 2, 2 }, { 0, 2, 33, 1 } };
+    static const SrcFormat formats[] = { SrcFormat::Rgb32, SrcFormat::Rgb24, SrcFormat::Yuy2, SrcFormat::Nv12 };
+    for (SrcFormat sf : formats) {
+        for (int bottomUp = 0; bottomUp < 2; ++bottomUp) {
+            if (bottomUp && (sf == SrcFormat::Yuy2 || sf == SrcFormat::Nv12)) continue;
+            TestSource full = make_source(sf, 40, 30, 8, bottomUp != 0);
+            for (const Roi& r : rois) {
+                for (OutFormat of : kOutFormats) {
+                    FrameGeometry g;
+                    g.roiX = r.x; g.roiY = r.y; g.roiW = r.w; g.roiH = r.h;
+                    CHECK(calc_geometry(of, g));
+                    TestSource ref = copy_roi(full, g);
+                    check_convert(crop_src_frame(full.frame, g), g.out, ref_direct(ref.frame, g.out), "roi");
+                }
+            }
+        }
+    }
+}
+
+static void test_scaled() {
+    struct Case { uint32_t w, h, ow, oh; };
+    static const Case cases[] = {
+        { 64, 48, 16, 12 },   // box, exact 4x
+        { 65, 49, 20, 15 },   // box, uneven spans
+        { 640, 8, 10, 1 },    // box, 64x horizontally
+        { 128, 128, 2, 2 },   // box, kMaxDownscale on both axes
+        { 10, 10, 33, 17 },   // bilinear upscale, odd output
+        { 33, 17, 20, 15 },   // bilinear, shrinking less than 2x
+        { 2, 5, 7, 1 },       // bilinear, mixed axes
+        { 300, 3, 299, 3 },   // bilinear, wider than a staging chunk
+        { 1, 1, 5, 3 },       // single source pixel
+    };
+    static const SrcFormat formats[] = { SrcFormat::Rgb32, SrcFormat::Rgb24, SrcFormat::Yuy2, SrcFormat::Nv12 };
+    for (const Case& c : cases) {
+        for (SrcFormat sf : formats) {
+            TestSource s = make_source(sf, c.w, c.h, 4, sf == SrcFormat::Rgb24);
+            std::vector<uint8_t> scaled = ref_scale(ref_to_bgra(s.frame), c.w, c.h, c.ow, c.oh);
+            for (OutFormat of : kOutFormats) {
+                FrameGeometry g;
+                g.roiW = c.w; g.roiH = c.h; g.scaleW = c.ow; g.scaleH = c.oh;
+                CHECK(calc_geometry(of, g));
+                check_convert(crop_src_frame(s.frame, g), g.out, ref_pack(scaled, c.ow, c.oh, g.out), "scaled");
+            }
+        }
+    }
+
+    // ROI and scale together.
+    TestSource full = make_source(SrcFormat::Yuy2, 96, 64, 0, false);
+    FrameGeometry g;
+    g.roiX = 8; g.roiY = 6; g.roiW = 64; g.roiH = 40; g.scaleW = 21; g.scaleH = 13;
+    CHECK(calc_geometry(OutFormat::I420, g));
+    TestSource ref = copy_roi(full, g);
+    check_convert(crop_src_frame(full.frame, g), g.out, ref_pack(ref_scale(ref_to_bgra(ref.frame), 64, 40, 21, 13), 21, 13, g.out), "roi+scale");
+}
+
+// Hand-checked anchors so a shared mistake in model and kernels still shows up.
+static void test_known_pixels() {
+    // One YUY2 pair per colour: white, red (Y=81 U=90 V=240) and black.
+    const uint8_t white[4] = { 235, 128, 235, 128 };
+    const uint8_t red[4] = { 81, 90, 81, 240 };
+    const uint8_t black[4] = { 16, 128, 16, 128 };
+    struct Known { const uint8_t* yuy2; uint8_t b, g, r, gray; };
+    const Known known[] = { { white, 255, 255, 255, 255 }, { red, 0, 0, 255, 76 }, { black, 0, 0, 0, 0 } };
+    for (const Known& k : known) {
+        SrcFrame s;
+        s.fmt = SrcFormat::Yuy2; s.data = k.yuy2; s.stride = 4; s.width = 2; s.height = 1;
+        OutLayout bgra, gray;
+        calc_out_layout(OutFormat::Bgra, 2, 1, bgra);
+        calc_out_layout(OutFormat::Gray8, 2, 1, gray);
+        uint8_t px[8]{}, g8[2]{};
+        convert_frame(s, bgra, px, g_scratch);
+        CHECK(px[0] == k.b && px[1] == k.g && px[2] == k.r && px[3] == 0xFF);
+        CHECK(px[4] == k.b && px[5] == k.g && px[6] == k.r && px[7] == 0xFF);
+        convert_frame(s, gray, g8, g_scratch);
+        CHECK(g8[0] == k.gray && g8[1] == k.gray); // GRAY8 from YUV is luma only
+    }
+
+    // Bottom-up RGB24 row order and byte swap.
+    const uint8_t rgb[6] = { 1, 2, 3, 4, 5, 6 }; // row 0 in memory = bottom row
+    SrcFrame s;
+    s.fmt = SrcFormat::Rgb24; s.data = rgb; s.stride = 3; s.width = 1; s.height = 2; s.bottomUp = true;
+    OutLayout out;
+    calc_out_layout(OutFormat::Rgb24, 1, 2, out);
+    uint8_t o[6]{};
+    convert_frame(s, out, o, g_scratch);
+    const uint8_t want[6] = { 6, 5, 4, 3, 2, 1 };
+    CHECK(memcmp(o, want, 6) == 0);
+}
+
+static void test_layout_math() {
+    OutLayout l;
+    CHECK(calc_out_layout(OutFormat::I420, 5, 3, l));
+    CHECK(l.rowBytes == 5 && l.frameBytes == 15 + 2 * 3 * 2);
+    CHECK(calc_out_layout(OutFormat::Rgb24, 7, 2, l));
+    CHECK(l.rowBytes == 21 && l.frameBytes == 42);
+    CHECK(!calc_out_layout(OutFormat::Bgra, 0, 2, l));
+
+    size_t bytes = 0;
+    CHECK(calc_src_frame_bytes(SrcFormat::Nv12, 64, 5, bytes) && bytes == 64 * 5 + 64 * 3);
+    CHECK(calc_src_frame_bytes(SrcFormat::Yuy2, 64, 5, bytes) && bytes == 64 * 5);
+    CHECK(!calc_src_frame_bytes(SrcFormat::Yuy2, 0, 5, bytes));
+
+    FrameGeometry g;
+    g.roiW = 640; g.roiH = 480; g.scaleW = 10; g.scaleH = 8;
+    CHECK(calc_geometry(OutFormat::Bgra, g) && g.out.width == 10 && g.out.height == 8);
+    g.scaleW = 9; // 640 / 9 > kMaxDownscale
+    CHECK(!calc_geometry(OutFormat::Bgra, g));
+    g.scaleW = 0; g.scaleH = 0;
+    CHECK(calc_geometry(OutFormat::Nv12, g) && g.out.width == 640 && g.out.height == 480);
+}
+
+int main() {
+    test_layout_math();
+    test_known_pixels();
+    test_same_size();
+    test_roi();
+    test_scaled();
+    return test_result("test_convert");
+}
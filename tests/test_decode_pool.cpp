@@ -0,0 +1,120 @@
+// Stress test for MjpegDecodePool (libcdshow/decode_pool.h) with a synthetic decoder: several
+// workers claim slots and publish into one FrameExchange at once, finishing out of order and
+// failing some frames halfway, while readers pin the latest frame. Every frame a reader pins
+// must be intact, seqs must never go backwards, and every submitted job must end up either
+// published or dropped. Also built with -fsanitize=thread.
+
+#include "decode_pool.h"
+#include "frame_pattern.h"
+#include "check.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+constexpr uint64_t kJobs = 3000;
+constexpr int kReaders = 2;
+
+// Stands in for WIC: writes the synthetic frame for the job's seq. Takes a seq-dependent
+// number of yields so workers finish out of order, and fails every 11th frame after
+// scribbling over half the slot.
+class FakeSlotDecoder : public MjpegSlotDecoder {
+public:
+    bool decode(const MjpegJob& job, FrameSlot& fs) override {
+        for (uint64_t i = job.seq % 4; i > 0; --i) std::this_thread::yield();
+        if (job.seq % 11 == 0) {
+            fill_half_frame(fs, job.seq);
+            return false;
+        }
+        fill_frame(fs, job.seq);
+        return true;
+    }
+};
+
+struct FakeHost : MjpegDecodeHost {
+    FrameExchange& frames;
+    std::atomic<uint64_t> publishedFrames{ 0 };
+    std::atomic<uint64_t> droppedFrames{ 0 };
+    std::atomic<uint64_t> outOfOrder{ 0 };
+    uint64_t lastSeq = 0; // publish is serialised by the pool
+
+    explicit FakeHost(FrameExchange& f) : frames(f) {}
+
+    std::unique_ptr<MjpegSlotDecoder> make_decoder() override { return std::make_unique<FakeSlotDecoder>(); }
+
+    void publish(int32_t slot, const MjpegJob& job) override {
+        if (job.seq <= lastSeq) outOfOrder.fetch_add(1);
+        lastSeq = job.seq;
+        frames.end_write(slot);
+        publishedFrames.fetch_add(1);
+    }
+
+    void dropped(const MjpegJob&) override { droppedFrames.fetch_add(1); }
+};
+
+static void test_workers_publish_concurrently(int32_t threads) {
+    std::unique_ptr<FrameExchange> ex(new FrameExchange());
+    ex->reserve(kFrameSlotsPreallocated, kFrameBytes);
+    FakeHost host(*ex);
+    MjpegDecodePool pool(*ex, host);
+    CHECK(pool.start(threads, 1));
+    CHECK(pool.threads() == threads);
+
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> reads{ 0 }, torn{ 0 }, backwards{ 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < kReaders; ++i) {
+        readers.emplace_back([&]() {
+            uint64_t last = 0;
+            while (!done.load()) {
+                int32_t slot = ex->pin_latest();
+                if (slot >= 0) {
+                    const FrameSlot& fs = ex->slots[slot];
+                    if (!frame_consistent(fs)) torn.fetch_add(1);
+                    if (fs.seq < last) backwards.fetch_add(1);
+                    last = fs.seq;
+                    ex->unpin(slot);
+                    reads.fetch_add(1);
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    // Like submit_mjpeg_sample: a sample that finds no free job is dropped before it gets a seq.
+    uint64_t submitted = 0, busy = 0;
+    for (uint64_t sample = 0; sample < kJobs; ++sample) {
+        MjpegJob* job = pool.begin_submit();
+        if (!job) {
+            ++busy;
+            std::this_thread::yield();
+            continue;
+        }
+        job->seq = ++submitted;
+        pool.end_submit(job);
+    }
+    while (host.publishedFrames.load() + host.droppedFrames.load() < submitted) std::this_thread::yield();
+    pool.stop();
+    done.store(true);
+    for (auto& t : readers) t.join();
+
+    printf("test_decode_pool: %d workers: %llu submitted (%llu busy), %llu published, %llu dropped, %llu reads\n",
+        threads, (unsigned long long)submitted, (unsigned long long)busy,
+        (unsigned long long)host.publishedFrames.load(), (unsigned long long)host.droppedFrames.load(),
+        (unsigned long long)reads.load());
+    CHECK(host.publishedFrames.load() + host.droppedFrames.load() == submitted);
+    CHECK(host.droppedFrames.load() >= submitted / 11); // at least the failed decodes
+    CHECK_MSG(host.outOfOrder.load() == 0, "%llu frames published out of order", (unsigned long long)host.outOfOrder.load());
+    CHECK_MSG(torn.load() == 0, "%llu torn frames", (unsigned long long)torn.load());
+    CHECK_MSG(backwards.load() == 0, "%llu reads went backwards", (unsigned long long)backwards.load());
+    for (int32_t i = 0; i < kFrameSlotCount; ++i) CHECK(ex->slots[i].pins.load() == 0);
+    int32_t latest = ex->latest.load();
+    CHECK(latest >= 0 && frame_consistent(ex->slots[latest]));
+}
+
+int main() {
+    test_workers_publish_concurrently(2);
+    test_workers_publish_concurrently(kMaxMjpegDecodeThreads);
+    return test_result("test_decode_pool");
+}
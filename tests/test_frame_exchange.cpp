@@ -0,0 +1,303 @@
+// Stress test for the lock-free slot ring in libcdshow/frame_exchange.h: one synthetic
+// producer publishes numbered frames while several readers pin, verify and unpin the latest
+// one, a lease holder keeps slots pinned for a while, and another thread keeps reserving
+// slot memory. Every third frame is preceded by a write that is abandoned halfway. Every
+// frame a reader pins must be internally consistent (all bytes derived from its seq) and
+// seqs must never go backwards. A second run uses several producers, and the publish window
+// itself is replayed step by step. Also built with -fsanitize=thread.
+
+#include <functional>
+
+// Runs between end_write's two stores, so tests can act inside the publish window.
+struct FrameExchange;
+static std::function<void(FrameExchange*, int32_t)> g_publishHook; // set only while single-threaded
+#define CDS_EXCHANGE_PUBLISH_HOOK(exchange, slot) (g_publishHook ? g_publishHook(exchange, slot) : (void)0)
+
+#include "frame_pattern.h"
+#include "check.h"
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+constexpr uint64_t kFrames = 10000;
+constexpr int kReaders = 4;
+
+struct Counters {
+    std::atomic<uint64_t> published{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+    std::atomic<uint64_t> reads{ 0 };
+    std::atomic<uint64_t> torn{ 0 };
+    std::atomic<uint64_t> backwards{ 0 };
+};
+
+// A write that fails halfway (decode error, stop): the slot holds half a frame when it is
+// given back, and a reader that saw it as `latest` earlier must not end up pinning it.
+static void aborted_write(FrameExchange& ex, uint64_t seq) {
+    int32_t slot = ex.begin_write();
+    if (slot < 0) return;
+    fill_half_frame(ex.slots[slot], seq);
+    ex.abort_write(slot);
+}
+
+static void producer_main(FrameExchange& ex, Counters& c, std::atomic<bool>& done) {
+    for (uint64_t seq = 1; seq <= kFrames; ++seq) {
+        if (seq % 3 == 0) aborted_write(ex, seq);
+        int32_t slot = ex.begin_write();
+        if (slot < 0) {
+            c.dropped.fetch_add(1);
+            std::this_thread::yield();
+            continue;
+        }
+        fill_frame(ex.slots[slot], seq);
+        ex.end_write(slot);
+        c.published.fetch_add(1);
+        std::this_thread::yield(); // let readers interleave even on a single core
+    }
+    done.store(true);
+}
+
+static void reader_main(FrameExchange& ex, Counters& c, const std::atomic<bool>& done) {
+    uint64_t last = 0;
+    while (!done.load()) {
+        int32_t slot = ex.pin_latest();
+        if (slot < 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        const FrameSlot& fs = ex.slots[slot];
+        if (!frame_consistent(fs)) c.torn.fetch_add(1);
+        if (fs.seq < last) c.backwards.fetch_add(1);
+        last = fs.seq;
+        ex.unpin(slot);
+        c.reads.fetch_add(1);
+        std::this_thread::yield();
+    }
+}
+
+// Holds up to six pins at once, like an application sitting on cds_acquire_frame leases,
+// so the producer has to use the spare slots and sometimes drops frames.
+static void lease_main(FrameExchange& ex, Counters& c, const std::atomic<bool>& done) {
+    std::deque<int32_t> held;
+    uint32_t n = 0;
+    while (!done.load()) {
+        int32_t slot = ex.pin_latest();
+        if (slot >= 0) {
+            held.push_back(slot);
+            c.reads.fetch_add(1);
+        }
+        if (held.size() > 6 || (++n % 7) == 0) {
+            if (!held.empty()) {
+                if (!frame_consistent(ex.slots[held.front()])) c.torn.fetch_add(1); // still intact while pinned
+                ex.unpin(held.front());
+                held.pop_front();
+            }
+        }
+        std::this_thread::yield();
+    }
+    for (int32_t slot : held) ex.unpin(slot);
+}
+
+static void test_stress() {
+    std::unique_ptr<FrameExchange> ex(new FrameExchange());
+    ex->reserve(kFrameSlotsPreallocated, kFrameBytes);
+    Counters c;
+    std::atomic<bool> done{ false };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kReaders; ++i) threads.emplace_back(reader_main, std::ref(*ex), std::ref(c), std::cref(done));
+    threads.emplace_back(lease_main, std::ref(*ex), std::ref(c), std::cref(done));
+    threads.emplace_back([&]() { // output size changes while streaming
+        size_t bytes = kFrameBytes;
+        while (!done.load()) {
+            ex->reserve(kFrameSlotsPreallocated, bytes);
+            bytes = bytes >= 4 * kFrameBytes ? kFrameBytes : bytes * 2;
+            std::this_thread::yield();
+        }
+    });
+    while (c.reads.load() == 0) { // readers are running before the producer starts
+        int32_t slot = ex->begin_write();
+        fill_frame(ex->slots[slot], 0);
+        ex->end_write(slot);
+        std::this_thread::yield();
+    }
+    producer_main(*ex, c, done);
+    for (auto& t : threads) t.join();
+
+    printf("test_frame_exchange: %llu published, %llu dropped, %llu reads\n",
+        (unsigned long long)c.published.load(), (unsigned long long)c.dropped.load(), (unsigned long long)c.reads.load());
+    CHECK(c.published.load() + c.dropped.load() == kFrames);
+    CHECK(c.published.load() > 0 && c.reads.load() > 0);
+    CHECK_MSG(c.torn.load() == 0, "%llu torn frames", (unsigned long long)c.torn.load());
+    CHECK_MSG(c.backwards.load() == 0, "%llu reads went backwards", (unsigned long long)c.backwards.load());
+    for (int32_t i = 0; i < kFrameSlotCount; ++i) CHECK(ex->slots[i].pins.load() == 0);
+    int32_t latest = ex->latest.load();
+    CHECK(latest >= 0 && frame_consistent(ex->slots[latest]));
+}
+
+// Several producers publishing at once (like the MJPEG decode pool's workers) while slots are
+// reserved and writes are aborted: nothing may claim a slot that is being published, so every
+// frame a reader pins is intact. Seqs come from a shared counter, so order is not checked here.
+static void test_multi_producer() {
+    constexpr int kProducers = 3;
+    std::unique_ptr<FrameExchange> ex(new FrameExchange());
+    ex->reserve(kFrameSlotsPreallocated, kFrameBytes);
+    Counters c;
+    std::atomic<bool> done{ false };
+    std::atomic<uint64_t> nextSeq{ 1 };
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < kReaders; ++i) {
+        threads.emplace_back([&]() {
+            while (!done.load()) {
+                int32_t slot = ex->pin_latest();
+                if (slot >= 0) {
+                    if (!frame_consistent(ex->slots[slot])) c.torn.fetch_add(1);
+                    ex->unpin(slot);
+                    c.reads.fetch_add(1);
+                }
+                std::this_thread::yield();
+            }
+        });
+    }
+    threads.emplace_back([&]() {
+        size_t bytes = kFrameBytes;
+        while (!done.load()) {
+            ex->reserve(kFrameSlotCount, bytes);
+            bytes = bytes >= 4 * kFrameBytes ? kFrameBytes : bytes * 2;
+            std::this_thread::yield();
+        }
+    });
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&]() {
+            for (uint64_t seq; (seq = nextSeq.fetch_add(1)) <= kFrames;) {
+                if (seq % 3 == 0) aborted_write(*ex, seq);
+                int32_t slot = ex->begin_write();
+                if (slot < 0) {
+                    c.dropped.fetch_add(1);
+                    std::this_thread::yield();
+                    continue;
+                }
+                fill_frame(ex->slots[slot], seq);
+                ex->end_write(slot);
+                c.published.fetch_add(1);
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& t : producers) t.join();
+    done.store(true);
+    for (auto& t : threads) t.join();
+
+    printf("test_frame_exchange: %d producers: %llu published, %llu dropped, %llu reads\n", kProducers,
+        (unsigned long long)c.published.load(), (unsigned long long)c.dropped.load(), (unsigned long long)c.reads.load());
+    CHECK(c.published.load() + c.dropped.load() == kFrames);
+    CHECK_MSG(c.torn.load() == 0, "%llu torn frames", (unsigned long long)c.torn.load());
+    for (int32_t i = 0; i < kFrameSlotCount; ++i) CHECK(ex->slots[i].pins.load() == 0);
+    int32_t latest = ex->latest.load();
+    CHECK(latest >= 0 && frame_consistent(ex->slots[latest]));
+}
+
+// The interleaving the stress tests can only hit by luck, replayed in order: while a slot is
+// being published, a second producer tries to claim every free slot and then gives them back.
+// It must not get the one being published, and that frame must be what readers pin afterwards.
+static void test_publish_window() {
+    std::unique_ptr<FrameExchange> ex(new FrameExchange());
+    int32_t first = ex->begin_write();
+    fill_frame(ex->slots[first], 1);
+    ex->end_write(first);
+
+    int32_t slot = ex->begin_write();
+    CHECK(slot >= 0);
+    fill_frame(ex->slots[slot], 2);
+    bool hooked = false;
+    g_publishHook = [&](FrameExchange* e, int32_t i) {
+        hooked = true;
+        CHECK(e == ex.get() && i == slot);
+        std::vector<int32_t> claimed;
+        for (int32_t w; (w = e->begin_write()) >= 0;) {
+            CHECK_MSG(w != slot, "slot %d claimed while it was being published", w);
+            claimed.push_back(w);
+            memset(e->slots[w].data.data(), 0xEE, e->slots[w].data.size()); // a write that fails
+        }
+        for (int32_t w : claimed) e->abort_write(w);
+    };
+    ex->end_write(slot);
+    g_publishHook = nullptr;
+
+    CHECK(hooked);
+    int32_t pinned = ex->pin_latest();
+    CHECK(pinned == slot && ex->slots[pinned].seq == 2 && frame_consistent(ex->slots[pinned]));
+    ex->unpin(pinned);
+}
+
+// cds_set_output_roi/size grow the slots from the API thread while frames are published.
+// reserve() inside the publish window must leave the slot being published alone: growing it
+// would drop the frame the producer just wrote (FrameBuffer::reserve does not copy).
+static void test_reserve_during_publish() {
+    std::unique_ptr<FrameExchange> ex(new FrameExchange());
+    ex->reserve(kFrameSlotsPreallocated, kFrameBytes);
+    int32_t slot = ex->begin_write();
+    fill_frame(ex->slots[slot], 1);
+    const uint8_t* before = ex->slots[slot].data.data();
+    g_publishHook = [&](FrameExchange* e, int32_t) { e->reserve(kFrameSlotCount, 4 * kFrameBytes); };
+    ex->end_write(slot);
+    g_publishHook = nullptr;
+
+    CHECK(ex->slots[slot].data.data() == before);
+    int32_t pinned = ex->pin_latest();
+    CHECK(pinned == slot && frame_consistent(ex->slots[pinned]));
+    ex->unpin(pinned);
+    // Every other slot did grow.
+    for (int32_t i = 0; i < kFrameSlotCount; ++i) {
+        if (i != slot) CHECK(ex->slots[i].data.capacity() >= 4 * kFrameBytes);
+    }
+}
+
+// Single-threaded rules: nothing to pin before the first publish, the published slot is never
+// handed to the producer, and a fully pinned ring drops frames instead of blocking.
+static void test_rules() {
+    std::unique_ptr<FrameExchange> ex(new FrameExchange());
+    CHECK(ex->pin_latest() == -1);
+
+    std::vector<int32_t> pinned;
+    for (uint64_t seq = 1;; ++seq) {
+        int32_t s = ex->begin_write();
+        if (s < 0) break;
+        CHECK(s != ex->latest.load());
+        fill_frame(ex->slots[s], seq);
+        ex->end_write(s);
+        CHECK(ex->latest.load() == s);
+        pinned.push_back(ex->pin_latest());
+        CHECK(pinned.back() == s);
+    }
+    CHECK(pinned.size() == (size_t)kFrameSlotCount);
+    CHECK(ex->begin_write() == -1);
+
+    ex->unpin(pinned.front()); // oldest frame: free again
+    int32_t s = ex->begin_write();
+    CHECK(s == pinned.front());
+    ex->abort_write(s);
+    for (size_t i = 1; i < pinned.size(); ++i) ex->unpin(pinned[i]);
+
+    // The published slot stays off limits even when nobody pins it.
+    for (int i = 0; i < 2 * kFrameSlotCount; ++i) {
+        int32_t w = ex->begin_write();
+        CHECK(w >= 0 && w != ex->latest.load());
+        ex->abort_write(w);
+    }
+}
+
+int main() {
+    test_rules();
+    test_publish_window();
+    test_reserve_during_publish();
+    test_stress();
+    test_multi_producer();
+    return test_result("test_frame_exchange");
+}
@@ -0,0 +1,229 @@
+// Unit tests for libcdshow/frame_pool.cpp: size classes, free-list reuse, the cache limit and
+// large-page accounting against a fake backend, then FrameBuffer and the real system backend
+// (hugetlb/THP on Linux when the kernel offers it).
+
+#include "frame_pool.h"
+#include "check.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+// Counts calls and hands out malloc'd memory; "large" blocks are rounded to largePage.
+class FakeBackend : public PoolBackend {
+public:
+    size_t largePage = 64 * 1024;
+    bool privilege = true;
+    bool largeFails = false;
+    int allocations = 0;
+    int largeAllocations = 0;
+    int releases = 0;
+    std::set<uint8_t*> live;
+
+    size_t large_page_size() override { return largePage; }
+    bool enable_large_pages() override { return privilege; }
+
+    PoolBlock allocate(size_t bytes, bool large) override {
+        PoolBlock b;
+        if (large && !largeFails) {
+            bytes = (bytes + largePage - 1) / largePage * largePage;
+            b.largePages = true;
+            ++largeAllocations;
+        }
+        void* p = nullptr;
+        if (posix_memalign(&p, kPoolAlign, bytes) != 0) return PoolBlock{};
+        b.base = (uint8_t*)p;
+        b.bytes = bytes;
+        ++allocations;
+        live.insert(b.base);
+        return b;
+    }
+
+    void release(const PoolBlock& block) override {
+        CHECK(live.erase(block.base) == 1);
+        ++releases;
+        free(block.base);
+    }
+};
+
+static cds_buffer_pool_stats stats_of(FrameBufferPool& pool) {
+    cds_buffer_pool_stats st{};
+    pool.stats(st);
+    return st;
+}
+
+static void test_size_classes() {
+    CHECK(FrameBufferPool::size_class(0) == kPoolMinBlock);
+    CHECK(FrameBufferPool::size_class(1) == kPoolMinBlock);
+    CHECK(FrameBufferPool::size_class(4096) == 4096);
+    CHECK(FrameBufferPool::size_class(4097) == 5120);  // octave 4096, step 1024
+    CHECK(FrameBufferPool::size_class(8192) == 8192);
+    CHECK(FrameBufferPool::size_class(8193) == 10240); // octave 8192, step 2048
+    CHECK(FrameBufferPool::size_class(1920 * 1080 * 4) == 8388608);
+    CHECK(FrameBufferPool::size_class(1920 * 1080 * 3 / 2) == 3145728);
+
+    // Classes never shrink a request and stay within a quarter octave of it.
+    for (size_t n = 1; n < (64u << 20); n = n * 3 / 2 + 7) {
+        size_t c = FrameBufferPool::size_class(n);
+        CHECK_MSG(c >= n && (n <= kPoolMinBlock || c - n < n / 4 + 1), "size %zu -> class %zu", n, c);
+        CHECK(FrameBufferPool::size_class(c) == c);
+    }
+}
+
+static void test_reuse() {
+    FakeBackend be;
+    FrameBufferPool pool(be);
+    size_t cap = 0;
+    uint8_t* a = pool.acquire(5000, cap);
+    CHECK(a && cap == 5120 && ((uintptr_t)a % kPoolAlign) == 0);
+    memset(a, 0xAB, cap); // the header in front must survive a full-capacity write
+    pool.release(a);
+    CHECK(stats_of(pool).buffers_cached == 1 && stats_of(pool).bytes_cached == 5120);
+
+    size_t cap2 = 0;
+    uint8_t* b = pool.acquire(5100, cap2); // same class
+    CHECK(b == a && cap2 == cap);
+    uint8_t* c = pool.acquire(5000, cap2); // class is empty again: new block
+    CHECK(c && c != a);
+    uint8_t* d = pool.acquire(6000, cap2); // next class up
+    CHECK(d && cap2 == 6144);
+
+    cds_buffer_pool_stats st = stats_of(pool);
+    CHECK(st.allocations == 3 && st.reuses == 1);
+    CHECK(st.buffers_in_use == 3 && st.bytes_in_use == 5120 + 5120 + 6144);
+    CHECK(st.buffers_cached == 0 && st.bytes_cached == 0);
+
+    pool.release(b);
+    pool.release(c);
+    pool.release(d);
+    st = stats_of(pool);
+    CHECK(st.buffers_in_use == 0 && st.bytes_in_use == 0 && st.buffers_cached == 3);
+    CHECK(be.releases == 0);
+    pool.trim();
+    st = stats_of(pool);
+    CHECK(st.buffers_cached == 0 && st.bytes_cached == 0);
+    CHECK(be.releases == 3 && be.live.empty());
+    pool.release(nullptr);
+}
+
+static void test_cache_limit() {
+    FakeBackend be;
+    FrameBufferPool pool(be, 3 * 8192);
+    size_t cap = 0;
+    uint8_t* blocks[5];
+    for (auto& b : blocks) b = pool.acquire(8192, cap);
+    for (auto& b : blocks) pool.release(b);
+    // Only three fit under the limit; the rest went straight back to the backend.
+    cds_buffer_pool_stats st = stats_of(pool);
+    CHECK(st.buffers_cached == 3 && st.bytes_cached == 3 * 8192);
+    CHECK(be.releases == 2);
+    pool.trim();
+    CHECK(be.live.empty());
+}
+
+static void test_large_pages() {
+    FakeBackend be;
+    FrameBufferPool pool(be);
+    be.privilege = false;
+    CHECK(!pool.set_large_pages(true)); // stays off without the privilege
+    size_t cap = 0;
+    uint8_t* p = pool.acquire(200 * 1024, cap);
+    CHECK(be.largeAllocations == 0 && stats_of(pool).large_page_bytes == 0);
+    pool.release(p);
+    pool.trim();
+
+    be.privilege = true;
+    CHECK(pool.set_large_pages(true));
+    uint8_t* small = pool.acquire(16 * 1024, cap); // under one large page: ordinary memory
+    CHECK(be.largeAllocations == 0);
+    uint8_t* big = pool.acquire(200 * 1024, cap);
+    CHECK(be.largeAllocations == 1);
+    // 200 KiB -> class 224 KiB + header, rounded to whole 64 KiB pages = 256 KiB.
+    CHECK(cap == 256 * 1024 - kPoolAlign);
+    CHECK(stats_of(pool).large_page_bytes == cap);
+
+    // Large blocks go back to the free list of their size class, not their rounded capacity.
+    pool.release(big);
+    size_t cap2 = 0;
+    uint8_t* again = pool.acquire(210 * 1024, cap2);
+    CHECK(again == big && cap2 == cap && be.largeAllocations == 1);
+    pool.release(again);
+    pool.release(small);
+    pool.trim();
+    CHECK(stats_of(pool).large_page_bytes == 0 && be.live.empty());
+
+    // Backend falls back to ordinary memory: counted as such.
+    be.largeFails = true;
+    uint8_t* fallback = pool.acquire(200 * 1024, cap);
+    CHECK(fallback && stats_of(pool).large_page_bytes == 0);
+    pool.release(fallback);
+
+    CHECK(pool.set_large_pages(false));
+    pool.trim();
+    CHECK(be.live.empty());
+}
+
+static void test_frame_buffer() {
+    FrameBuffer a;
+    CHECK(a.empty() && a.data() == nullptr);
+    a.resize(1000);
+    CHECK(a.size() == 1000 && a.capacity() >= 1000 && ((uintptr_t)a.data() % kPoolAlign) == 0);
+    memset(a.data(), 7, a.size());
+
+    uint8_t* p = a.data();
+    a.resize(10); // shrinking keeps the block
+    CHECK(a.data() == p && a.size() == 10);
+    a.resize(1000);
+    CHECK(a.data() == p);
+
+    FrameBuffer b(a); // copy
+    CHECK(b.size() == 1000 && b.data() != a.data() && memcmp(a.data(), b.data(), 1000) == 0);
+
+    FrameBuffer c(std::move(b)); // move steals the block
+    CHECK(c.size() == 1000 && b.data() == nullptr && b.size() == 0);
+
+    c.reserve(1 << 20);
+    CHECK(c.capacity() >= (1u << 20) && c.size() == 1000);
+    a = std::move(c);
+    CHECK(a.capacity() >= (1u << 20));
+}
+
+// The real backend: ordinary blocks everywhere, huge pages on Linux when the kernel has them.
+static void test_system_backend() {
+    PoolBackend& be = system_pool_backend();
+    FrameBufferPool pool(be);
+    size_t cap = 0;
+    uint8_t* p = pool.acquire(3 << 20, cap);
+    CHECK(p && cap >= (3u << 20) && ((uintptr_t)p % kPoolAlign) == 0);
+    memset(p, 1, cap);
+    pool.release(p);
+    pool.trim();
+
+    if (!pool.set_large_pages(true)) {
+        printf("test_frame_pool: no huge pages on this system, large-page path skipped\n");
+        return;
+    }
+    const size_t lp = be.large_page_size();
+    CHECK(lp != 0);
+    p = pool.acquire(2 * lp, cap);
+    CHECK(p && ((uintptr_t)p % kPoolAlign) == 0);
+    CHECK_MSG(stats_of(pool).large_page_bytes == cap, "large_page_bytes %llu, capacity %zu",
+        (unsigned long long)stats_of(pool).large_page_bytes, cap);
+    CHECK((cap + kPoolAlign) % lp == 0);
+    CHECK(((uintptr_t)(p - kPoolAlign) % lp) == 0); // mapping starts on a huge page boundary
+    memset(p, 2, cap);
+    pool.release(p);
+    pool.trim();
+    CHECK(stats_of(pool).large_page_bytes == 0);
+    pool.set_large_pages(false);
+}
+
+int main() {
+    test_size_classes();
+    test_reuse();
+    test_cache_limit();
+    test_large_pages();
+    test_frame_buffer();
+    test_system_backend();
+    return test_result("test_frame_pool");
+}
@@ -0,0 +1,184 @@
+// Unit tests for run_session_loop (libcdshow/session_loop.h) against a scripted wait set
+// with a virtual clock: stop wakes, media events are drained, trigger polls keep their
+// cadence, and a poll interval changed while the loop is blocked takes effect on the next pass.
+
+#include "session_loop.h"
+#include "check.h"
+
+#include <functional>
+#include <vector>
+
+// Each wait() consumes one step. A step either lets the requested timeout run out (the
+// clock advances by it) or wakes early after `afterMs`. `during` runs while "blocked",
+// after the clock moved, like another thread calling into the library.
+struct WaitStep {
+    SessionWake wake = SessionWake::Timeout;
+    uint32_t afterMs = 0; // ignored for Timeout
+    std::function<void()> during;
+};
+
+class ScriptedWaitSet : public SessionWaitSet {
+public:
+    std::vector<WaitStep> steps;
+    std::vector<uint32_t> timeouts; // what the loop asked for, per wait
+    uint64_t clock = 1000;          // arbitrary non-zero start
+    size_t next = 0;
+
+    SessionWake wait(uint32_t timeoutMs) override {
+        timeouts.push_back(timeoutMs);
+        if (next >= steps.size()) return SessionWake::Stop; // script exhausted
+        const WaitStep& st = steps[next++];
+        if (st.wake == SessionWake::Timeout) {
+            CHECK_MSG(timeoutMs != kWaitForever, "wait %zu would block forever", timeouts.size());
+            if (timeoutMs != kWaitForever) clock += timeoutMs;
+        }
+        else {
+            CHECK_MSG(timeoutMs == kWaitForever || st.afterMs <= timeoutMs,
+                "wait %zu: early wake at %u ms after a %u ms timeout", timeouts.size(), st.afterMs, timeoutMs);
+            clock += st.afterMs;
+        }
+        if (st.during) st.during();
+        return st.wake;
+    }
+
+    uint64_t now_ms() override { return clock; }
+};
+
+struct LoopRun {
+    uint32_t interval = 0;
+    std::vector<uint64_t> polls;  // clock at each onPoll
+    std::vector<uint64_t> events; // clock at each onMediaEvent
+    uint32_t pollCostMs = 0;      // onPoll advances the clock by this much
+
+    void run(ScriptedWaitSet& waits) {
+        run_session_loop(waits,
+            [&]() { return interval; },
+            [&]() { events.push_back(waits.clock); },
+            [&]() { polls.push_back(waits.clock); waits.clock += pollCostMs; });
+    }
+};
+
+static WaitStep step(SessionWake wake, uint32_t afterMs = 0, std::function<void()> during = nullptr) {
+    WaitStep st;
+    st.wake = wake;
+    st.afterMs = afterMs;
+    st.during = std::move(during);
+    return st;
+}
+
+static void test_stop_wakes() {
+    // Without polling the loop blocks until stopped, and stops on the first Stop.
+    ScriptedWaitSet waits;
+    waits.steps = { step(SessionWake::Stop, 250) };
+    LoopRun r;
+    r.run(waits);
+    CHECK(waits.next == 1 && waits.timeouts.size() == 1);
+    CHECK(waits.timeouts[0] == kWaitForever);
+    CHECK(r.polls.empty() && r.events.empty());
+
+    // With polling, a stop in the middle of an interval ends the loop without another poll.
+    ScriptedWaitSet w2;
+    w2.steps = { step(SessionWake::Timeout), step(SessionWake::Stop, 2), step(SessionWake::Timeout) };
+    LoopRun r2;
+    r2.interval = 5;
+    r2.run(w2);
+    CHECK(w2.next == 2);
+    CHECK(r2.polls.size() == 2); // at start and after the first interval
+}
+
+static void test_media_events_drained() {
+    ScriptedWaitSet waits;
+    waits.steps = {
+        step(SessionWake::MediaEvent, 10),
+        step(SessionWake::MediaEvent, 0), // several queued back to back
+        step(SessionWake::Other, 3),      // window messages: nothing to drain
+        step(SessionWake::MediaEvent, 7),
+        step(SessionWake::Stop, 1),
+    };
+    LoopRun r;
+    r.run(waits);
+    CHECK(r.events.size() == 3);
+    CHECK(r.events == (std::vector<uint64_t>{ 1010, 1010, 1020 }));
+    for (uint32_t t : waits.timeouts) CHECK(t == kWaitForever);
+    CHECK(r.polls.empty());
+}
+
+static void test_poll_cadence() {
+    // Polls start immediately and then run every interval, whatever wakes in between.
+    ScriptedWaitSet waits;
+    waits.steps = {
+        step(SessionWake::Timeout),       // 1000 -> 1005
+        step(SessionWake::MediaEvent, 2), // 1007: the next poll stays due at 1010
+        step(SessionWake::Timeout),       // -> 1010
+        step(SessionWake::Other, 1),      // 1011
+        step(SessionWake::Timeout),       // -> 1015
+        step(SessionWake::Stop, 1),
+    };
+    LoopRun r;
+    r.interval = 5;
+    r.run(waits);
+    CHECK(r.polls == (std::vector<uint64_t>{ 1000, 1005, 1010, 1015 }));
+    CHECK(waits.timeouts == (std::vector<uint32_t>{ 5, 5, 3, 5, 4, 5 }));
+    CHECK(r.events == (std::vector<uint64_t>{ 1007 }));
+
+    // A slow poll does not eat into the next interval: it is measured from when the poll ended.
+    ScriptedWaitSet slow;
+    slow.steps = { step(SessionWake::Timeout), step(SessionWake::Timeout), step(SessionWake::Stop, 0) };
+    LoopRun rs;
+    rs.interval = 5;
+    rs.pollCostMs = 3;
+    rs.run(slow);
+    CHECK(rs.polls == (std::vector<uint64_t>{ 1000, 1008, 1016 }));
+    CHECK(slow.timeouts == (std::vector<uint32_t>{ 5, 5, 5 }));
+}
+
+static void test_interval_changes_mid_wait() {
+    // cds_set_trigger_poll_interval lowers the interval while the loop sleeps out a long
+    // one: after the next wake the loop must not keep waiting for the old deadline.
+    ScriptedWaitSet waits;
+    LoopRun r;
+    r.interval = 1000;
+    waits.steps = {
+        step(SessionWake::Other, 100, [&]() { r.interval = 5; }), // 1100
+        step(SessionWake::Timeout),                                 // -> 1105
+        step(SessionWake::Timeout),                                 // -> 1110
+        step(SessionWake::Stop, 0),
+    };
+    r.run(waits);
+    CHECK(waits.timeouts == (std::vector<uint32_t>{ 1000, 5, 5, 5 }));
+    CHECK(r.polls == (std::vector<uint64_t>{ 1000, 1105, 1110 }));
+
+    // Growing the interval keeps the deadline already promised.
+    ScriptedWaitSet grow;
+    LoopRun rg;
+    rg.interval = 5;
+    grow.steps = {
+        step(SessionWake::MediaEvent, 2, [&]() { rg.interval = 1000; }), // 1002
+        step(SessionWake::Timeout),                                       // -> 1005: poll
+        step(SessionWake::Stop, 0),
+    };
+    rg.run(grow);
+    CHECK(grow.timeouts == (std::vector<uint32_t>{ 5, 3, 1000 }));
+    CHECK(rg.polls == (std::vector<uint64_t>{ 1000, 1005 }));
+
+    // Turning polling off makes the loop block on events only.
+    ScriptedWaitSet off;
+    LoopRun ro;
+    ro.interval = 5;
+    off.steps = {
+        step(SessionWake::Other, 1, [&]() { ro.interval = 0; }),
+        step(SessionWake::MediaEvent, 500),
+        step(SessionWake::Stop, 0),
+    };
+    ro.run(off);
+    CHECK(off.timeouts == (std::vector<uint32_t>{ 5, kWaitForever, kWaitForever }));
+    CHECK(ro.polls.size() == 1 && ro.events.size() == 1);
+}
+
+int main() {
+    test_stop_wakes();
+    test_media_events_drained();
+    test_poll_cadence();
+    test_interval_changes_mid_wait();
+    return test_result("test_session_loop");
+}